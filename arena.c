@@ -0,0 +1,49 @@
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "arena.h"
+
+size_t arena_size(size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+int arena_reserve(struct arena *arena, size_t size)
+{
+    arena->used = 0;
+    if (size <= arena->capacity)
+        return 0;
+
+    // 旧内存中的数据不再需要，先释放再分配，不用realloc复制
+    free(arena->base);
+    arena->capacity = 0;
+    int ret = posix_memalign((void **)&arena->base, ARENA_ALIGNMENT, size);
+    if (ret != 0)
+    {
+        arena->base = NULL;
+        log_("posix_memalign %zu failed: %s\n", size, strerror(ret));
+        return -1;
+    }
+    arena->capacity = size;
+    return 0;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    size = arena_size(size);
+    if (size > arena->capacity - arena->used)
+        return NULL;
+
+    void *ptr = arena->base + arena->used;
+    arena->used += size;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+void arena_free(struct arena *arena)
+{
+    free(arena->base);
+    arena->base = NULL;
+    arena->capacity = 0;
+    arena->used = 0;
+}
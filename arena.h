@@ -0,0 +1,25 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_ALIGNMENT 64 // 每块按缓存行对齐，SIMD读写block和平面时不跨行
+
+// 一次分配的连续内存，按顺序切分给各缓冲，整体复用和释放，不单独释放其中的某一块
+struct arena
+{
+    uint8_t *base;
+    size_t capacity; // base已分配的大小
+    size_t used;     // 已切分的字节数
+};
+
+// 按ARENA_ALIGNMENT对齐后在arena中占用的大小，用于预先计算arena_reserve的总大小
+size_t arena_size(size_t size);
+// 清空arena，容量不足size时重新分配，之前切分的内存全部失效，成功返回0
+int arena_reserve(struct arena *arena, size_t size);
+// 从保留的内存中切分size字节并清0，超出容量返回NULL
+void *arena_alloc(struct arena *arena, size_t size);
+void arena_free(struct arena *arena);
+
+#endif
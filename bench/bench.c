@@ -0,0 +1,504 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "../log.h"
+#include "../jpeg_decoder.h"
+#include "encoder.h"
+#include "kernels.h"
+
+#define STAGE_PARSE 0
+#define STAGE_ENTROPY 1
+#define STAGE_IDCT 2
+#define STAGE_COLOR 3
+#define STAGE_TOTAL 4        // 不统计各阶段耗时时的整体解码，从解析到颜色转换
+#define STAGE_COEFFICIENTS 5 // 解析后只熵解码得到系数，见jpeg_decoder_decode_coefficients
+#define STAGE_COUNT 6
+
+static const char *stage_names[STAGE_COUNT] = {"parse", "entropy", "idct", "color", "total", "coefficients"};
+
+// -q时对比的IDCT方法，第一个为参考
+#define IDCT_COUNT 3
+static const int idct_methods[IDCT_COUNT] = {JPEG_IDCT_FLOAT, JPEG_IDCT_INT, JPEG_IDCT_FAST};
+static const char *idct_names[IDCT_COUNT] = {"float", "int", "fast"};
+#define PSNR_IDENTICAL 99.99 // 与参考完全一致时的PSNR，避免输出inf
+
+struct bench_image
+{
+    char name[64];
+    uint8_t *data;
+    size_t size;
+    int sampling;         // SAMPLING_444等，-1为未知
+    int quality;          // 生成时的质量，-1为未知
+    int restart_interval; // 每个restart interval的MCU个数
+};
+
+struct bench_options
+{
+    int run_count;
+    int thread_count;
+    int speculative;
+    int json;
+    int quality;     // 1时对比各IDCT方法与参考的误差，不统计各阶段耗时
+    double min_psnr; // -q时低于此PSNR算失败，0为不检查
+};
+
+void usage(const char *name)
+{
+    log_("%s [-n runs] [-j threads] [-e] [-f csv|json] [-q] [-t min_psnr] [-w dir] [-k] [file.jpg...]\n", name);
+    log_("  -n  timed runs per image and mode, default: 10\n");
+    log_("  -j  threads for decoding restart intervals in parallel, default: 1\n");
+    log_("  -e  speculative parallel entropy decoding for images without restart markers, needs -j\n");
+    log_("  -f  output format, one record per image and stage, default: csv\n");
+    log_("  -q  compare IDCT methods instead: PSNR and max error of int/fast against float, and decode throughput of each\n");
+    log_("  -t  with -q, fail if any method is below min_psnr dB on any image, implies -q\n");
+    log_("  -w  write the synthetic corpus as .jpg files to dir and exit\n");
+    log_("  -k  check that the SIMD IDCT and color conversion kernels match the scalar ones on random and extreme inputs, -n rounds x 1000, and exit\n");
+    log_("without files a synthetic corpus is generated: 4:4:4/4:2:2/4:2:0/4:4:0/gray at 1920x1080 with quality 50/90 and\n");
+    log_("restart intervals off/one MCU row, plus 4:2:0 quality 90 at 640x480, 3840x2160 and 7680x4320, and gray 640x480 with component id 3\n");
+}
+
+double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int add_synthetic(struct bench_image *images, int count, int width, int height, int sampling, int quality, int restart_rows, int component_id)
+{
+    uint8_t *RGB = synthesize_image(width, height);
+    if (!RGB)
+        return count;
+
+    struct encode_options options = {width, height, sampling, quality, 0, component_id};
+    int MCU_width = sampling == SAMPLING_422 || sampling == SAMPLING_420 ? 16 : 8;
+    options.restart_interval = restart_rows * ((width + MCU_width - 1) / MCU_width);
+
+    struct bench_image *image = &images[count];
+    image->data = encode_jpeg(RGB, &options, &image->size);
+    free(RGB);
+    if (!image->data)
+    {
+        log_("encode %dx%d %s failed\n", width, height, sampling_name(sampling));
+        return count;
+    }
+
+    char id[16] = "";
+    if (component_id > 1)
+        snprintf(id, sizeof(id), "_id%d", component_id);
+    snprintf(image->name, sizeof(image->name), "synthetic_%dx%d_%s_q%d%s%s", width, height, sampling_name(sampling), quality, restart_rows ? "_rst" : "", id);
+    image->sampling = sampling;
+    image->quality = quality;
+    image->restart_interval = options.restart_interval;
+    return count + 1;
+}
+
+#define SYNTHETIC_COUNT 24
+
+// 生成SYNTHETIC_COUNT张图像，返回成功生成的个数
+int build_corpus(struct bench_image *images)
+{
+    int count = 0;
+    int samplings[] = {SAMPLING_444, SAMPLING_422, SAMPLING_420, SAMPLING_440, SAMPLING_GRAY};
+    for (int i = 0; i < (int)(sizeof(samplings) / sizeof(samplings[0])); ++i)
+        for (int quality = 50; quality <= 90; quality += 40)
+            for (int restart_rows = 0; restart_rows <= 1; ++restart_rows)
+                count = add_synthetic(images, count, 1920, 1080, samplings[i], quality, restart_rows, 0);
+
+    count = add_synthetic(images, count, 640, 480, SAMPLING_420, 90, 0, 0);
+    count = add_synthetic(images, count, 3840, 2160, SAMPLING_420, 90, 0, 0);
+    count = add_synthetic(images, count, 7680, 4320, SAMPLING_420, 90, 0, 0);
+    count = add_synthetic(images, count, 640, 480, SAMPLING_GRAY, 90, 0, 3); // 单分量图像的分量id可以不是1
+    return count;
+}
+
+int load_file(struct bench_image *image, const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+    {
+        log_("fopen `%s` failed: %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    image->data = size > 0 ? malloc(size) : NULL;
+    image->size = image->data ? fread(image->data, 1, size, fp) : 0;
+    fclose(fp);
+    if (image->size == 0)
+    {
+        log_("read `%s` failed\n", filename);
+        free(image->data);
+        return -1;
+    }
+
+    const char *name = strrchr(filename, '/');
+    snprintf(image->name, sizeof(image->name), "%s", name ? name + 1 : filename);
+    image->sampling = -1;
+    image->quality = -1;
+    image->restart_interval = 0;
+    return 0;
+}
+
+int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// 解析并解码一次，返回总耗时，stats不为NULL时取各阶段耗时
+double decode_once(struct jpeg_decoder *dec, struct bench_image *image, uint8_t **RGB, size_t *RGB_size, struct jpeg_stats *stats)
+{
+    double start = now_seconds();
+    struct jpeg_info info;
+    if (jpeg_decoder_parse_headers(dec, image->data, image->size, &info) != 0)
+        return -1;
+
+    size_t size = (size_t)info.width * info.height * 3;
+    if (size > *RGB_size) // 只在第一次运行时分配，不计入后面的计时
+    {
+        free(*RGB);
+        *RGB = malloc(size);
+        *RGB_size = *RGB ? size : 0;
+        if (!*RGB)
+            return -1;
+    }
+    if (jpeg_decoder_decode(dec, *RGB, info.width * 3) != 0)
+        return -1;
+    double seconds = now_seconds() - start;
+
+    if (stats && jpeg_decoder_stats(dec, stats) != 0)
+        return -1;
+    return seconds;
+}
+
+// 解析并只解码系数一次，返回总耗时
+double decode_coefficients_once(struct jpeg_decoder *dec, struct bench_image *image)
+{
+    double start = now_seconds();
+    struct jpeg_info info;
+    struct jpeg_coefficients coefficients;
+    if (jpeg_decoder_parse_headers(dec, image->data, image->size, &info) != 0 || jpeg_decoder_decode_coefficients(dec, &coefficients) != 0)
+        return -1;
+    return now_seconds() - start;
+}
+
+void print_record(const struct bench_options *options, const struct bench_image *image, const struct jpeg_probe_info *probe,
+    int stage, double *seconds, int first)
+{
+    int n = options->run_count;
+    qsort(seconds, n, sizeof(double), compare_double);
+    double min = seconds[0], median = n % 2 ? seconds[n / 2] : (seconds[n / 2 - 1] + seconds[n / 2]) / 2;
+    double p99 = seconds[(99 * n + 99) / 100 - 1]; // nearest-rank
+    double megapixels = (double)probe->width * probe->height / 1e6;
+    const char *sampling = image->sampling >= 0 ? sampling_name(image->sampling) : "";
+    if (image->sampling < 0 && probe->component_count == 1)
+        sampling = "gray";
+    else if (image->sampling < 0 && probe->component_count == 3)
+    {
+        static const char *names[3][3] = {{"444", "440", ""}, {"422", "420", ""}, {"", "", ""}};
+        int h = probe->horizontal_sample_rates[0], v = probe->vertical_sample_rates[0];
+        sampling = h <= 2 && v <= 2 && probe->horizontal_sample_rates[1] == 1 && probe->vertical_sample_rates[1] == 1 ? names[h - 1][v - 1] : "";
+    }
+
+    if (options->json)
+    {
+        printf("%s  {\"image\": \"%s\", \"width\": %d, \"height\": %d, \"sampling\": \"%s\", \"quality\": %d, \"restart_interval\": %d, "
+               "\"bytes\": %zu, \"threads\": %d, \"stage\": \"%s\", \"runs\": %d, \"ms_min\": %.4f, \"ms_median\": %.4f, \"ms_p99\": %.4f, "
+               "\"mpps_best\": %.2f, \"mpps_median\": %.2f, \"mpps_p99\": %.2f}",
+            first ? "" : ",\n", image->name, probe->width, probe->height, sampling, image->quality, probe->restart_interval,
+            image->size, options->thread_count, stage_names[stage], n, min * 1e3, median * 1e3, p99 * 1e3,
+            megapixels / min, megapixels / median, megapixels / p99);
+        return;
+    }
+
+    printf("%s,%d,%d,%s,%d,%d,%zu,%d,%s,%d,%.4f,%.4f,%.4f,%.2f,%.2f,%.2f\n",
+        image->name, probe->width, probe->height, sampling, image->quality, probe->restart_interval,
+        image->size, options->thread_count, stage_names[stage], n, min * 1e3, median * 1e3, p99 * 1e3,
+        megapixels / min, megapixels / median, megapixels / p99);
+}
+
+// 先不统计各阶段耗时运行run_count次得到整体耗时和只解码系数的耗时，再统计耗时运行run_count次得到各阶段耗时，每种模式先预热一次
+int bench_image(const struct bench_options *options, struct bench_image *image, int *first)
+{
+    struct jpeg_probe_info probe;
+    if (jpeg_decoder_probe(image->data, image->size, &probe) != 0 || !probe.complete)
+    {
+        log_("probe `%s` failed\n", image->name);
+        return -1;
+    }
+
+    int ret = -1;
+    uint8_t *RGB = NULL;
+    size_t RGB_size = 0;
+    double *seconds[STAGE_COUNT] = {0};
+    struct jpeg_decoder *decoders[2] = {0};
+    for (int collect_stats = 0; collect_stats <= 1; ++collect_stats)
+    {
+        struct jpeg_decoder_options decoder_options = {0};
+        decoder_options.thread_count = options->thread_count;
+        decoder_options.collect_stats = collect_stats;
+        decoder_options.speculative = options->speculative;
+        decoders[collect_stats] = jpeg_decoder_create(&decoder_options);
+        if (!decoders[collect_stats])
+            goto end;
+    }
+    for (int stage = 0; stage < STAGE_COUNT; ++stage)
+    {
+        seconds[stage] = calloc(options->run_count, sizeof(double));
+        if (!seconds[stage])
+            goto end;
+    }
+
+    struct jpeg_stats stats;
+    if (decode_once(decoders[0], image, &RGB, &RGB_size, NULL) < 0)
+        goto end;
+    for (int i = 0; i < options->run_count; ++i)
+    {
+        if ((seconds[STAGE_TOTAL][i] = decode_once(decoders[0], image, &RGB, &RGB_size, NULL)) < 0)
+            goto end;
+    }
+
+    if (decode_coefficients_once(decoders[0], image) < 0)
+        goto end;
+    for (int i = 0; i < options->run_count; ++i)
+    {
+        if ((seconds[STAGE_COEFFICIENTS][i] = decode_coefficients_once(decoders[0], image)) < 0)
+            goto end;
+    }
+
+    // 编译时关闭了统计(JPEG_DECODER_NO_STATS)时只输出整体耗时和系数解码耗时
+    if (decode_once(decoders[1], image, &RGB, &RGB_size, NULL) < 0)
+        goto end;
+    int staged = jpeg_decoder_stats(decoders[1], &stats) == 0;
+    for (int i = 0; staged && i < options->run_count; ++i)
+    {
+        if (decode_once(decoders[1], image, &RGB, &RGB_size, &stats) < 0)
+            goto end;
+        seconds[STAGE_PARSE][i] = stats.parse_seconds;
+        seconds[STAGE_ENTROPY][i] = stats.entropy_seconds;
+        seconds[STAGE_IDCT][i] = stats.idct_seconds;
+        seconds[STAGE_COLOR][i] = stats.color_seconds;
+    }
+
+    for (int stage = 0; stage < STAGE_COUNT; ++stage)
+    {
+        if (!staged && stage != STAGE_TOTAL && stage != STAGE_COEFFICIENTS)
+            continue;
+        print_record(options, image, &probe, stage, seconds[stage], *first);
+        *first = 0;
+    }
+    fflush(stdout);
+    ret = 0;
+
+end:
+    if (ret != 0)
+        log_("decode `%s` failed\n", image->name);
+    for (int stage = 0; stage < STAGE_COUNT; ++stage)
+        free(seconds[stage]);
+    jpeg_decoder_destroy(decoders[0]);
+    jpeg_decoder_destroy(decoders[1]);
+    free(RGB);
+    return ret;
+}
+
+// 对每种IDCT方法预热一次再计时run_count次，输出与参考(float)相比的PSNR、最大误差和吞吐量，低于min_psnr返回1
+int quality_image(const struct bench_options *options, struct bench_image *image, int *first)
+{
+    struct jpeg_probe_info probe;
+    if (jpeg_decoder_probe(image->data, image->size, &probe) != 0 || !probe.complete)
+    {
+        log_("probe `%s` failed\n", image->name);
+        return -1;
+    }
+
+    int ret = -1;
+    uint8_t *RGBs[IDCT_COUNT] = {0};
+    size_t RGB_sizes[IDCT_COUNT] = {0};
+    double *seconds = calloc(options->run_count, sizeof(double));
+    struct jpeg_decoder_options decoder_options = {0};
+    struct jpeg_decoder *dec = NULL;
+    if (!seconds)
+        goto end;
+
+    int below = 0;
+    size_t size = (size_t)probe.width * probe.height * 3;
+    for (int m = 0; m < IDCT_COUNT; ++m)
+    {
+        decoder_options.thread_count = options->thread_count;
+        decoder_options.idct_method = idct_methods[m];
+        dec = jpeg_decoder_create(&decoder_options);
+        if (!dec || decode_once(dec, image, &RGBs[m], &RGB_sizes[m], NULL) < 0)
+            goto end;
+        for (int i = 0; i < options->run_count; ++i)
+        {
+            if ((seconds[i] = decode_once(dec, image, &RGBs[m], &RGB_sizes[m], NULL)) < 0)
+                goto end;
+        }
+        jpeg_decoder_destroy(dec);
+        dec = NULL;
+
+        double squared_error = 0;
+        int max_error = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            int error = abs(RGBs[m][i] - RGBs[0][i]);
+            squared_error += error * error;
+            max_error = error > max_error ? error : max_error;
+        }
+        double psnr = squared_error == 0 ? PSNR_IDENTICAL : 10 * log10(255.0 * 255.0 * size / squared_error);
+        if (psnr > PSNR_IDENTICAL)
+            psnr = PSNR_IDENTICAL;
+        int pass = options->min_psnr <= 0 || psnr >= options->min_psnr;
+        below += !pass;
+
+        int n = options->run_count;
+        qsort(seconds, n, sizeof(double), compare_double);
+        double median = n % 2 ? seconds[n / 2] : (seconds[n / 2 - 1] + seconds[n / 2]) / 2;
+        double megapixels = (double)probe.width * probe.height / 1e6;
+        if (options->json)
+            printf("%s  {\"image\": \"%s\", \"width\": %d, \"height\": %d, \"quality\": %d, \"threads\": %d, \"idct\": \"%s\", "
+                   "\"runs\": %d, \"ms_min\": %.4f, \"ms_median\": %.4f, \"mpps_median\": %.2f, \"psnr\": %.2f, \"max_error\": %d, \"pass\": %s}",
+                *first ? "" : ",\n", image->name, probe.width, probe.height, image->quality, options->thread_count, idct_names[m],
+                n, seconds[0] * 1e3, median * 1e3, megapixels / median, psnr, max_error, pass ? "true" : "false");
+        else
+            printf("%s,%d,%d,%d,%d,%s,%d,%.4f,%.4f,%.2f,%.2f,%d,%d\n",
+                image->name, probe.width, probe.height, image->quality, options->thread_count, idct_names[m],
+                n, seconds[0] * 1e3, median * 1e3, megapixels / median, psnr, max_error, pass);
+        *first = 0;
+        if (!pass)
+            log_("`%s` idct %s: PSNR %.2f dB below %.2f dB\n", image->name, idct_names[m], psnr, options->min_psnr);
+    }
+    fflush(stdout);
+    ret = below ? 1 : 0;
+
+end:
+    if (ret < 0)
+        log_("decode `%s` failed\n", image->name);
+    jpeg_decoder_destroy(dec);
+    for (int m = 0; m < IDCT_COUNT; ++m)
+        free(RGBs[m]);
+    free(seconds);
+    return ret;
+}
+
+int write_corpus(struct bench_image *images, int count, const char *dir)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        char filename[PATH_MAX] = {0};
+        snprintf(filename, PATH_MAX, "%s/%s.jpg", dir, images[i].name);
+        FILE *fp = fopen(filename, "wb");
+        if (!fp || fwrite(images[i].data, 1, images[i].size, fp) != images[i].size)
+        {
+            log_("write `%s` failed: %s\n", filename, strerror(errno));
+            if (fp)
+                fclose(fp);
+            return -1;
+        }
+        fclose(fp);
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench_options options = {10, 1, 0, 0, 0, 0};
+    const char *corpus_dir = NULL;
+    int kernels = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:j:ef:qt:w:k")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            options.run_count = atoi(optarg);
+            break;
+        case 'j':
+            options.thread_count = atoi(optarg);
+            break;
+        case 'e':
+            options.speculative = 1;
+            break;
+        case 'f':
+            if (strcmp(optarg, "json") != 0 && strcmp(optarg, "csv") != 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            options.json = strcmp(optarg, "json") == 0;
+            break;
+        case 'q':
+            options.quality = 1;
+            break;
+        case 't':
+            options.quality = 1;
+            options.min_psnr = atof(optarg);
+            break;
+        case 'w':
+            corpus_dir = optarg;
+            break;
+        case 'k':
+            kernels = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.run_count < 1 || options.thread_count < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (kernels)
+        return check_kernels(options.run_count * 1000) == 0 ? 0 : 1;
+
+    int capacity = optind < argc ? argc - optind : SYNTHETIC_COUNT;
+    struct bench_image *images = calloc(capacity, sizeof(struct bench_image));
+    int count = 0;
+    if (optind < argc)
+    {
+        for (int i = optind; i < argc; ++i)
+            if (load_file(&images[count], argv[i]) == 0)
+                ++count;
+    }
+    else
+    {
+        log_("generating synthetic corpus...\n");
+        count = build_corpus(images);
+    }
+
+    int failed_count = capacity - count;
+    if (corpus_dir)
+    {
+        failed_count += write_corpus(images, count, corpus_dir) != 0;
+        goto end;
+    }
+
+    int first = 1;
+    if (options.json)
+        printf("[\n");
+    else if (options.quality)
+        printf("image,width,height,quality,threads,idct,runs,ms_min,ms_median,mpps_median,psnr,max_error,pass\n");
+    else
+        printf("image,width,height,sampling,quality,restart_interval,bytes,threads,stage,runs,ms_min,ms_median,ms_p99,mpps_best,mpps_median,mpps_p99\n");
+    for (int i = 0; i < count; ++i)
+        failed_count += (options.quality ? quality_image(&options, &images[i], &first) : bench_image(&options, &images[i], &first)) != 0;
+    if (options.json)
+        printf("\n]\n");
+
+end:
+    for (int i = 0; i < count; ++i)
+        free(images[i].data);
+    free(images);
+    return failed_count == 0 ? 0 : 1;
+}
@@ -0,0 +1,475 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../log.h"
+#include "encoder.h"
+
+#define max(_a, _b) ((_a) > (_b) ? (_a) : (_b))
+#define min(_a, _b) ((_a) < (_b) ? (_a) : (_b))
+#define clip(_min, _max, _val) min(max((_min), (_val)), (_max))
+
+// zigzag顺序的第k个系数在8x8自然顺序中的下标
+static const uint8_t natural_order[64] = {
+    0, 1, 8, 16, 9, 2, 3, 10,
+    17, 24, 32, 25, 18, 11, 4, 5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13, 6, 7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+// Annex K.1的亮度和色度量化表，自然顺序
+static const uint8_t luminance_quantization[64] = {
+    16, 11, 10, 16, 24, 40, 51, 61,
+    12, 12, 14, 19, 26, 58, 60, 55,
+    14, 13, 16, 24, 40, 57, 69, 56,
+    14, 17, 22, 29, 51, 87, 80, 62,
+    18, 22, 37, 56, 68, 109, 103, 77,
+    24, 35, 55, 64, 81, 104, 113, 92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103, 99,
+};
+
+static const uint8_t chrominance_quantization[64] = {
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+};
+
+// Annex K.3的霍夫曼表：各码长的码字个数及按码字顺序排列的值
+static const uint8_t dc_luminance_bits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t dc_chrominance_bits[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t dc_values[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const uint8_t ac_luminance_bits[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D};
+static const uint8_t ac_luminance_values[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+    0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+    0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+    0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+    0xF9, 0xFA,
+};
+
+static const uint8_t ac_chrominance_bits[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t ac_chrominance_values[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+    0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+    0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+    0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+    0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+    0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+    0xF9, 0xFA,
+};
+
+// 按值索引的码字和码长
+struct huffman_code
+{
+    uint16_t codes[256];
+    uint8_t sizes[256];
+};
+
+struct bit_writer
+{
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    uint32_t buffer; // 待写出的bit，低bit_count位有效
+    int bit_count;
+    int failed; // 分配内存失败
+};
+
+const char *sampling_name(int sampling)
+{
+    switch (sampling)
+    {
+    case SAMPLING_444: return "444";
+    case SAMPLING_422: return "422";
+    case SAMPLING_420: return "420";
+    case SAMPLING_440: return "440";
+    case SAMPLING_GRAY: return "gray";
+    default: return "unknown";
+    }
+}
+
+// 线性同余，保证每次生成的图像相同
+static uint32_t next_random(uint32_t *state)
+{
+    *state = *state * 1664525 + 1013904223;
+    return *state >> 8;
+}
+
+uint8_t *synthesize_image(int width, int height)
+{
+    uint8_t *RGB = malloc((size_t)width * height * 3);
+    if (!RGB)
+    {
+        log_("malloc failed: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    uint32_t state = 1;
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            // 按相对坐标生成，不同分辨率下的内容相似
+            double u = (double)x / width, v = (double)y / height;
+            double r = 128 + 90 * sin(u * 9 + v * 4);
+            double g = 128 + 90 * sin(u * 3 - v * 7 + 1);
+            double b = 128 + 90 * cos((u + v) * 6);
+
+            // 右上为硬边缘的色块，左下为高频纹理，其余区域平滑
+            if (u > 0.5 && v < 0.5)
+            {
+                int checker = ((int)(u * 24) + (int)(v * 24)) % 2 ? 50 : -50;
+                r += checker;
+                b -= checker;
+            }
+            else if (u < 0.5 && v > 0.5)
+            {
+                double texture = 40 * sin(x * 0.9) * sin(y * 0.7);
+                r += texture;
+                g += texture;
+                b += texture;
+            }
+
+            int noise = (int)(next_random(&state) % 21) - 10;
+            uint8_t *pixel = RGB + ((size_t)y * width + x) * 3;
+            pixel[0] = clip(0, 255, (int)r + noise);
+            pixel[1] = clip(0, 255, (int)g + noise);
+            pixel[2] = clip(0, 255, (int)b + noise);
+        }
+    }
+
+    return RGB;
+}
+
+static void reserve(struct bit_writer *bw, size_t size)
+{
+    if (bw->size + size <= bw->capacity || bw->failed)
+        return;
+
+    size_t capacity = max(bw->capacity * 2, bw->size + size + 4096);
+    uint8_t *data = realloc(bw->data, capacity);
+    if (!data)
+    {
+        log_("realloc failed: %s\n", strerror(errno));
+        bw->failed = 1;
+        return;
+    }
+    bw->data = data;
+    bw->capacity = capacity;
+}
+
+static void put_byte(struct bit_writer *bw, uint8_t byte)
+{
+    reserve(bw, 1);
+    if (!bw->failed)
+        bw->data[bw->size++] = byte;
+}
+
+static void put_2bytes(struct bit_writer *bw, uint16_t value)
+{
+    put_byte(bw, value >> 8);
+    put_byte(bw, value & 0xFF);
+}
+
+// 写入压缩数据，0xFF后填充0x00
+static void put_bits(struct bit_writer *bw, uint32_t bits, int count)
+{
+    bw->buffer = (bw->buffer << count) | (bits & ((1U << count) - 1));
+    bw->bit_count += count;
+    while (bw->bit_count >= 8)
+    {
+        uint8_t byte = bw->buffer >> (bw->bit_count - 8);
+        put_byte(bw, byte);
+        if (byte == 0xFF)
+            put_byte(bw, 0x00);
+        bw->bit_count -= 8;
+    }
+}
+
+// restart interval或扫描结束时用1补齐最后一个字节
+static void flush_bits(struct bit_writer *bw)
+{
+    if (bw->bit_count > 0)
+        put_bits(bw, 0x7F, 8 - bw->bit_count);
+    bw->buffer = 0;
+}
+
+static void build_huffman_code(const uint8_t bits[16], const uint8_t *values, struct huffman_code *hc)
+{
+    memset(hc, 0, sizeof(struct huffman_code));
+    int code = 0, k = 0;
+    for (int length = 1; length <= 16; ++length)
+    {
+        for (int i = 0; i < bits[length - 1]; ++i, ++k)
+        {
+            hc->codes[values[k]] = code++;
+            hc->sizes[values[k]] = length;
+        }
+        code <<= 1;
+    }
+}
+
+static void write_DHT(struct bit_writer *bw, int ac_dc_type, int table_id, const uint8_t bits[16], const uint8_t *values)
+{
+    int count = 0;
+    for (int i = 0; i < 16; ++i)
+        count += bits[i];
+
+    put_2bytes(bw, 0xFFC4);
+    put_2bytes(bw, 2 + 1 + 16 + count);
+    put_byte(bw, ac_dc_type << 4 | table_id);
+    for (int i = 0; i < 16; ++i)
+        put_byte(bw, bits[i]);
+    for (int i = 0; i < count; ++i)
+        put_byte(bw, values[i]);
+}
+
+// IJG的质量缩放：50为原表，越小量化越粗
+static void scale_quantization(const uint8_t *base, int quality, uint16_t *table)
+{
+    quality = clip(1, 100, quality);
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    for (int i = 0; i < 64; ++i)
+        table[i] = clip(1, 255, (base[i] * scale + 50) / 100);
+}
+
+// 系数v的位数及其VLI编码
+static int vli_size(int v)
+{
+    int size = 0;
+    for (v = abs(v); v; v >>= 1)
+        ++size;
+    return size;
+}
+
+static void encode_block(struct bit_writer *bw, const float *pixels, const uint16_t *quantization,
+    const struct huffman_code *dc, const struct huffman_code *ac, int *dc_prediction)
+{
+    static float cosines[8][8];
+    static int cosines_ready = 0;
+    if (!cosines_ready)
+    {
+        for (int u = 0; u < 8; ++u)
+            for (int x = 0; x < 8; ++x)
+                cosines[u][x] = (u == 0 ? sqrtf(0.125f) : 0.5f) * cosf((2 * x + 1) * u * (float)M_PI / 16);
+        cosines_ready = 1;
+    }
+
+    // 可分离的正向DCT，先按行再按列
+    float rows[64], coefficients[64];
+    for (int y = 0; y < 8; ++y)
+        for (int u = 0; u < 8; ++u)
+        {
+            float sum = 0;
+            for (int x = 0; x < 8; ++x)
+                sum += cosines[u][x] * (pixels[y * 8 + x] - 128);
+            rows[y * 8 + u] = sum;
+        }
+    for (int v = 0; v < 8; ++v)
+        for (int u = 0; u < 8; ++u)
+        {
+            float sum = 0;
+            for (int y = 0; y < 8; ++y)
+                sum += cosines[v][y] * rows[y * 8 + u];
+            coefficients[v * 8 + u] = sum;
+        }
+
+    int quantized[64];
+    for (int k = 0; k < 64; ++k)
+    {
+        int index = natural_order[k];
+        quantized[k] = (int)lroundf(coefficients[index] / quantization[index]);
+    }
+
+    int diff = quantized[0] - *dc_prediction;
+    *dc_prediction = quantized[0];
+    int size = vli_size(diff);
+    put_bits(bw, dc->codes[size], dc->sizes[size]);
+    if (size > 0)
+        put_bits(bw, diff < 0 ? diff - 1 : diff, size);
+
+    int zero_count = 0;
+    for (int k = 1; k < 64; ++k)
+    {
+        if (quantized[k] == 0)
+        {
+            ++zero_count;
+            continue;
+        }
+        for (; zero_count >= 16; zero_count -= 16)
+            put_bits(bw, ac->codes[0xF0], ac->sizes[0xF0]);
+
+        size = vli_size(quantized[k]);
+        int symbol = zero_count << 4 | size;
+        put_bits(bw, ac->codes[symbol], ac->sizes[symbol]);
+        put_bits(bw, quantized[k] < 0 ? quantized[k] - 1 : quantized[k], size);
+        zero_count = 0;
+    }
+    if (zero_count > 0)
+        put_bits(bw, ac->codes[0x00], ac->sizes[0x00]); // EOB
+}
+
+uint8_t *encode_jpeg(const uint8_t *RGB, const struct encode_options *options, size_t *size)
+{
+    int width = options->width, height = options->height;
+    int component_count = options->sampling == SAMPLING_GRAY ? 1 : 3;
+    int first_id = options->component_id > 0 ? options->component_id : 1;
+    int horizontal_factor = options->sampling == SAMPLING_422 || options->sampling == SAMPLING_420 ? 2 : 1;
+    int vertical_factor = options->sampling == SAMPLING_420 || options->sampling == SAMPLING_440 ? 2 : 1;
+    int MCU_width = 8 * horizontal_factor, MCU_height = 8 * vertical_factor;
+    int horizontal_MCU_count = (width + MCU_width - 1) / MCU_width;
+    int vertical_MCU_count = (height + MCU_height - 1) / MCU_height;
+
+    // 全分辨率的YCbCr，取样时边缘之外复制最后一行/列
+    float *planes = malloc((size_t)width * height * 3 * sizeof(float));
+    if (!planes)
+    {
+        log_("malloc failed: %s\n", strerror(errno));
+        return NULL;
+    }
+    size_t plane_size = (size_t)width * height;
+    for (size_t i = 0; i < plane_size; ++i)
+    {
+        float r = RGB[i * 3], g = RGB[i * 3 + 1], b = RGB[i * 3 + 2];
+        planes[i] = 0.299f * r + 0.587f * g + 0.114f * b;
+        planes[plane_size + i] = -0.168736f * r - 0.331264f * g + 0.5f * b + 128;
+        planes[plane_size * 2 + i] = 0.5f * r - 0.418688f * g - 0.081312f * b + 128;
+    }
+
+    uint16_t quantizations[2][64];
+    scale_quantization(luminance_quantization, options->quality, quantizations[0]);
+    scale_quantization(chrominance_quantization, options->quality, quantizations[1]);
+    struct huffman_code codes[2][2]; // [亮度/色度][DC/AC]
+    build_huffman_code(dc_luminance_bits, dc_values, &codes[0][0]);
+    build_huffman_code(ac_luminance_bits, ac_luminance_values, &codes[0][1]);
+    build_huffman_code(dc_chrominance_bits, dc_values, &codes[1][0]);
+    build_huffman_code(ac_chrominance_bits, ac_chrominance_values, &codes[1][1]);
+
+    struct bit_writer bw = {0};
+    put_2bytes(&bw, 0xFFD8);
+    put_2bytes(&bw, 0xFFE0); // JFIF 1.01，无缩略图
+    put_2bytes(&bw, 16);
+    const uint8_t JFIF[14] = {'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+    for (int i = 0; i < 14; ++i)
+        put_byte(&bw, JFIF[i]);
+
+    for (int table_id = 0; table_id < (component_count == 1 ? 1 : 2); ++table_id)
+    {
+        put_2bytes(&bw, 0xFFDB);
+        put_2bytes(&bw, 2 + 1 + 64);
+        put_byte(&bw, table_id);
+        for (int k = 0; k < 64; ++k)
+            put_byte(&bw, quantizations[table_id][natural_order[k]]);
+    }
+
+    put_2bytes(&bw, 0xFFC0);
+    put_2bytes(&bw, 2 + 6 + component_count * 3);
+    put_byte(&bw, 8);
+    put_2bytes(&bw, height);
+    put_2bytes(&bw, width);
+    put_byte(&bw, component_count);
+    for (int i = 0; i < component_count; ++i)
+    {
+        put_byte(&bw, first_id + i);
+        put_byte(&bw, i == 0 ? horizontal_factor << 4 | vertical_factor : 0x11);
+        put_byte(&bw, i == 0 ? 0 : 1);
+    }
+
+    write_DHT(&bw, 0, 0, dc_luminance_bits, dc_values);
+    write_DHT(&bw, 1, 0, ac_luminance_bits, ac_luminance_values);
+    if (component_count > 1)
+    {
+        write_DHT(&bw, 0, 1, dc_chrominance_bits, dc_values);
+        write_DHT(&bw, 1, 1, ac_chrominance_bits, ac_chrominance_values);
+    }
+
+    if (options->restart_interval > 0)
+    {
+        put_2bytes(&bw, 0xFFDD);
+        put_2bytes(&bw, 4);
+        put_2bytes(&bw, options->restart_interval);
+    }
+
+    put_2bytes(&bw, 0xFFDA);
+    put_2bytes(&bw, 2 + 1 + component_count * 2 + 3);
+    put_byte(&bw, component_count);
+    for (int i = 0; i < component_count; ++i)
+    {
+        put_byte(&bw, first_id + i);
+        put_byte(&bw, i == 0 ? 0x00 : 0x11);
+    }
+    put_byte(&bw, 0);
+    put_byte(&bw, 63);
+    put_byte(&bw, 0);
+
+    int dc_predictions[3] = {0};
+    int MCU_count = horizontal_MCU_count * vertical_MCU_count;
+    for (int k = 0; k < MCU_count && !bw.failed; ++k)
+    {
+        if (options->restart_interval > 0 && k > 0 && k % options->restart_interval == 0)
+        {
+            flush_bits(&bw);
+            put_2bytes(&bw, 0xFFD0 + (k / options->restart_interval - 1) % 8);
+            memset(dc_predictions, 0, sizeof(dc_predictions));
+        }
+
+        int MCU_x = k % horizontal_MCU_count * MCU_width, MCU_y = k / horizontal_MCU_count * MCU_height;
+        for (int component = 0; component < component_count; ++component)
+        {
+            // 色度每个样本为horizontal_factor x vertical_factor个像素的平均
+            int h = component == 0 ? horizontal_factor : 1, v = component == 0 ? vertical_factor : 1;
+            int step_x = component == 0 ? 1 : horizontal_factor, step_y = component == 0 ? 1 : vertical_factor;
+            const float *plane = planes + plane_size * component;
+            for (int block_i = 0; block_i < v; ++block_i)
+            {
+                for (int block_j = 0; block_j < h; ++block_j)
+                {
+                    float pixels[64];
+                    for (int i = 0; i < 64; ++i)
+                    {
+                        int x0 = MCU_x + (block_j * 8 + i % 8) * step_x, y0 = MCU_y + (block_i * 8 + i / 8) * step_y;
+                        float sum = 0;
+                        for (int dy = 0; dy < step_y; ++dy)
+                            for (int dx = 0; dx < step_x; ++dx)
+                                sum += plane[(size_t)min(y0 + dy, height - 1) * width + min(x0 + dx, width - 1)];
+                        pixels[i] = sum / (step_x * step_y);
+                    }
+                    int table = component == 0 ? 0 : 1;
+                    encode_block(&bw, pixels, quantizations[table], &codes[table][0], &codes[table][1], &dc_predictions[component]);
+                }
+            }
+        }
+    }
+    flush_bits(&bw);
+    put_2bytes(&bw, 0xFFD9);
+    free(planes);
+
+    if (bw.failed)
+    {
+        free(bw.data);
+        return NULL;
+    }
+    *size = bw.size;
+    return bw.data;
+}
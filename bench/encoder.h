@@ -0,0 +1,31 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SAMPLING_444 0
+#define SAMPLING_422 1
+#define SAMPLING_420 2
+#define SAMPLING_440 3
+#define SAMPLING_GRAY 4
+
+struct encode_options
+{
+    int width;
+    int height;
+    int sampling;         // SAMPLING_444等
+    int quality;          // 1~100，按IJG的方法缩放Annex K的量化表
+    int restart_interval; // 每个restart interval的MCU个数，0为不写DRI
+    int component_id;     // 第一个分量的id，其余依次加1，0为默认的1；用于生成分量id不是1的灰度图像
+};
+
+const char *sampling_name(int sampling);
+
+// 生成带平滑渐变、硬边缘、高频纹理和噪声的RGB24测试图像，内容只由宽高决定
+uint8_t *synthesize_image(int width, int height);
+
+// 用Annex K的霍夫曼表把RGB24编码为baseline JPEG，返回malloc的数据，失败返回NULL
+uint8_t *encode_jpeg(const uint8_t *RGB, const struct encode_options *options, size_t *size);
+
+#endif
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <string.h>
+#include "../log.h"
+#include "../simd.h"
+#include "../idct.h"
+#include "../color.h"
+#include "../jpeg_decoder.h"
+#include "kernels.h"
+
+#define MAX_WIDTH 80 // 颜色转换测试的最大行宽，覆盖各SIMD宽度的整块和尾部
+#define GUARD 16     // 输出之后的保护字节，检查内核不越界写
+
+// 24x8灰度图像，量化表全为1，交流表中0x08(8位系数)的码字1位、EOB 2位、0x07(7位系数)3位
+// 三个block的直流为0，第1个交流系数依次为200、-200、100：前两个码字加系数正好9位，系数超出合并表能存的范围
+static const uint8_t long_AC_jpeg[] = {
+    0xFF, 0xD8, 0xFF, 0xDB, 0x00, 0x43, 0x00, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0xFF, 0xC0, 0x00, 0x0B, 0x08, 0x00, 0x08, 0x00, 0x18,
+    0x01, 0x01, 0x11, 0x00, 0xFF, 0xC4, 0x00, 0x14, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xC4, 0x00, 0x16, 0x10, 0x01,
+    0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08,
+    0x00, 0x07, 0xFF, 0xDA, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3F, 0x00, 0x32, 0x20, 0xDE, 0x6C,
+    0x97, 0xFF, 0xD9,
+};
+static const int16_t long_AC_values[3] = {200, -200, 100};
+
+// xorshift，固定种子，每次运行的输入相同
+static uint32_t random_state = 2463534242u;
+
+static uint32_t next_random()
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+// 第round轮的系数块：稀疏小系数、稠密的合法范围系数、int16极值各占一部分
+static void random_block(int16_t block[64], int round)
+{
+    memset(block, 0, 64 * sizeof(int16_t));
+    switch (round % 4)
+    {
+    case 0: // 实际图像中常见的只有少量低频系数
+        block[0] = (int16_t)(next_random() % 2048) - 1024;
+        for (int i = next_random() % 10; i > 0; --i)
+            block[next_random() % 64] = (int16_t)(next_random() % 512) - 256;
+        break;
+    case 1: // 反量化后的合法范围
+        for (int i = 0; i < 64; ++i)
+            block[i] = (int16_t)(next_random() % 4096) - 2048;
+        break;
+    case 2: // 全范围随机
+        for (int i = 0; i < 64; ++i)
+            block[i] = (int16_t)next_random();
+        break;
+    default: // 极值，每项取-32768/32767/0之一
+        for (int i = 0; i < 64; ++i)
+        {
+            static const int16_t extremes[3] = {-32768, 32767, 0};
+            block[i] = extremes[next_random() % 3];
+        }
+        break;
+    }
+}
+
+// 对比method方法在level级别的实现与纯C实现，返回不一致的块数
+static int check_idct(int method, int level, int round_count)
+{
+    idct_func reference = idct_get(method, SIMD_NONE), kernel = idct_get(method, level);
+    int mismatch_count = 0;
+    for (int round = 0; round < round_count; ++round)
+    {
+        int16_t block[64] __attribute__((aligned(32)));
+        int16_t input[64] __attribute__((aligned(32)));
+        uint8_t expected[8 * 16], actual[8 * 16]; // stride为16，检查每行之后的字节不被改写
+        random_block(block, round);
+        memset(expected, 0xA5, sizeof(expected));
+        memset(actual, 0xA5, sizeof(actual));
+
+        memcpy(input, block, sizeof(block));
+        reference(input, expected, 16);
+        memcpy(input, block, sizeof(block));
+        kernel(input, actual, 16);
+        if (memcmp(expected, actual, sizeof(expected)) != 0)
+            ++mismatch_count;
+    }
+
+    return mismatch_count;
+}
+
+// 对比level级别的颜色转换与纯C实现，各行宽1~MAX_WIDTH都测，返回不一致的行数
+static int check_color(int level, int round_count)
+{
+    color_convert_func reference = color_get(SIMD_NONE), kernel = color_get(level);
+    int mismatch_count = 0;
+    for (int round = 0; round < round_count; ++round)
+    {
+        int width = round % MAX_WIDTH + 1;
+        int extreme = round / MAX_WIDTH % 4 == 3; // 每4轮行宽中有1轮只用0/255，检查限幅
+        uint8_t Y[MAX_WIDTH], Cb[MAX_WIDTH], Cr[MAX_WIDTH];
+        uint8_t expected[MAX_WIDTH * 3 + GUARD], actual[MAX_WIDTH * 3 + GUARD];
+        for (int i = 0; i < width; ++i)
+        {
+            Y[i] = extreme ? (next_random() & 1) * 255 : (uint8_t)next_random();
+            Cb[i] = extreme ? (next_random() & 1) * 255 : (uint8_t)next_random();
+            Cr[i] = extreme ? (next_random() & 1) * 255 : (uint8_t)next_random();
+        }
+        memset(expected, 0xA5, sizeof(expected));
+        memset(actual, 0xA5, sizeof(actual));
+
+        reference(Y, Cb, Cr, expected, width);
+        kernel(Y, Cb, Cr, actual, width);
+        if (memcmp(expected, actual, width * 3 + GUARD) != 0)
+            ++mismatch_count;
+    }
+
+    return mismatch_count;
+}
+
+// 解析一次long_AC_jpeg，依次解码系数、像素、再解码一次像素，同一次解析的多次解码都应从扫描开头开始
+// 系数与long_AC_values一致、两次像素都与纯C IDCT的结果一致时返回0
+static int check_long_AC()
+{
+    int ret = -1;
+    struct jpeg_info info;
+    struct jpeg_coefficients result;
+    struct jpeg_decoder *dec = jpeg_decoder_create(NULL);
+    if (!dec || jpeg_decoder_parse_headers(dec, long_AC_jpeg, sizeof(long_AC_jpeg), &info) != 0 ||
+        jpeg_decoder_decode_coefficients(dec, &result) != 0)
+        goto end;
+    for (int i = 0; i < 3; ++i)
+    {
+        int16_t expected[64] = {[1] = long_AC_values[i]};
+        if (memcmp(result.planes[0] + i * 64, expected, sizeof(expected)) != 0)
+            goto end;
+    }
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        uint8_t RGB[8 * 24 * 3];
+        if (jpeg_decoder_decode(dec, RGB, 24 * 3) != 0)
+            goto end;
+        for (int i = 0; i < 3; ++i)
+        {
+            int16_t block[64] __attribute__((aligned(32))) = {[1] = long_AC_values[i]};
+            uint8_t expected[64];
+            idct_get(IDCT_METHOD_INT, SIMD_NONE)(block, expected, 8);
+            for (int k = 0; k < 64; ++k)
+            {
+                if (RGB[(k / 8 * 24 + i * 8 + k % 8) * 3] != expected[k])
+                    goto end;
+            }
+        }
+    }
+    ret = 0;
+
+end:
+    jpeg_decoder_destroy(dec);
+    return ret;
+}
+
+int check_kernels(int round_count)
+{
+    simd_init();
+    idct_init();
+
+    static const int methods[2] = {IDCT_METHOD_INT, IDCT_METHOD_FAST};
+    int failed_count = 0;
+    for (int level = SIMD_SSE2; level <= SIMD_AVX2; ++level)
+    {
+        if (level > simd_level())
+        {
+            printf("%s: not supported by this CPU, skipped\n", simd_name(level));
+            continue;
+        }
+
+        for (int i = 0; i < 2; ++i)
+        {
+            // 该级别没有专门实现时idct_get返回较低级别的实现，与纯C对比同样有效
+            int mismatch_count = check_idct(methods[i], level, round_count);
+            printf("idct %s %s: %d/%d blocks mismatched\n", idct_method_name(methods[i]), simd_name(level), mismatch_count, round_count);
+            failed_count += mismatch_count != 0;
+        }
+
+        int mismatch_count = check_color(level, round_count);
+        printf("color %s: %d/%d rows mismatched\n", simd_name(level), mismatch_count, round_count);
+        failed_count += mismatch_count != 0;
+    }
+
+    // 霍夫曼合并查找表的边界和同一次解析的多次解码，与SIMD级别无关
+    int failed = check_long_AC() != 0;
+    printf("huffman long AC, coefficients then pixels twice: %s\n", failed ? "mismatched" : "ok");
+    failed_count += failed;
+
+    if (failed_count)
+        log_("%d kernels differ from the scalar implementation\n", failed_count);
+    return failed_count;
+}
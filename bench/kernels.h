@@ -0,0 +1,8 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+// 用随机和极端输入对比各SIMD内核与纯C实现的输出，应逐位一致；CPU不支持的级别跳过
+// 返回输出不一致的内核个数
+int check_kernels(int round_count);
+
+#endif
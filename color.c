@@ -0,0 +1,234 @@
+#include <stddef.h>
+#include "color.h"
+#include "simd.h"
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+#define clip_pixel(_val) ((_val) < 0 ? 0 : (_val) > 255 ? 255 : (_val))
+
+// JFIF定义的转换系数，放大2^16倍：
+// R = Y + 1.40200 * (Cr - 128)
+// G = Y - 0.34414 * (Cb - 128) - 0.71414 * (Cr - 128)
+// B = Y + 1.77200 * (Cb - 128)
+#define FIX_1_40200 91881
+#define FIX_0_34414 22554
+#define FIX_0_71414 46802
+#define FIX_1_77200 116130
+#define ONE_HALF (1 << 15)
+
+#ifdef SIMD_X86
+static void color_convert_sse2(const uint8_t *Y, const uint8_t *Cb, const uint8_t *Cr, uint8_t *RGB, int width);
+static void color_convert_avx2(const uint8_t *Y, const uint8_t *Cb, const uint8_t *Cr, uint8_t *RGB, int width);
+#endif
+
+// level一般传simd_level()，也可以传更低的级别以强制使用对应实现
+color_convert_func color_get(int level)
+{
+#ifdef SIMD_X86
+    if (level >= SIMD_AVX2)
+        return color_convert_avx2;
+    if (level >= SIMD_SSE2)
+        return color_convert_sse2;
+#endif
+    return color_convert;
+}
+
+const char *upsample_method_name(int method)
+{
+    switch (method)
+    {
+    case UPSAMPLE_NEAREST: return "nearest";
+    case UPSAMPLE_FANCY: return "fancy";
+    default: return "unknown";
+    }
+}
+
+void color_convert(const uint8_t *Y, const uint8_t *Cb, const uint8_t *Cr, uint8_t *RGB, int width)
+{
+    for (int i = 0; i < width; ++i)
+    {
+        int cb = Cb[i] - 128;
+        int cr = Cr[i] - 128;
+        int R = Y[i] + ((FIX_1_40200 * cr + ONE_HALF) >> 16);
+        int G = Y[i] + ((-FIX_0_34414 * cb - FIX_0_71414 * cr + ONE_HALF) >> 16);
+        int B = Y[i] + ((FIX_1_77200 * cb + ONE_HALF) >> 16);
+
+        *RGB++ = clip_pixel(R);
+        *RGB++ = clip_pixel(G);
+        *RGB++ = clip_pixel(B);
+    }
+}
+
+void gray_convert(const uint8_t *Y, uint8_t *RGB, int width)
+{
+    for (int i = 0; i < width; ++i)
+    {
+        *RGB++ = Y[i];
+        *RGB++ = Y[i];
+        *RGB++ = Y[i];
+    }
+}
+
+void upsample_nearest(const uint8_t *in, uint8_t *out, int in_width, int factor)
+{
+    for (int i = 0; i < in_width; ++i)
+    {
+        for (int j = 0; j < factor; ++j)
+        {
+            *out++ = in[i];
+        }
+    }
+}
+
+// 每个输入采样生成左右两个输出，分别按3:1与左、右相邻的采样加权，两端的相邻采样取自身
+void upsample_h2v1_fancy(const uint8_t *in, uint8_t *out, int in_width)
+{
+    for (int i = 0; i < in_width; ++i)
+    {
+        int left = in[i > 0 ? i - 1 : i];
+        int right = in[i < in_width - 1 ? i + 1 : i];
+        *out++ = (in[i] * 3 + left + 1) >> 2;
+        *out++ = (in[i] * 3 + right + 2) >> 2;
+    }
+}
+
+void upsample_h1v2_fancy(const uint8_t *near, const uint8_t *far, uint8_t *out, int in_width, int bias)
+{
+    for (int i = 0; i < in_width; ++i)
+    {
+        out[i] = (near[i] * 3 + far[i] + bias) >> 2;
+    }
+}
+
+// 先在垂直方向按3:1求列和，再在水平方向对列和按3:1加权，共除以16
+void upsample_h2v2_fancy(const uint8_t *near, const uint8_t *far, uint8_t *out, int in_width)
+{
+    int last = near[0] * 3 + far[0];
+    int current = last;
+    for (int i = 0; i < in_width; ++i)
+    {
+        int next = i < in_width - 1 ? near[i + 1] * 3 + far[i + 1] : current;
+        *out++ = (current * 3 + last + 8) >> 4;
+        *out++ = (current * 3 + next + 7) >> 4;
+        last = current;
+        current = next;
+    }
+}
+
+#ifdef SIMD_X86
+
+// 以下SIMD实现与color_convert结果逐位相同
+// 乘数超出int16范围，拆成整数倍和小数部分，例如91881 = 65536 + 26345，
+// (65536 * Y + 91881 * cr + ONE_HALF) >> 16 = Y + cr + ((26345 * cr + ONE_HALF) >> 16)
+// 小数部分用madd对(cb, cr)交错的16位数据一次算出两项之和
+#define PAIR(_cb, _cr) (int)(((uint32_t)(_cr) << 16) | ((_cb) & 0xFFFF))
+#define R_PAIR PAIR(0, FIX_1_40200 - 65536)                  // R = Y + cr + (...)
+#define G_PAIR PAIR(-FIX_0_34414, 65536 - FIX_0_71414)       // G = Y - cr + (...)
+#define B_PAIR PAIR(FIX_1_77200 - 131072, 0)                 // B = Y + 2 * cb + (...)
+
+// 8个像素：y/cb/cr为16位，cb/cr已减128，返回8个16位结果
+__attribute__((target("sse2"))) static inline __m128i fraction_sse2(__m128i cb, __m128i cr, int pair)
+{
+    __m128i coef = _mm_set1_epi32(pair);
+    __m128i half = _mm_set1_epi32(ONE_HALF);
+    __m128i lo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(cb, cr), coef), half), 16);
+    __m128i hi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(cb, cr), coef), half), 16);
+    return _mm_packs_epi32(lo, hi);
+}
+
+// 8个像素转换为R/G/B各8个16位值
+__attribute__((target("sse2"))) static inline void convert8_sse2(__m128i y, __m128i cb, __m128i cr, __m128i *r, __m128i *g, __m128i *b)
+{
+    *r = _mm_add_epi16(_mm_add_epi16(y, cr), fraction_sse2(cb, cr, R_PAIR));
+    *g = _mm_add_epi16(_mm_sub_epi16(y, cr), fraction_sse2(cb, cr, G_PAIR));
+    *b = _mm_add_epi16(_mm_add_epi16(y, _mm_add_epi16(cb, cb)), fraction_sse2(cb, cr, B_PAIR));
+}
+
+__attribute__((target("sse2"))) static void color_convert_sse2(const uint8_t *Y, const uint8_t *Cb, const uint8_t *Cr, uint8_t *RGB, int width)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i center = _mm_set1_epi16(128);
+    uint8_t r[16], g[16], b[16];
+
+    int i = 0;
+    for (; i + 16 <= width; i += 16)
+    {
+        __m128i y = _mm_loadu_si128((__m128i *)(Y + i));
+        __m128i cb = _mm_loadu_si128((__m128i *)(Cb + i));
+        __m128i cr = _mm_loadu_si128((__m128i *)(Cr + i));
+
+        __m128i r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+        convert8_sse2(_mm_unpacklo_epi8(y, zero), _mm_sub_epi16(_mm_unpacklo_epi8(cb, zero), center), _mm_sub_epi16(_mm_unpacklo_epi8(cr, zero), center), &r_lo, &g_lo, &b_lo);
+        convert8_sse2(_mm_unpackhi_epi8(y, zero), _mm_sub_epi16(_mm_unpackhi_epi8(cb, zero), center), _mm_sub_epi16(_mm_unpackhi_epi8(cr, zero), center), &r_hi, &g_hi, &b_hi);
+
+        // 饱和打包到0~255；SSE2没有字节重排指令，交错成RGB24用标量完成
+        _mm_storeu_si128((__m128i *)r, _mm_packus_epi16(r_lo, r_hi));
+        _mm_storeu_si128((__m128i *)g, _mm_packus_epi16(g_lo, g_hi));
+        _mm_storeu_si128((__m128i *)b, _mm_packus_epi16(b_lo, b_hi));
+        for (int j = 0; j < 16; ++j)
+        {
+            *RGB++ = r[j];
+            *RGB++ = g[j];
+            *RGB++ = b[j];
+        }
+    }
+
+    color_convert(Y + i, Cb + i, Cr + i, RGB, width - i);
+}
+
+__attribute__((target("avx2"))) static inline __m256i fraction_avx2(__m256i cb, __m256i cr, int pair)
+{
+    __m256i coef = _mm256_set1_epi32(pair);
+    __m256i half = _mm256_set1_epi32(ONE_HALF);
+    __m256i lo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(cb, cr), coef), half), 16);
+    __m256i hi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(cb, cr), coef), half), 16);
+    return _mm256_packs_epi32(lo, hi); // unpack与packs都在128位内进行，像素顺序保持不变
+}
+
+// 16位的16个值饱和打包为16个字节
+__attribute__((target("avx2"))) static inline __m128i pack16_avx2(__m256i v)
+{
+    return _mm_packus_epi16(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+}
+
+__attribute__((target("avx2"))) static void color_convert_avx2(const uint8_t *Y, const uint8_t *Cb, const uint8_t *Cr, uint8_t *RGB, int width)
+{
+    __m256i center = _mm256_set1_epi16(128);
+
+    // 16个像素的R/G/B交错为48字节，每16字节输出由三个分量各自重排后合并，-1处填0
+    const __m128i shuffle_r0 = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+    const __m128i shuffle_g0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+    const __m128i shuffle_b0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i shuffle_r1 = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+    const __m128i shuffle_g1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+    const __m128i shuffle_b1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+    const __m128i shuffle_r2 = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+    const __m128i shuffle_g2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+    const __m128i shuffle_b2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+
+    int i = 0;
+    for (; i + 16 <= width; i += 16)
+    {
+        __m256i y = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(Y + i)));
+        __m256i cb = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(Cb + i))), center);
+        __m256i cr = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *)(Cr + i))), center);
+
+        __m128i r = pack16_avx2(_mm256_add_epi16(_mm256_add_epi16(y, cr), fraction_avx2(cb, cr, R_PAIR)));
+        __m128i g = pack16_avx2(_mm256_add_epi16(_mm256_sub_epi16(y, cr), fraction_avx2(cb, cr, G_PAIR)));
+        __m128i b = pack16_avx2(_mm256_add_epi16(_mm256_add_epi16(y, _mm256_add_epi16(cb, cb)), fraction_avx2(cb, cr, B_PAIR)));
+
+        __m128i out0 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, shuffle_r0), _mm_shuffle_epi8(g, shuffle_g0)), _mm_shuffle_epi8(b, shuffle_b0));
+        __m128i out1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, shuffle_r1), _mm_shuffle_epi8(g, shuffle_g1)), _mm_shuffle_epi8(b, shuffle_b1));
+        __m128i out2 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, shuffle_r2), _mm_shuffle_epi8(g, shuffle_g2)), _mm_shuffle_epi8(b, shuffle_b2));
+        _mm_storeu_si128((__m128i *)RGB, out0);
+        _mm_storeu_si128((__m128i *)(RGB + 16), out1);
+        _mm_storeu_si128((__m128i *)(RGB + 32), out2);
+        RGB += 48;
+    }
+
+    color_convert(Y + i, Cb + i, Cr + i, RGB, width - i);
+}
+
+#endif
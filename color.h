@@ -0,0 +1,28 @@
+#ifndef COLOR_H
+#define COLOR_H
+
+#include <stdint.h>
+
+#define UPSAMPLE_FANCY 0   // 三角滤波，按3:1加权距离最近的两个色度采样，默认
+#define UPSAMPLE_NEAREST 1 // 最近邻，直接复制色度采样
+
+// 一行全分辨率的YCbCr转RGB24，结果限幅到0~255
+typedef void (*color_convert_func)(const uint8_t *Y, const uint8_t *Cb, const uint8_t *Cr, uint8_t *RGB, int width);
+
+color_convert_func color_get(int level);
+const char *upsample_method_name(int method);
+
+void color_convert(const uint8_t *Y, const uint8_t *Cb, const uint8_t *Cr, uint8_t *RGB, int width);
+void gray_convert(const uint8_t *Y, uint8_t *RGB, int width);
+
+// 以下上采样函数的in_width均为输入(色度)的采样个数
+// 水平方向放大factor倍，每个采样复制factor次
+void upsample_nearest(const uint8_t *in, uint8_t *out, int in_width, int factor);
+// 水平2倍三角滤波
+void upsample_h2v1_fancy(const uint8_t *in, uint8_t *out, int in_width);
+// 垂直2倍三角滤波，near为距离输出行较近的输入行，far为较远的输入行；输出行在near上方时bias为1，下方时为2
+void upsample_h1v2_fancy(const uint8_t *near, const uint8_t *far, uint8_t *out, int in_width, int bias);
+// 水平垂直各2倍三角滤波，near/far同上
+void upsample_h2v2_fancy(const uint8_t *near, const uint8_t *far, uint8_t *out, int in_width);
+
+#endif
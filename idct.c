@@ -0,0 +1,707 @@
+#include <math.h>
+#include <stddef.h>
+#include "idct.h"
+#include "simd.h"
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+#define PI 3.14159265358979323846f
+
+#define clip_pixel(_val) ((_val) < 0 ? 0 : (_val) > 255 ? 255 : (_val))
+
+static double cos_table[8][8]; // cos_table[i][x] = cos((2i + 1)xπ / 16)
+static double scale_table[8];  // C_0 = 1/√2, C_i = 1
+
+// idct_fast输入系数的缩放因子，自然顺序，第(u, v)项为round(s_u * s_v * 2^14)，s_0 = 1，s_k = √2 cos(kπ/16)
+static int16_t aan_scales[64] __attribute__((aligned(16)));
+
+#ifdef SIMD_X86
+static void idct_int_sse2(int16_t in[64], uint8_t *out, int stride);
+static void idct_int_avx2(int16_t in[64], uint8_t *out, int stride);
+static void idct_fast_sse2(int16_t in[64], uint8_t *out, int stride);
+#endif
+
+// 浮点参考实现所需的余弦表，程序启动时调用一次
+void idct_init()
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        for (int x = 0; x < 8; ++x)
+        {
+            cos_table[i][x] = cos(((2 * i + 1) * x * PI) / 16);
+        }
+        scale_table[i] = i == 0 ? 1.0f / sqrt(2) : 1.0f;
+    }
+
+    for (int u = 0; u < 8; ++u)
+    {
+        for (int v = 0; v < 8; ++v)
+        {
+            double su = u == 0 ? 1 : sqrt(2) * cos(u * 3.14159265358979323846 / 16);
+            double sv = v == 0 ? 1 : sqrt(2) * cos(v * 3.14159265358979323846 / 16);
+            aan_scales[u * 8 + v] = (int16_t)lround(su * sv * 16384);
+        }
+    }
+}
+
+// level一般传simd_level()，也可以传更低的级别以强制使用对应实现
+idct_func idct_get(int method, int level)
+{
+    switch (method)
+    {
+    case IDCT_METHOD_INT:
+#ifdef SIMD_X86
+        if (level >= SIMD_AVX2)
+            return idct_int_avx2;
+        if (level >= SIMD_SSE2)
+            return idct_int_sse2;
+#endif
+        return idct_int;
+    case IDCT_METHOD_FAST:
+#ifdef SIMD_X86
+        if (level >= SIMD_SSE2)
+            return idct_fast_sse2;
+#endif
+        return idct_fast;
+    case IDCT_METHOD_FLOAT: return idct_float;
+    default: return NULL;
+    }
+}
+
+// 缩小解码时每个block输出size x size像素，size为4/2/1，与IDCT方法无关，均为定点实现
+idct_func idct_get_scaled(int size)
+{
+    switch (size)
+    {
+    case 4: return idct_int_4x4;
+    case 2: return idct_int_2x2;
+    case 1: return idct_int_1x1;
+    default: return NULL;
+    }
+}
+
+const char *idct_method_name(int method)
+{
+    switch (method)
+    {
+    case IDCT_METHOD_INT: return "int";
+    case IDCT_METHOD_FLOAT: return "float";
+    case IDCT_METHOD_FAST: return "fast";
+    default: return "unknown";
+    }
+}
+
+// 按公式直接计算，每个输出点累加64项，计算顺序与原实现一致，结果逐位相同
+void idct_float(int16_t in[64], uint8_t *out, int stride)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        for (int j = 0; j < 8; ++j)
+        {
+            double v = 0;
+            for (int x = 0; x < 8; ++x)
+            {
+                for (int y = 0; y < 8; ++y)
+                {
+                    v += scale_table[x] * scale_table[y] * cos_table[i][x] * cos_table[j][y] * in[x * 8 + y];
+                }
+            }
+            int pixel = (int)(v / 4) + 128;
+            out[i * stride + j] = clip_pixel(pixel);
+        }
+    }
+}
+
+// 定点常数，放大2^13倍
+#define CONST_BITS 13
+#define PASS1_BITS 2 // 第一遍结果额外保留的精度位
+
+#define FIX_0_298631336 2446
+#define FIX_0_390180644 3196
+#define FIX_0_541196100 4433
+#define FIX_0_765366865 6270
+#define FIX_0_899976223 7373
+#define FIX_1_175875602 9633
+#define FIX_1_501321110 12299
+#define FIX_1_847759065 15137
+#define FIX_1_961570560 16069
+#define FIX_2_053119869 16819
+#define FIX_2_562915447 20995
+#define FIX_3_072711026 25172
+
+#define DESCALE(_x, _n) (((_x) + (1 << ((_n) - 1))) >> (_n))
+
+// 一维8点IDCT（Loeffler-Ligtenberg-Moschytz），in/out按stride取数，out经DESCALE(shift)
+#define IDCT_1D(_in, _in_stride, _out, _out_stride, _shift)                  \
+    do                                                                       \
+    {                                                                        \
+        int z1, z2, z3, z4, z5;                                              \
+        int tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13;              \
+                                                                             \
+        /* 偶数部分 */                                                       \
+        z2 = (_in)[2 * (_in_stride)];                                        \
+        z3 = (_in)[6 * (_in_stride)];                                        \
+        z1 = (z2 + z3) * FIX_0_541196100;                                    \
+        tmp2 = z1 - z3 * FIX_1_847759065;                                    \
+        tmp3 = z1 + z2 * FIX_0_765366865;                                    \
+        z2 = (_in)[0];                                                       \
+        z3 = (_in)[4 * (_in_stride)];                                        \
+        tmp0 = (z2 + z3) * (1 << CONST_BITS);                                \
+        tmp1 = (z2 - z3) * (1 << CONST_BITS);                                \
+        tmp10 = tmp0 + tmp3;                                                 \
+        tmp13 = tmp0 - tmp3;                                                 \
+        tmp11 = tmp1 + tmp2;                                                 \
+        tmp12 = tmp1 - tmp2;                                                 \
+                                                                             \
+        /* 奇数部分 */                                                       \
+        tmp0 = (_in)[7 * (_in_stride)];                                      \
+        tmp1 = (_in)[5 * (_in_stride)];                                      \
+        tmp2 = (_in)[3 * (_in_stride)];                                      \
+        tmp3 = (_in)[1 * (_in_stride)];                                      \
+        z1 = tmp0 + tmp3;                                                    \
+        z2 = tmp1 + tmp2;                                                    \
+        z3 = tmp0 + tmp2;                                                    \
+        z4 = tmp1 + tmp3;                                                    \
+        z5 = (z3 + z4) * FIX_1_175875602;                                    \
+        tmp0 *= FIX_0_298631336;                                             \
+        tmp1 *= FIX_2_053119869;                                             \
+        tmp2 *= FIX_3_072711026;                                             \
+        tmp3 *= FIX_1_501321110;                                             \
+        z1 *= -FIX_0_899976223;                                              \
+        z2 *= -FIX_2_562915447;                                              \
+        z3 = z3 * -FIX_1_961570560 + z5;                                     \
+        z4 = z4 * -FIX_0_390180644 + z5;                                     \
+        tmp0 += z1 + z3;                                                     \
+        tmp1 += z2 + z4;                                                     \
+        tmp2 += z2 + z3;                                                     \
+        tmp3 += z1 + z4;                                                     \
+                                                                             \
+        (_out)[0] = DESCALE(tmp10 + tmp3, (_shift));                         \
+        (_out)[7 * (_out_stride)] = DESCALE(tmp10 - tmp3, (_shift));         \
+        (_out)[1 * (_out_stride)] = DESCALE(tmp11 + tmp2, (_shift));         \
+        (_out)[6 * (_out_stride)] = DESCALE(tmp11 - tmp2, (_shift));         \
+        (_out)[2 * (_out_stride)] = DESCALE(tmp12 + tmp1, (_shift));         \
+        (_out)[5 * (_out_stride)] = DESCALE(tmp12 - tmp1, (_shift));         \
+        (_out)[3 * (_out_stride)] = DESCALE(tmp13 + tmp0, (_shift));         \
+        (_out)[4 * (_out_stride)] = DESCALE(tmp13 - tmp0, (_shift));         \
+    }                                                                        \
+    while (0)
+
+// 行列分离的定点IDCT：先对每列做一维IDCT，再对每行做一维IDCT，每个block约一千次整数乘加
+void idct_int(int16_t in[64], uint8_t *out, int stride)
+{
+    int workspace[8][8];
+    int result[8][8];
+
+    // 第一遍：列，结果保留PASS1_BITS位小数
+    for (int x = 0; x < 8; ++x)
+    {
+        // 大部分列只有直流分量，输出即为常数，与完整计算的结果相同
+        if (in[8 + x] == 0 && in[16 + x] == 0 && in[24 + x] == 0 && in[32 + x] == 0 &&
+            in[40 + x] == 0 && in[48 + x] == 0 && in[56 + x] == 0)
+        {
+            int dc = in[x] * (1 << PASS1_BITS);
+            for (int y = 0; y < 8; ++y)
+                workspace[y][x] = dc;
+            continue;
+        }
+
+        IDCT_1D(&in[x], 8, &workspace[0][x], 8, CONST_BITS - PASS1_BITS);
+    }
+
+    // 第二遍：行，去掉PASS1_BITS以及两遍一维变换累积的8倍增益
+    for (int y = 0; y < 8; ++y)
+    {
+        IDCT_1D(workspace[y], 1, result[y], 1, CONST_BITS + PASS1_BITS + 3);
+        for (int x = 0; x < 8; ++x)
+        {
+            int pixel = result[y][x] + 128;
+            out[y * stride + x] = clip_pixel(pixel);
+        }
+    }
+}
+
+// 以下为快速IDCT(Arai-Agui-Nakajima)，每个一维变换只有5次乘法，各分量的缩放因子在开始时乘到系数上
+// 全部为16位运算：乘法取积的高16位(SIMD的pmulhw)，加减按16位回绕，C实现与SIMD实现逐位相同
+// 系数先左移4位再乘以2^14倍的缩放因子取高16位，即保留PASS1_BITS位小数，两遍之后去掉PASS1_BITS和8倍增益
+// 常数乘法拆为整数倍加上小于0.5的小数部分，小数部分按2^16倍取高16位，截断误差使结果与idct_int有±1~2的差异
+
+#define MULHI16(_a, _c) ((int16_t)(((int32_t)(_a) * (_c)) >> 16))
+
+#define FAST_0_414213562 27146  // 1.414213562 = 1 + 0.414213562
+#define FAST_M0_152240935 -9977 // 1.847759065 = 2 - 0.152240935
+#define FAST_0_082392200 5400   // 1.082392200 = 1 + 0.082392200
+#define FAST_M0_386874070 -25354 // 2.613125930 = 3 - 0.386874070
+
+// 一维8点AAN IDCT，v按stride取数，结果写回原位置
+static void idct_fast_1d(int16_t *v, int stride)
+{
+    // 偶数部分
+    int16_t tmp10 = v[0] + v[4 * stride];
+    int16_t tmp11 = v[0] - v[4 * stride];
+    int16_t tmp13 = v[2 * stride] + v[6 * stride];
+    int16_t z = v[2 * stride] - v[6 * stride];
+    int16_t tmp12 = (int16_t)(z + MULHI16(z, FAST_0_414213562)) - tmp13;
+    int16_t tmp0 = tmp10 + tmp13;
+    int16_t tmp3 = tmp10 - tmp13;
+    int16_t tmp1 = tmp11 + tmp12;
+    int16_t tmp2 = tmp11 - tmp12;
+
+    // 奇数部分
+    int16_t z13 = v[5 * stride] + v[3 * stride];
+    int16_t z10 = v[5 * stride] - v[3 * stride];
+    int16_t z11 = v[1 * stride] + v[7 * stride];
+    int16_t z12 = v[1 * stride] - v[7 * stride];
+    int16_t tmp7 = z11 + z13;
+    z = z11 - z13;
+    int16_t tmp11_odd = z + MULHI16(z, FAST_0_414213562);
+    z = z10 + z12;
+    int16_t z5 = (int16_t)(z * 2) + MULHI16(z, FAST_M0_152240935);
+    int16_t tmp10_odd = (int16_t)(z12 + MULHI16(z12, FAST_0_082392200)) - z5;
+    int16_t tmp12_odd = z5 - (int16_t)((int16_t)(z10 * 3) + MULHI16(z10, FAST_M0_386874070));
+    int16_t tmp6 = tmp12_odd - tmp7;
+    int16_t tmp5 = tmp11_odd - tmp6;
+    int16_t tmp4 = tmp10_odd + tmp5;
+
+    v[0] = tmp0 + tmp7;
+    v[7 * stride] = tmp0 - tmp7;
+    v[1 * stride] = tmp1 + tmp6;
+    v[6 * stride] = tmp1 - tmp6;
+    v[2 * stride] = tmp2 + tmp5;
+    v[5 * stride] = tmp2 - tmp5;
+    v[4 * stride] = tmp3 + tmp4;
+    v[3 * stride] = tmp3 - tmp4;
+}
+
+void idct_fast(int16_t in[64], uint8_t *out, int stride)
+{
+    int16_t workspace[64];
+    for (int k = 0; k < 64; ++k)
+        workspace[k] = MULHI16((int16_t)(in[k] * 16), aan_scales[k]);
+
+    // 第一遍：列，只有直流分量的列一维变换后各项都等于直流分量，不用计算
+    for (int x = 0; x < 8; ++x)
+    {
+        int16_t *column = &workspace[x];
+        if (column[8] == 0 && column[16] == 0 && column[24] == 0 && column[32] == 0 &&
+            column[40] == 0 && column[48] == 0 && column[56] == 0)
+        {
+            for (int y = 1; y < 8; ++y)
+                column[y * 8] = column[0];
+            continue;
+        }
+        idct_fast_1d(column, 8);
+    }
+
+    // 第二遍：行
+    for (int y = 0; y < 8; ++y)
+    {
+        int16_t *row = &workspace[y * 8];
+        idct_fast_1d(row, 1);
+        for (int x = 0; x < 8; ++x)
+        {
+            int16_t pixel = (int16_t)((int16_t)(row[x] + (1 << (PASS1_BITS + 2))) >> (PASS1_BITS + 3)) + 128;
+            out[y * stride + x] = clip_pixel(pixel);
+        }
+    }
+}
+
+// 以下为缩小解码用的N点IDCT，只取左上NxN个低频系数输出NxN像素，相当于8点IDCT的结果做理想低通后缩小8/N倍
+// 与idct_int一样各维放大√2倍计算，两遍共8倍增益；1x1和2x2不需要乘法
+
+void idct_int_4x4(int16_t in[64], uint8_t *out, int stride)
+{
+    int workspace[4][4];
+
+    // 第一遍：列，结果保留PASS1_BITS位小数
+    for (int x = 0; x < 4; ++x)
+    {
+        int tmp10 = (in[x] + in[16 + x]) * (1 << PASS1_BITS);
+        int tmp12 = (in[x] - in[16 + x]) * (1 << PASS1_BITS);
+        int z1 = (in[8 + x] + in[24 + x]) * FIX_0_541196100;
+        int tmp0 = DESCALE(z1 + in[8 + x] * FIX_0_765366865, CONST_BITS - PASS1_BITS);
+        int tmp2 = DESCALE(z1 - in[24 + x] * FIX_1_847759065, CONST_BITS - PASS1_BITS);
+
+        workspace[0][x] = tmp10 + tmp0;
+        workspace[3][x] = tmp10 - tmp0;
+        workspace[1][x] = tmp12 + tmp2;
+        workspace[2][x] = tmp12 - tmp2;
+    }
+
+    // 第二遍：行
+    for (int y = 0; y < 4; ++y)
+    {
+        int *w = workspace[y];
+        int tmp10 = (w[0] + w[2]) * (1 << CONST_BITS);
+        int tmp12 = (w[0] - w[2]) * (1 << CONST_BITS);
+        int z1 = (w[1] + w[3]) * FIX_0_541196100;
+        int tmp0 = z1 + w[1] * FIX_0_765366865;
+        int tmp2 = z1 - w[3] * FIX_1_847759065;
+
+        int pixels[4] = {tmp10 + tmp0, tmp12 + tmp2, tmp12 - tmp2, tmp10 - tmp0};
+        for (int x = 0; x < 4; ++x)
+        {
+            int pixel = DESCALE(pixels[x], CONST_BITS + PASS1_BITS + 3) + 128;
+            out[y * stride + x] = clip_pixel(pixel);
+        }
+    }
+}
+
+void idct_int_2x2(int16_t in[64], uint8_t *out, int stride)
+{
+    int tmp0 = in[0] + in[8], tmp1 = in[0] - in[8];
+    int tmp2 = in[1] + in[9], tmp3 = in[1] - in[9];
+
+    int pixels[4] = {tmp0 + tmp2, tmp0 - tmp2, tmp1 + tmp3, tmp1 - tmp3};
+    for (int i = 0; i < 4; ++i)
+    {
+        int pixel = DESCALE(pixels[i], 3) + 128;
+        out[i / 2 * stride + i % 2] = clip_pixel(pixel);
+    }
+}
+
+void idct_int_1x1(int16_t in[64], uint8_t *out, int stride)
+{
+    (void)stride; // 与idct_func签名一致，只输出1个像素
+    int pixel = DESCALE(in[0], 3) + 128;
+    out[0] = clip_pixel(pixel);
+}
+
+#ifdef SIMD_X86
+
+// 以下SIMD实现与idct_int逐项对应，所有运算都是32位整数的加减乘移位，结果与idct_int逐位相同
+// 8x8数据按行存放在8个向量中，向量内的各通道为各列，一维变换在向量之间进行，即同时处理所有列
+
+// SSE2没有32位低位乘法，用两次32x32->64位乘法拼出来
+__attribute__((target("sse2"))) static inline __m128i mullo_epi32_sse2(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+#define MUL_SSE2(_a, _c) mullo_epi32_sse2((_a), _mm_set1_epi32(_c))
+
+__attribute__((target("sse2"))) static inline void idct_1d_sse2(__m128i v[8], int shift)
+{
+    __m128i round = _mm_set1_epi32(1 << (shift - 1));
+    __m128i count = _mm_cvtsi32_si128(shift);
+
+    // 偶数部分
+    __m128i z1 = MUL_SSE2(_mm_add_epi32(v[2], v[6]), FIX_0_541196100);
+    __m128i tmp2 = _mm_sub_epi32(z1, MUL_SSE2(v[6], FIX_1_847759065));
+    __m128i tmp3 = _mm_add_epi32(z1, MUL_SSE2(v[2], FIX_0_765366865));
+    __m128i tmp0 = _mm_slli_epi32(_mm_add_epi32(v[0], v[4]), CONST_BITS);
+    __m128i tmp1 = _mm_slli_epi32(_mm_sub_epi32(v[0], v[4]), CONST_BITS);
+    __m128i tmp10 = _mm_add_epi32(tmp0, tmp3);
+    __m128i tmp13 = _mm_sub_epi32(tmp0, tmp3);
+    __m128i tmp11 = _mm_add_epi32(tmp1, tmp2);
+    __m128i tmp12 = _mm_sub_epi32(tmp1, tmp2);
+
+    // 奇数部分
+    tmp0 = v[7];
+    tmp1 = v[5];
+    tmp2 = v[3];
+    tmp3 = v[1];
+    z1 = _mm_add_epi32(tmp0, tmp3);
+    __m128i z2 = _mm_add_epi32(tmp1, tmp2);
+    __m128i z3 = _mm_add_epi32(tmp0, tmp2);
+    __m128i z4 = _mm_add_epi32(tmp1, tmp3);
+    __m128i z5 = MUL_SSE2(_mm_add_epi32(z3, z4), FIX_1_175875602);
+    tmp0 = MUL_SSE2(tmp0, FIX_0_298631336);
+    tmp1 = MUL_SSE2(tmp1, FIX_2_053119869);
+    tmp2 = MUL_SSE2(tmp2, FIX_3_072711026);
+    tmp3 = MUL_SSE2(tmp3, FIX_1_501321110);
+    z1 = MUL_SSE2(z1, -FIX_0_899976223);
+    z2 = MUL_SSE2(z2, -FIX_2_562915447);
+    z3 = _mm_add_epi32(MUL_SSE2(z3, -FIX_1_961570560), z5);
+    z4 = _mm_add_epi32(MUL_SSE2(z4, -FIX_0_390180644), z5);
+    tmp0 = _mm_add_epi32(tmp0, _mm_add_epi32(z1, z3));
+    tmp1 = _mm_add_epi32(tmp1, _mm_add_epi32(z2, z4));
+    tmp2 = _mm_add_epi32(tmp2, _mm_add_epi32(z2, z3));
+    tmp3 = _mm_add_epi32(tmp3, _mm_add_epi32(z1, z4));
+
+#define DESCALE_SSE2(_x) _mm_sra_epi32(_mm_add_epi32((_x), round), count)
+    v[0] = DESCALE_SSE2(_mm_add_epi32(tmp10, tmp3));
+    v[7] = DESCALE_SSE2(_mm_sub_epi32(tmp10, tmp3));
+    v[1] = DESCALE_SSE2(_mm_add_epi32(tmp11, tmp2));
+    v[6] = DESCALE_SSE2(_mm_sub_epi32(tmp11, tmp2));
+    v[2] = DESCALE_SSE2(_mm_add_epi32(tmp12, tmp1));
+    v[5] = DESCALE_SSE2(_mm_sub_epi32(tmp12, tmp1));
+    v[3] = DESCALE_SSE2(_mm_add_epi32(tmp13, tmp0));
+    v[4] = DESCALE_SSE2(_mm_sub_epi32(tmp13, tmp0));
+#undef DESCALE_SSE2
+}
+
+// 4x4的32位矩阵转置
+__attribute__((target("sse2"))) static inline void transpose4x4_sse2(__m128i *r0, __m128i *r1, __m128i *r2, __m128i *r3)
+{
+    __m128i t0 = _mm_unpacklo_epi32(*r0, *r1);
+    __m128i t1 = _mm_unpacklo_epi32(*r2, *r3);
+    __m128i t2 = _mm_unpackhi_epi32(*r0, *r1);
+    __m128i t3 = _mm_unpackhi_epi32(*r2, *r3);
+    *r0 = _mm_unpacklo_epi64(t0, t1);
+    *r1 = _mm_unpackhi_epi64(t0, t1);
+    *r2 = _mm_unpacklo_epi64(t2, t3);
+    *r3 = _mm_unpackhi_epi64(t2, t3);
+}
+
+// 8x8矩阵拆成左右两半，left[i]为第i行的0~3列，right[i]为第i行的4~7列，转置后仍按此方式存放
+__attribute__((target("sse2"))) static inline void transpose8x8_sse2(__m128i left[8], __m128i right[8])
+{
+    transpose4x4_sse2(&left[0], &left[1], &left[2], &left[3]);
+    transpose4x4_sse2(&right[0], &right[1], &right[2], &right[3]);
+    transpose4x4_sse2(&left[4], &left[5], &left[6], &left[7]);
+    transpose4x4_sse2(&right[4], &right[5], &right[6], &right[7]);
+    for (int i = 0; i < 4; ++i) // 右上与左下两块互换
+    {
+        __m128i tmp = right[i];
+        right[i] = left[i + 4];
+        left[i + 4] = tmp;
+    }
+}
+
+__attribute__((target("sse2"))) static void idct_int_sse2(int16_t in[64], uint8_t *out, int stride)
+{
+    __m128i left[8], right[8];
+    __m128i center = _mm_set1_epi32(128);
+
+    // int16符号扩展到int32：与自身交错后算术右移16位
+    for (int y = 0; y < 8; ++y)
+    {
+        __m128i row = _mm_loadu_si128((__m128i *)&in[y * 8]);
+        left[y] = _mm_srai_epi32(_mm_unpacklo_epi16(row, row), 16);
+        right[y] = _mm_srai_epi32(_mm_unpackhi_epi16(row, row), 16);
+    }
+
+    // 第一遍：列
+    idct_1d_sse2(left, CONST_BITS - PASS1_BITS);
+    idct_1d_sse2(right, CONST_BITS - PASS1_BITS);
+
+    // 第二遍：行，转置后行变为列
+    transpose8x8_sse2(left, right);
+    idct_1d_sse2(left, CONST_BITS + PASS1_BITS + 3);
+    idct_1d_sse2(right, CONST_BITS + PASS1_BITS + 3);
+    transpose8x8_sse2(left, right);
+
+    // +128，饱和打包到0~255
+    for (int y = 0; y < 8; ++y)
+    {
+        __m128i row = _mm_packs_epi32(_mm_add_epi32(left[y], center), _mm_add_epi32(right[y], center));
+        _mm_storel_epi64((__m128i *)(out + y * stride), _mm_packus_epi16(row, row));
+    }
+}
+
+// 与idct_fast_1d逐项对应，v[i]为第i个输入，各通道为8列
+__attribute__((target("sse2"))) static inline void idct_fast_1d_sse2(__m128i v[8])
+{
+#define MUL_FRACTION(_a, _c) _mm_mulhi_epi16((_a), _mm_set1_epi16(_c))
+    // 偶数部分
+    __m128i tmp10 = _mm_add_epi16(v[0], v[4]);
+    __m128i tmp11 = _mm_sub_epi16(v[0], v[4]);
+    __m128i tmp13 = _mm_add_epi16(v[2], v[6]);
+    __m128i z = _mm_sub_epi16(v[2], v[6]);
+    __m128i tmp12 = _mm_sub_epi16(_mm_add_epi16(z, MUL_FRACTION(z, FAST_0_414213562)), tmp13);
+    __m128i tmp0 = _mm_add_epi16(tmp10, tmp13);
+    __m128i tmp3 = _mm_sub_epi16(tmp10, tmp13);
+    __m128i tmp1 = _mm_add_epi16(tmp11, tmp12);
+    __m128i tmp2 = _mm_sub_epi16(tmp11, tmp12);
+
+    // 奇数部分
+    __m128i z13 = _mm_add_epi16(v[5], v[3]);
+    __m128i z10 = _mm_sub_epi16(v[5], v[3]);
+    __m128i z11 = _mm_add_epi16(v[1], v[7]);
+    __m128i z12 = _mm_sub_epi16(v[1], v[7]);
+    __m128i tmp7 = _mm_add_epi16(z11, z13);
+    z = _mm_sub_epi16(z11, z13);
+    __m128i tmp11_odd = _mm_add_epi16(z, MUL_FRACTION(z, FAST_0_414213562));
+    z = _mm_add_epi16(z10, z12);
+    __m128i z5 = _mm_add_epi16(_mm_add_epi16(z, z), MUL_FRACTION(z, FAST_M0_152240935));
+    __m128i tmp10_odd = _mm_sub_epi16(_mm_add_epi16(z12, MUL_FRACTION(z12, FAST_0_082392200)), z5);
+    __m128i z10x3 = _mm_add_epi16(_mm_add_epi16(z10, z10), z10);
+    __m128i tmp12_odd = _mm_sub_epi16(z5, _mm_add_epi16(z10x3, MUL_FRACTION(z10, FAST_M0_386874070)));
+    __m128i tmp6 = _mm_sub_epi16(tmp12_odd, tmp7);
+    __m128i tmp5 = _mm_sub_epi16(tmp11_odd, tmp6);
+    __m128i tmp4 = _mm_add_epi16(tmp10_odd, tmp5);
+#undef MUL_FRACTION
+
+    v[0] = _mm_add_epi16(tmp0, tmp7);
+    v[7] = _mm_sub_epi16(tmp0, tmp7);
+    v[1] = _mm_add_epi16(tmp1, tmp6);
+    v[6] = _mm_sub_epi16(tmp1, tmp6);
+    v[2] = _mm_add_epi16(tmp2, tmp5);
+    v[5] = _mm_sub_epi16(tmp2, tmp5);
+    v[4] = _mm_add_epi16(tmp3, tmp4);
+    v[3] = _mm_sub_epi16(tmp3, tmp4);
+}
+
+// 8x8的16位矩阵转置
+__attribute__((target("sse2"))) static inline void transpose8x8_epi16_sse2(__m128i v[8])
+{
+    __m128i t0 = _mm_unpacklo_epi16(v[0], v[1]);
+    __m128i t1 = _mm_unpackhi_epi16(v[0], v[1]);
+    __m128i t2 = _mm_unpacklo_epi16(v[2], v[3]);
+    __m128i t3 = _mm_unpackhi_epi16(v[2], v[3]);
+    __m128i t4 = _mm_unpacklo_epi16(v[4], v[5]);
+    __m128i t5 = _mm_unpackhi_epi16(v[4], v[5]);
+    __m128i t6 = _mm_unpacklo_epi16(v[6], v[7]);
+    __m128i t7 = _mm_unpackhi_epi16(v[6], v[7]);
+    __m128i u0 = _mm_unpacklo_epi32(t0, t2);
+    __m128i u1 = _mm_unpackhi_epi32(t0, t2);
+    __m128i u2 = _mm_unpacklo_epi32(t1, t3);
+    __m128i u3 = _mm_unpackhi_epi32(t1, t3);
+    __m128i u4 = _mm_unpacklo_epi32(t4, t6);
+    __m128i u5 = _mm_unpackhi_epi32(t4, t6);
+    __m128i u6 = _mm_unpacklo_epi32(t5, t7);
+    __m128i u7 = _mm_unpackhi_epi32(t5, t7);
+    v[0] = _mm_unpacklo_epi64(u0, u4);
+    v[1] = _mm_unpackhi_epi64(u0, u4);
+    v[2] = _mm_unpacklo_epi64(u1, u5);
+    v[3] = _mm_unpackhi_epi64(u1, u5);
+    v[4] = _mm_unpacklo_epi64(u2, u6);
+    v[5] = _mm_unpackhi_epi64(u2, u6);
+    v[6] = _mm_unpacklo_epi64(u3, u7);
+    v[7] = _mm_unpackhi_epi64(u3, u7);
+}
+
+// 16位运算一个向量即为一行，不需要像idct_int_sse2那样拆成左右两半
+__attribute__((target("sse2"))) static void idct_fast_sse2(int16_t in[64], uint8_t *out, int stride)
+{
+    __m128i v[8];
+    for (int y = 0; y < 8; ++y)
+    {
+        __m128i row = _mm_slli_epi16(_mm_loadu_si128((__m128i *)&in[y * 8]), 4);
+        v[y] = _mm_mulhi_epi16(row, _mm_load_si128((__m128i *)&aan_scales[y * 8]));
+    }
+
+    // 第一遍：列
+    idct_fast_1d_sse2(v);
+
+    // 第二遍：行，转置后行变为列
+    transpose8x8_epi16_sse2(v);
+    idct_fast_1d_sse2(v);
+    transpose8x8_epi16_sse2(v);
+
+    // 去掉小数位和增益，+128，饱和打包到0~255
+    __m128i round = _mm_set1_epi16(1 << (PASS1_BITS + 2));
+    __m128i center = _mm_set1_epi16(128);
+    for (int y = 0; y < 8; ++y)
+    {
+        __m128i row = _mm_add_epi16(_mm_srai_epi16(_mm_add_epi16(v[y], round), PASS1_BITS + 3), center);
+        _mm_storel_epi64((__m128i *)(out + y * stride), _mm_packus_epi16(row, row));
+    }
+}
+
+#define MUL_AVX2(_a, _c) _mm256_mullo_epi32((_a), _mm256_set1_epi32(_c))
+
+__attribute__((target("avx2"))) static inline void idct_1d_avx2(__m256i v[8], int shift)
+{
+    __m256i round = _mm256_set1_epi32(1 << (shift - 1));
+    __m128i count = _mm_cvtsi32_si128(shift);
+
+    // 偶数部分
+    __m256i z1 = MUL_AVX2(_mm256_add_epi32(v[2], v[6]), FIX_0_541196100);
+    __m256i tmp2 = _mm256_sub_epi32(z1, MUL_AVX2(v[6], FIX_1_847759065));
+    __m256i tmp3 = _mm256_add_epi32(z1, MUL_AVX2(v[2], FIX_0_765366865));
+    __m256i tmp0 = _mm256_slli_epi32(_mm256_add_epi32(v[0], v[4]), CONST_BITS);
+    __m256i tmp1 = _mm256_slli_epi32(_mm256_sub_epi32(v[0], v[4]), CONST_BITS);
+    __m256i tmp10 = _mm256_add_epi32(tmp0, tmp3);
+    __m256i tmp13 = _mm256_sub_epi32(tmp0, tmp3);
+    __m256i tmp11 = _mm256_add_epi32(tmp1, tmp2);
+    __m256i tmp12 = _mm256_sub_epi32(tmp1, tmp2);
+
+    // 奇数部分
+    tmp0 = v[7];
+    tmp1 = v[5];
+    tmp2 = v[3];
+    tmp3 = v[1];
+    z1 = _mm256_add_epi32(tmp0, tmp3);
+    __m256i z2 = _mm256_add_epi32(tmp1, tmp2);
+    __m256i z3 = _mm256_add_epi32(tmp0, tmp2);
+    __m256i z4 = _mm256_add_epi32(tmp1, tmp3);
+    __m256i z5 = MUL_AVX2(_mm256_add_epi32(z3, z4), FIX_1_175875602);
+    tmp0 = MUL_AVX2(tmp0, FIX_0_298631336);
+    tmp1 = MUL_AVX2(tmp1, FIX_2_053119869);
+    tmp2 = MUL_AVX2(tmp2, FIX_3_072711026);
+    tmp3 = MUL_AVX2(tmp3, FIX_1_501321110);
+    z1 = MUL_AVX2(z1, -FIX_0_899976223);
+    z2 = MUL_AVX2(z2, -FIX_2_562915447);
+    z3 = _mm256_add_epi32(MUL_AVX2(z3, -FIX_1_961570560), z5);
+    z4 = _mm256_add_epi32(MUL_AVX2(z4, -FIX_0_390180644), z5);
+    tmp0 = _mm256_add_epi32(tmp0, _mm256_add_epi32(z1, z3));
+    tmp1 = _mm256_add_epi32(tmp1, _mm256_add_epi32(z2, z4));
+    tmp2 = _mm256_add_epi32(tmp2, _mm256_add_epi32(z2, z3));
+    tmp3 = _mm256_add_epi32(tmp3, _mm256_add_epi32(z1, z4));
+
+#define DESCALE_AVX2(_x) _mm256_sra_epi32(_mm256_add_epi32((_x), round), count)
+    v[0] = DESCALE_AVX2(_mm256_add_epi32(tmp10, tmp3));
+    v[7] = DESCALE_AVX2(_mm256_sub_epi32(tmp10, tmp3));
+    v[1] = DESCALE_AVX2(_mm256_add_epi32(tmp11, tmp2));
+    v[6] = DESCALE_AVX2(_mm256_sub_epi32(tmp11, tmp2));
+    v[2] = DESCALE_AVX2(_mm256_add_epi32(tmp12, tmp1));
+    v[5] = DESCALE_AVX2(_mm256_sub_epi32(tmp12, tmp1));
+    v[3] = DESCALE_AVX2(_mm256_add_epi32(tmp13, tmp0));
+    v[4] = DESCALE_AVX2(_mm256_sub_epi32(tmp13, tmp0));
+#undef DESCALE_AVX2
+}
+
+__attribute__((target("avx2"))) static inline void transpose8x8_avx2(__m256i v[8])
+{
+    __m256i t0 = _mm256_unpacklo_epi32(v[0], v[1]);
+    __m256i t1 = _mm256_unpackhi_epi32(v[0], v[1]);
+    __m256i t2 = _mm256_unpacklo_epi32(v[2], v[3]);
+    __m256i t3 = _mm256_unpackhi_epi32(v[2], v[3]);
+    __m256i t4 = _mm256_unpacklo_epi32(v[4], v[5]);
+    __m256i t5 = _mm256_unpackhi_epi32(v[4], v[5]);
+    __m256i t6 = _mm256_unpacklo_epi32(v[6], v[7]);
+    __m256i t7 = _mm256_unpackhi_epi32(v[6], v[7]);
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+    __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+    __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+    __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+    __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+    __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+    __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+    v[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+    v[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+    v[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+    v[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+    v[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+    v[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+    v[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+    v[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+__attribute__((target("avx2"))) static void idct_int_avx2(int16_t in[64], uint8_t *out, int stride)
+{
+    __m256i v[8];
+    __m256i center = _mm256_set1_epi32(128);
+
+    for (int y = 0; y < 8; ++y)
+    {
+        v[y] = _mm256_cvtepi16_epi32(_mm_loadu_si128((__m128i *)&in[y * 8]));
+    }
+
+    // 第一遍：列
+    idct_1d_avx2(v, CONST_BITS - PASS1_BITS);
+
+    // 第二遍：行，转置后行变为列
+    transpose8x8_avx2(v);
+    idct_1d_avx2(v, CONST_BITS + PASS1_BITS + 3);
+    transpose8x8_avx2(v);
+
+    // +128，饱和打包到0~255，每次处理两行
+    for (int y = 0; y < 8; y += 2)
+    {
+        __m256i rows = _mm256_packs_epi32(_mm256_add_epi32(v[y], center), _mm256_add_epi32(v[y + 1], center));
+        rows = _mm256_permute4x64_epi64(rows, _MM_SHUFFLE(3, 1, 2, 0)); // packs按128位分别打包，调整回行顺序
+        rows = _mm256_packus_epi16(rows, rows);
+        _mm_storel_epi64((__m128i *)(out + y * stride), _mm256_castsi256_si128(rows));
+        _mm_storel_epi64((__m128i *)(out + (y + 1) * stride), _mm256_extracti128_si256(rows, 1));
+    }
+}
+
+#endif
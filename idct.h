@@ -0,0 +1,27 @@
+#ifndef IDCT_H
+#define IDCT_H
+
+#include <stdint.h>
+
+#define IDCT_METHOD_INT 0   // 定点分离式IDCT(LLM)，默认
+#define IDCT_METHOD_FLOAT 1 // 浮点参考实现，与README中的公式逐项对应
+#define IDCT_METHOD_FAST 2  // 16位定点AAN，乘法少、SIMD一次处理8列，精度低于IDCT_METHOD_INT
+
+// IDCT + 电平平移(+128)并限幅到0~255
+// in为自然顺序、已反量化的64个系数，out按stride逐行写入8x8像素
+typedef void (*idct_func)(int16_t in[64], uint8_t *out, int stride);
+
+void idct_init();
+idct_func idct_get(int method, int level);
+idct_func idct_get_scaled(int size);
+const char *idct_method_name(int method);
+
+void idct_float(int16_t in[64], uint8_t *out, int stride);
+void idct_int(int16_t in[64], uint8_t *out, int stride);
+void idct_fast(int16_t in[64], uint8_t *out, int stride);
+// 缩小解码，out按stride逐行写入4x4/2x2/1x1像素
+void idct_int_4x4(int16_t in[64], uint8_t *out, int stride);
+void idct_int_2x2(int16_t in[64], uint8_t *out, int stride);
+void idct_int_1x1(int16_t in[64], uint8_t *out, int stride);
+
+#endif
@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "input.h"
+
+// 保证in->buffer至少有size字节，按倍数扩大
+static int reserve_buffer(struct input *in, size_t size)
+{
+    size_t buffer_size = in->buffer_size ? in->buffer_size : 1 << 16;
+    while (buffer_size < size)
+        buffer_size *= 2;
+    if (buffer_size == in->buffer_size)
+        return 0;
+
+    uint8_t *buffer = realloc(in->buffer, buffer_size);
+    if (!buffer)
+    {
+        log_("realloc failed: %s\n", strerror(errno));
+        return -1;
+    }
+    in->buffer = buffer;
+    in->buffer_size = buffer_size;
+    return 0;
+}
+
+// 逐块read到in->buffer，用于管道等不能mmap的输入
+static int read_all(struct input *in, int fd)
+{
+    size_t size = 0;
+    while (1)
+    {
+        if (size == in->buffer_size && reserve_buffer(in, size + 1) != 0)
+            return -1;
+
+        ssize_t ret = read(fd, in->buffer + size, in->buffer_size - size);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+        {
+            log_("read failed: %s\n", strerror(errno));
+            return -1;
+        }
+        if (ret == 0)
+            break;
+        size += ret;
+    }
+
+    in->data = in->buffer;
+    in->size = size;
+    return 0;
+}
+
+int input_open_file(struct input *in, const char *filename)
+{
+    input_close(in);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        log_("open `%s` failed: %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    int ret = 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED)
+        {
+            madvise(mapped, st.st_size, MADV_SEQUENTIAL); // 解析和熵解码都是从前往后读一遍
+            in->mapped = mapped;
+            in->data = mapped;
+            in->size = st.st_size;
+            close(fd);
+            return 0;
+        }
+        log_("mmap `%s` failed: %s, fall back to read\n", filename, strerror(errno));
+    }
+
+    ret = read_all(in, fd);
+    close(fd);
+    return ret;
+}
+
+void input_set_memory(struct input *in, const uint8_t *data, size_t size)
+{
+    input_close(in);
+    in->data = data;
+    in->size = size;
+}
+
+int input_append(struct input *in, const uint8_t *data, size_t size)
+{
+    if (reserve_buffer(in, in->size + size) != 0)
+        return -1;
+
+    memcpy(in->buffer + in->size, data, size);
+    in->data = in->buffer;
+    in->size += size;
+    return 0;
+}
+
+void input_close(struct input *in)
+{
+    if (in->mapped)
+        munmap(in->mapped, in->size);
+    in->mapped = NULL;
+    in->data = NULL;
+    in->size = 0;
+}
+
+void input_free(struct input *in)
+{
+    input_close(in);
+    free(in->buffer);
+    in->buffer = NULL;
+    in->buffer_size = 0;
+}
@@ -0,0 +1,29 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// 解码的输入数据，来自文件映射、读取到的缓冲或调用者提供的内存
+struct input
+{
+    const uint8_t *data;
+    size_t size;
+    void *mapped;       // mmap映射的地址，为NULL时不是映射
+    uint8_t *buffer;    // 不能mmap的文件(管道等)读取到这里，reset后保留复用
+    size_t buffer_size; // buffer已分配的大小
+};
+
+// 只读映射整个文件并提示顺序访问，不能映射时退回read，成功返回0
+int input_open_file(struct input *in, const char *filename);
+// 直接使用调用者的内存，不复制
+void input_set_memory(struct input *in, const uint8_t *data, size_t size);
+// 追加到读取缓冲末尾，用于数据分块到达的增量解码，缓冲扩大时data可能移动，成功返回0
+// 调用前数据须为空(input_close之后)或来自之前的input_append
+int input_append(struct input *in, const uint8_t *data, size_t size);
+// 解除映射，保留读取缓冲
+void input_close(struct input *in);
+// 同时释放读取缓冲
+void input_free(struct input *in);
+
+#endif
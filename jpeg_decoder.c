@@ -3,22 +3,45 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <limits.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 #include "log.h"
+#include "jpeg_decoder.h"
+#include "idct.h"
+#include "color.h"
+#include "simd.h"
+#include "thread_pool.h"
+#include "input.h"
+#include "arena.h"
+
+#ifdef SIMD_X86
+#include <x86intrin.h>
+#endif
 
 #define max(_a, _b) ((_a) > (_b) ? (_a) : (_b))
 #define min(_a, _b) ((_a) < (_b) ? (_a) : (_b))
 #define clip(_min, _max, _val) min(max((_min), (_val)), (_max))
 
-#define SEG_SOI 0xD8  // start of image
-#define SEG_APP0 0xE0 // application 0
-#define SEG_SOF0 0xC0 // start of frame 0(0: baseline)
-#define SEG_DQT 0xDB  // define quantization table
-#define SEG_DHT 0xC4  // define huffman table
-#define SEG_SOS 0xDA  // start of scan
-#define SEG_EOI 0xD9  // end of image
-
-#define PI 3.14159265358979323846f
+// 公开头文件中的常量与内部模块一致，直接透传
+_Static_assert(JPEG_IDCT_INT == IDCT_METHOD_INT && JPEG_IDCT_FLOAT == IDCT_METHOD_FLOAT && JPEG_IDCT_FAST == IDCT_METHOD_FAST, "IDCT method mismatch");
+_Static_assert(JPEG_UPSAMPLE_FANCY == UPSAMPLE_FANCY && JPEG_UPSAMPLE_NEAREST == UPSAMPLE_NEAREST, "upsample method mismatch");
+
+#define SEG_SOI 0xD8   // start of image
+#define SEG_APP0 0xE0  // application 0
+#define SEG_SOF0 0xC0  // start of frame 0(0: baseline)
+#define SEG_SOF15 0xCF // start of frame 15，SOF0~SOF15中除DHT/JPG/DAC外都是帧头，结构相同
+#define SEG_JPG 0xC8   // 保留，不是帧头
+#define SEG_DAC 0xCC   // define arithmetic coding，不是帧头
+#define SEG_DQT 0xDB   // define quantization table
+#define SEG_DHT 0xC4   // define huffman table
+#define SEG_SOS 0xDA   // start of scan
+#define SEG_DRI 0xDD   // define restart interval
+#define SEG_RST0 0xD0  // restart 0，RST0~RST7循环使用
+#define SEG_RST7 0xD7  // restart 7
+#define SEG_EOI 0xD9   // end of image
+#define SEG_TEM 0x01   // temporary，没有段长
 
 #define COLOR_ID_Y 1
 #define COLOR_ID_Cb 2
@@ -27,15 +50,18 @@
 #define BLOCK_HORIZONTAL_PIXEL_COUNT 8
 #define BLOCK_VERTICAL_PIXEL_COUNT 8
 
-uint8_t dezigzag[8][8] = {
-    {0, 1, 5, 6, 14, 15, 27, 28},
-    {2, 4, 7, 13, 16, 26, 29, 42},
-    {3, 8, 12, 17, 25, 30, 41, 43},
-    {9, 11, 18, 24, 31, 40, 44, 53},
-    {10, 19, 23, 32, 39, 45, 52, 54},
-    {20, 22, 33, 38, 46, 51, 55, 60},
-    {21, 34, 37, 47, 50, 56, 59, 61},
-    {35, 36, 48, 49, 57, 58, 62, 63},
+#define HUFFMAN_LOOKUP_BITS 9 // 快速查找表一次预读的bit数，码长不超过该值的码字查表一次即可得到
+
+// zigzag顺序的第k个系数在8x8自然顺序中的下标
+const uint8_t natural_order[64] = {
+    0, 1, 8, 16, 9, 2, 3, 10,
+    17, 24, 32, 25, 18, 11, 4, 5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13, 6, 7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63,
 };
 
 const char *marker_name(int seg_id)
@@ -48,6 +74,7 @@ const char *marker_name(int seg_id)
     case SEG_DQT: return "DQT";
     case SEG_DHT: return "DHT";
     case SEG_SOS: return "SOS";
+    case SEG_DRI: return "DRI";
     case SEG_EOI: return "EOI";
     default:
         log_("[%x]\n", seg_id);
@@ -57,13 +84,16 @@ const char *marker_name(int seg_id)
 
 //          |区段头0xFFDB|段长|量化值大小|id|数据    |
 // 长度(bit)|16          |16  |4         |4 |段长指定|
+// 一个DQT段中可以依次有多个表
 struct define_quantization_table
 {
-    uint8_t *ptr;          // 包含0xFFDB
+    const uint8_t *ptr;         // 所在的DQT段，包含0xFFDB，沿用之前图像的表时为NULL
     int length;            // 不包含0xFFDB，包含长度字节的总长度
     int quantization_size; // 标识字节的高4位，标识每个量化值大小，0:1byte/1:2bytes
     int table_id;          // 标识字节的低4位，id可为0/1/2/3
     uint16_t values[8][8]; // 表值
+    uint16_t natural_values[64]; // 按自然顺序排列的表值，解码系数时直接相乘完成反量化
+    int defined;                 // 当前图像可以使用该表
 };
 
 struct define_huffman_table_code_item
@@ -73,18 +103,70 @@ struct define_huffman_table_code_item
     uint8_t value;
 };
 
-// [TODO] 在一个DHT中可能有多个huffman表
 //          |区段头0xFFC4|段长|AC/DC|表号|霍夫曼树叶子节点个数表|数据        |
 // 长度(bit)|16          |16  |4    |4   |128                   |叶子节点个数|
+// 一个DHT段中可以依次有多个表，段长之后从AC/DC开始重复
 struct define_huffman_table
 {
-    uint8_t *ptr;                                 // 包含0xFFC4
+    const uint8_t *ptr;                                // 所在的DHT段，包含0xFFC4，沿用之前图像的表或标准表时为NULL
     int length;                                   // 不包含0xFFC4，包含长度字节的总长度
     int ac_dc_type;                               // 直流0/交流1
     int table_id;                                 // 表号，最低位有效，高3位固定0
     uint8_t leave_counts[16];                     // 霍夫曼表码字长度对应的叶子节点个数
     int leave_count_total;                        // 叶子节点总数，即码字总数
-    struct define_huffman_table_code_item *items; // 每个码字的信息
+    struct define_huffman_table_code_item items[256]; // 每个码字的信息，8bit的值最多256个
+
+    int max_codes[18];                         // 各码长(1~16)的最大码字，该码长无码字时为-1，[17]为哨兵
+    int value_offsets[17];                     // 各码长首个码字在items中的下标减去该码字，码字+偏移即为下标
+    uint16_t lookup[1 << HUFFMAN_LOOKUP_BITS]; // 预读查找表：(码长 << 8) | 值，0表示码长超过预读位数需走慢速路径
+    int16_t ac_lookup[1 << HUFFMAN_LOOKUP_BITS]; // 交流合并表：(系数 << 8) | (前置0个数 << 4) | (码长 + 系数位数)，0表示不可合并
+
+    int defined;      // 当前图像可以使用该表
+    int lookup_built; // 以上各表已按leave_counts和items生成，再次定义相同的表时直接沿用
+    int invalid;      // 图像中定义的该表不合法，不用标准表代替，用到该表时解码失败
+};
+
+// Annex K.3的标准霍夫曼表，表号0为亮度、1为色度；MJPEG的帧通常省略DHT，图像没有定义用到的表时按这些表解码
+struct standard_huffman_table
+{
+    uint8_t leave_counts[16]; // 各码长的码字个数
+    uint8_t values[162];      // 按码字顺序排列的值
+};
+
+// [直流0/交流1][表号]
+const struct standard_huffman_table standard_DHTs[2][2] = {
+    {
+        {{0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0}, {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}},
+        {{0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0}, {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}},
+    },
+    {
+        {{0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D}, {
+            0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+            0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+            0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+            0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+            0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+            0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+            0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+            0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+            0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+            0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+            0xF9, 0xFA,
+        }},
+        {{0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77}, {
+            0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+            0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+            0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+            0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+            0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+            0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+            0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+            0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+            0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+            0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+            0xF9, 0xFA,
+        }},
+    },
 };
 
 //          |颜色分量id|水平采样率|垂直采样率|量化表id|
@@ -102,7 +184,7 @@ struct start_of_frame_0_channel_info
 // 各颜色分量详细信息，以下表重复3次
 struct start_of_frame_0
 {
-    uint8_t *ptr;                                         // 包含0xFFC0
+    const uint8_t *ptr;                                        // 包含0xFFC0
     int length;                                           // 不包含0xFFC0，包含长度字节的总长度
     int accuracy;                                         // baseline的精度固定为8
     int height;                                           // 图像高
@@ -124,7 +206,7 @@ struct start_of_scan_channel_info
 // 长度(bit)|16          |16  |8           |48          |24          |
 struct start_of_scan
 {
-    uint8_t *ptr;                                      // 包含0xFFDA
+    const uint8_t *ptr;                                     // 包含0xFFDA
     int length;                                        // 不包含0xFFDA，包含长度字节的总长度
     int color_channel_count;                           // 颜色分量个数
     struct start_of_scan_channel_info channel_info[3]; // 各颜色分量的详细信息
@@ -135,10 +217,7 @@ struct start_of_scan
 
 struct block
 {
-    int coefficient[8][8]; // 直流系数和交流系数
-    int dequantized[8][8]; // 反量化结果
-    int dezigzaged[8][8];  // 反ZigZag结果
-    int idcted[8][8];      // IDCT结果
+    int16_t coefficient[64]; // 反量化后的直流系数和交流系数，按自然顺序存放
 };
 
 struct MCU
@@ -146,46 +225,238 @@ struct MCU
     struct block **blocks[4]; // 由于这里颜色分量id为1/2/3，因此配置长度为4，0不使用
 };
 
+// 串行解码时保留的MCU行数，转换第i行时第i-1行和第i+1行仍然有效，供三角滤波上采样取相邻的色度行
+#define MCU_ROW_RING_SIZE 3
+
+// 并行解码时每个线程每批分到的restart interval个数，越大负载越均衡，但缓存的MCU行越多
+#define INTERVALS_PER_THREAD 4
+
+// 两阶段解码时每批的MCU行数为线程数，至少为此值
+#define MIN_RECONSTRUCT_ROW_COUNT 2
+
+// 推测解码时每段压缩数据至少的字节数，更短时分段的额外开销超过并行的收益
+#define MIN_SPECULATIVE_CHUNK_LENGTH 4096
+// 推测解码时每段记录的MCU起点个数，同步通常在开头的几个到几十个MCU内完成
+#define SPECULATIVE_RECORD_COUNT 256
+
+// 熵解码的统计计数，全部为uint64_t，合并时逐项相加
+struct decode_counters
+{
+    uint64_t MCU_ticks;  // 熵解码和IDCT的总计时
+    uint64_t idct_ticks; // 其中IDCT的计时
+    uint64_t bits;
+    uint64_t decoded_blocks;
+    uint64_t skipped_blocks;
+    uint64_t eob_positions[JPEG_STATS_EOB_POSITIONS];
+    uint64_t zero_runs[JPEG_STATS_ZERO_RUNS];
+};
+
+struct context;
+struct entropy_state;
+
+// MCU_i/MCU_j为MCU所在的行列，熵解码后IDCT，像素写到各分量条带中
+typedef void (*read_MCU_func)(struct context *ctx, struct entropy_state *es, struct MCU *mcu, int MCU_i, int MCU_j);
+// 两阶段解码的重建阶段，对第MCU_i行中已熵解码的MCU做IDCT
+typedef void (*idct_MCU_row_func)(struct context *ctx, int MCU_i);
+
+// 常见的采样组合，Y为1~2 x 1~2个block，Cb/Cr各1个block，各用块数为常量的实现；其它组合按MCU_horizontal_block_counts等循环
+#define LAYOUT_GENERIC 0
+#define LAYOUT_444 1
+#define LAYOUT_422 2
+#define LAYOUT_420 3
+#define LAYOUT_440 4
+#define LAYOUT_GRAY 5
+
+// 色度分量上采样到全分辨率的方式，由采样倍数和upsample_method决定
+#define CHROMA_FULL 0       // 水平方向不需要上采样，垂直方向直接取对应的行
+#define CHROMA_NEAREST 1    // 水平复制
+#define CHROMA_H2V1_FANCY 2 // 以下为三角滤波
+#define CHROMA_H1V2_FANCY 3
+#define CHROMA_H2V2_FANCY 4
+
+// 熵解码状态，各restart interval之间相互独立，并行解码时每个线程各用一份
+struct entropy_state
+{
+    uint64_t bit_buffer;    // 位缓冲，有效bit从最高位开始排列，低位补0
+    int bit_count;          // 位缓冲中的有效bit数
+    int bit_padding_count;  // 遇到marker或数据结束后补入的0 bit数
+    const uint8_t *bit_ptr; // 压缩数据中下一个要装入位缓冲的字节
+    const uint8_t *bit_end; // 压缩数据可读取的结束位置
+
+    int dc_global_coefficient[4]; // 全局dc差分偏移量，1:Y/2:Cb/3:Cr，每个restart interval开始时清0
+
+    struct decode_counters *counters; // 统计时累加到这里，并行解码时每个interval各用一份，解码结束后合并
+};
+
+// 推测解码时一个MCU开始处的状态
+struct speculative_record
+{
+    int64_t position; // exact_bit_position
+    int MCU;          // 从本段起点开始已解码的MCU个数
+    int dc[4];        // 从0开始累加的直流差分
+};
+
+// 推测解码的一段压缩数据，从begin处的字节边界开始按MCU解码，直到MCU边界处的位置不小于end_position
+struct speculative_chunk
+{
+    const uint8_t *begin;
+    int64_t end_position; // 下一段的起始位置
+    struct speculative_record records[SPECULATIVE_RECORD_COUNT]; // 开头的MCU起点，遇到非法码字时清空重新记录
+    int record_count;
+    struct entropy_state end_state; // 结束时的状态，直流差分从0开始累加
+    int end_MCU;                    // 结束时从本段起点开始已解码的MCU个数
+    int failed;                     // 第0段遇到非法码字
+
+    int first_MCU;              // 与前一段串联后得到的本段第一个MCU的真实序号，-1为没有同步，并入前一段解码
+    struct entropy_state state; // first_MCU开始处的真实状态
+};
+
 struct context
 {
-    FILE *fp;          // 文件指针
-    int length;        // 文件长度
-    uint8_t *buffer;   // 读取整个文件的指针
-    uint8_t *ptr;      // 在整个内存中以字节为单位游走的指针
-    size_t bit_offset; // 在压缩数据区以bit为单位游走的偏移量
+    int length;            // 数据长度
+    const uint8_t *buffer; // 调用者提供的整个文件的数据
+    const uint8_t *ptr;    // 在整个内存中以字节为单位游走的指针
 
-    uint8_t *ptr_SOI;
-    uint8_t **ptr_APP0s;
+    const uint8_t *ptr_SOI;
+    const uint8_t **ptr_APP0s;
     int count_APP0s;
+    int capacity_APP0s;
     struct start_of_frame_0 SOF0;
-    struct define_quantization_table *DQTs;
-    int count_DQTs;
-    struct define_huffman_table *DHTs;
-    int count_DHTs;
+    struct define_quantization_table DQTs[4]; // 按表号存放，后定义的表覆盖之前同一表号的表
+    struct define_huffman_table DHTs[2][4];   // 按[直流0/交流1][表号]存放
+    int keep_tables;                          // 非0时reset后各表仍可使用，图像中没有定义的表沿用之前的图像，用于MJPEG
     struct start_of_scan SOS;
-    uint8_t *compress_data;
-    uint8_t *ptr_EOI;
+    const uint8_t *compress_data;
 
-    int dc_global_coefficient[4]; // 全局dc差分偏移量，1:Y/2:Cb/3:Cr
+    int restart_interval;          // DRI中每个restart interval的MCU个数，0为没有restart marker
+    const uint8_t **interval_ptrs; // 预扫描得到的每个restart interval压缩数据的起始位置
+    int interval_count;            // restart interval个数，没有DRI时整个扫描为1个
+    int interval_capacity;         // interval_ptrs已分配的个数
 
-    struct MCU **MCUs;        // 全部MCU
+    struct entropy_state entropy; // 串行解码的熵解码状态，并行解码结束后为最后一个interval的状态
+    int next_MCU;                 // 增量解码时下一个要解码的MCU
+
+    struct thread_pool *pool; // 并行解码restart interval的线程池
+    int window_interval_count; // 并行解码时每批解码的restart interval个数
+    int output_row_count;      // 已转换并输出的MCU行数
+
+    struct arena MCU_arena;   // MCUs、planes、upsampled和RGBs都从这里切分，整体一次分配，图像之间复用
+    struct MCU **MCUs;        // MCU行的环形缓冲，第i行MCU解码到MCUs[i % MCU_row_ring_size]
+    int MCU_row_ring_size;    // 环形缓冲的MCU行数，并行解码时要容纳一批interval覆盖的所有行
     int horizontal_MCU_count; // 横向MCU个数
     int vertical_MCU_count;   // 纵向MCU个数
 
+    struct arena coefficient_arena; // 只解码系数时各分量整幅图像的系数平面，图像之间复用
+
     int MCU_horizontal_block_counts[4]; // 每个MCU中横向block个数
     int MCU_vertical_block_counts[4];   // 每个MCU中纵向block个数
-
-    uint8_t *RGBs;   // 最终RGB值
-    int data_length; // RGB的数据长度
+    int layout;                         // LAYOUT_444等，决定read_MCU选用的实现
+    read_MCU_func read_MCU;             // 按layout选定的MCU解码实现，每张图像选一次
+    read_MCU_func entropy_MCU;          // 两阶段解码的熵解码阶段，只熵解码不IDCT
+    idct_MCU_row_func idct_MCU_row;     // 两阶段解码的重建阶段，一行MCU的IDCT
+    int reconstruct_row_count;          // 两阶段解码时每批的MCU行数，0为不使用两阶段解码
+    int conversion_slot_count;          // upsampled和RGBs的份数，两阶段解码时并行转换的各行各用一份
+
+    int speculative;                              // 两阶段解码时先尝试推测解码，见speculative_decode
+    struct speculative_chunk *speculative_chunks; // 推测解码的各段，从MCU_arena切分
+    int speculative_chunk_count;                  // 推测解码最多分的段数，即线程数，0为不推测解码
+
+    struct define_huffman_table *dc_DHTs[4]; // 各分量用到的霍夫曼表和自然顺序的量化表，解析后查找一次
+    struct define_huffman_table *ac_DHTs[4];
+    uint16_t *quantizations[4];
+
+    int image_width;          // 输出图像(缩小后)的宽高，右侧和下侧补齐MCU的部分解码后不输出
+    int image_height;
+    int component_widths[4];  // 各分量在条带中有效的像素个数和行数，之后为补齐MCU的数据，上采样在此处取边缘
+    int component_heights[4];
+
+    uint8_t *planes[4];    // 各分量IDCT后的像素，每个分量为MCU_row_ring_size个条带，第i行MCU写入第i % MCU_row_ring_size个条带
+    int plane_widths[4];   // 各分量条带的宽度，即行跨度
+    int plane_heights[4];  // 各分量条带的高度，即一行MCU中该分量的像素行数
+    uint8_t *upsampled[4]; // Cb/Cr上采样到全分辨率的一行，共conversion_slot_count份
+    int chroma_upsamplers[4];  // Cb/Cr的上采样方式，CHROMA_FULL等
+    int horizontal_factors[4]; // Cb/Cr相对Y的水平和垂直采样倍数
+    int vertical_factors[4];
+
+    uint8_t *RGBs;   // 当前MCU行的RGB值，没有指定RGB_output时使用，共conversion_slot_count份
+    int data_length; // 一行MCU的RGB数据长度
+
+    uint8_t *RGB_output; // 不为NULL时RGB直接转换到调用者提供的整幅图像缓冲
+    int RGB_stride;      // RGB_output每行的字节数
+
+    // 输出区域(输出像素坐标)，不裁剪时为整幅图像
+    int crop_x;
+    int crop_y;
+    int crop_width;
+    int crop_height;
+    int MCU_row_begin; // 需要反量化和IDCT的MCU行范围[MCU_row_begin, MCU_row_end)，包含上采样用到的相邻行
+    int MCU_row_end;
+    int MCU_col_begin; // 需要反量化和IDCT的MCU列范围[MCU_col_begin, MCU_col_end)
+    int MCU_col_end;
+
+    jpeg_row_callback output; // 每行MCU解码完成后的输出回调
+    void *output_opaque;      // 输出回调的私有数据
+    int output_MCU_row;       // 正在交给输出回调的MCU行，jpeg_decoder_coefficients只能取这一行，不在回调中时为-1
+
+    int idct_method; // IDCT_METHOD_INT/IDCT_METHOD_FLOAT/IDCT_METHOD_FAST
+    idct_func idct;  // 根据idct_method及CPU支持的指令集选定的IDCT实现
+    int scale_denom; // 输出缩小为1/scale_denom
+
+    int block_sizes[4];  // 各分量每个block输出的像素边长，原尺寸为8，缩小解码时见init_block_sizes
+    idct_func idcts[4];  // 各分量按block_sizes选用的IDCT
+
+    int upsample_method;              // UPSAMPLE_NEAREST/UPSAMPLE_FANCY
+    color_convert_func color_convert; // 根据CPU支持的指令集选定的颜色转换实现
+
+    // 各阶段计时和熵解码计数，collect_stats非0时才统计，单位为read_ticks的计数，解析时清0
+    int collect_stats;
+    uint64_t start_ticks; // 开始解析时的计数和纳秒时间，用于把计数换算为秒
+    uint64_t start_ns;
+    uint64_t parse_ticks;
+    uint64_t color_ticks;            // 上采样和颜色转换
+    struct decode_counters counters; // 熵解码(包括与之合并的反量化)和IDCT
+
+    int alloc_count; // 当前图像的内存分配次数和字节数，总是统计
+    size_t alloc_bytes;
 };
 
-void usage(const char *name)
+// 编译时定义JPEG_DECODER_NO_STATS时统计代码全部去掉，否则由collect_stats在运行时决定
+#ifdef JPEG_DECODER_NO_STATS
+#define stats_enabled(_ctx) 0
+#else
+#define stats_enabled(_ctx) ((_ctx)->collect_stats)
+#endif
+
+// 解码器内部按图像分配的内存都经过这里或MCU_arena，用于统计每张图像的分配次数
+void *counted_realloc(struct context *ctx, void *ptr, size_t size)
+{
+    ++ctx->alloc_count;
+    ctx->alloc_bytes += size;
+    return realloc(ptr, size);
+}
+
+uint64_t monotonic_ns()
 {
-    log_("%s <filename>\n", name);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 计时用的计数，x86上为TSC，每个block计时两次也几乎没有开销，按同一段时间内的monotonic_ns换算为秒；其它平台直接为纳秒
+uint64_t read_ticks()
+{
+#ifdef SIMD_X86
+    return __rdtsc();
+#else
+    return monotonic_ns();
+#endif
 }
 
 uint8_t get_byte(struct context *ctx)
 {
+    if (ctx->ptr >= ctx->buffer + ctx->length) // 数据被截断时停在末尾返回0，不读越界
+        return 0;
+
     return *ctx->ptr++;
 }
 
@@ -194,35 +465,136 @@ uint16_t get_2bytes(struct context *ctx)
     return get_byte(ctx) << 8 | get_byte(ctx);
 }
 
-uint8_t get_bit(struct context *ctx)
+void init_bits(struct entropy_state *es, const uint8_t *data, const uint8_t *end)
 {
-    int bit_byte_offset = ctx->bit_offset % 8; // 在该字节中的位偏移量
-    int byte_offset = ctx->bit_offset / 8;     // 所在字节的偏移量
-    if (*(ctx->compress_data + byte_offset) == 0x00 && *(ctx->compress_data + byte_offset - 1) == 0xFF)
+    es->bit_buffer = 0;
+    es->bit_count = 0;
+    es->bit_padding_count = 0;
+    es->bit_ptr = data;
+    es->bit_end = end;
+}
+
+// 将位缓冲装到至少57个有效bit，装入时去掉0xFF后填充的0x00
+void fill_bits(struct entropy_state *es)
+{
+    // 快速路径：接下来8个字节中没有0xFF时，一次装入尽可能多的整字节
+    if (es->bit_end - es->bit_ptr >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, es->bit_ptr, 8);
+        word = __builtin_bswap64(word); // 码流为大端序
+        uint64_t inverted = ~word;      // 0xFF字节取反后为0x00，用判断0字节的方法检测
+        if (((inverted - 0x0101010101010101ULL) & ~inverted & 0x8080808080808080ULL) == 0)
+        {
+            int byte_count = (64 - es->bit_count) / 8;
+            word &= ~0ULL << (64 - byte_count * 8);
+            es->bit_buffer |= word >> es->bit_count;
+            es->bit_count += byte_count * 8;
+            es->bit_ptr += byte_count;
+            return;
+        }
+    }
+
+    // 慢速路径：逐字节装入，处理填充字节和marker
+    while (es->bit_count <= 56)
     {
-        ctx->bit_offset += 8;
+        uint8_t byte = 0;
+        int padding = 1;
+        if (es->bit_padding_count == 0 && es->bit_ptr < es->bit_end)
+        {
+            byte = *es->bit_ptr++;
+            padding = 0;
+            if (byte == 0xFF)
+            {
+                if (es->bit_ptr < es->bit_end && *es->bit_ptr == 0x00)
+                {
+                    es->bit_ptr++; // 0xFF 0x00，0x00为填充字节
+                }
+                else
+                {
+                    es->bit_ptr--; // 0xFF后接其它值为marker，压缩数据到此结束，停在marker处
+                    byte = 0;
+                    padding = 1;
+                }
+            }
+        }
+
+        if (padding) // 数据已读完，后面补0
+            es->bit_padding_count += 8;
+        es->bit_buffer |= (uint64_t)byte << (56 - es->bit_count);
+        es->bit_count += 8;
     }
+}
+
+// 预读n(1~16)个bit，不移动偏移量
+uint16_t peek_bits(struct entropy_state *es, int n)
+{
+    if (es->bit_count < n)
+        fill_bits(es);
 
-    return ((*(ctx->compress_data + ctx->bit_offset / 8)) >> (7 - ctx->bit_offset++ % 8)) & 0x01;
+    return es->bit_buffer >> (64 - n);
 }
 
-void read_DQT(struct context *ctx)
+void consume_bits(struct entropy_state *es, int n)
 {
-    ctx->DQTs = realloc(ctx->DQTs, (++ctx->count_DQTs) * sizeof(struct define_quantization_table));
-    struct define_quantization_table *dqt = &ctx->DQTs[ctx->count_DQTs - 1];
+    es->bit_buffer <<= n;
+    es->bit_count -= n;
+}
 
-    dqt->ptr = ctx->ptr - 2;
-    dqt->length = get_2bytes(ctx);
-    uint8_t byte = get_byte(ctx);
-    dqt->quantization_size = (byte >> 4) & 0x0F;
-    dqt->table_id = byte & 0x0F;
+// 读取n(0~16)个bit
+uint16_t get_bits(struct entropy_state *es, int n)
+{
+    if (n == 0)
+        return 0;
 
-    for (int i = 0; i < 8; ++i)
+    uint16_t bits = peek_bits(es, n);
+    consume_bits(es, n);
+    return bits;
+}
+
+// 增量解码时去掉数据不足而补入位缓冲的0，新数据到达后从bit_ptr继续装入
+void unpad_bits(struct entropy_state *es)
+{
+    es->bit_count -= es->bit_padding_count;
+    es->bit_buffer = es->bit_count > 0 ? es->bit_buffer & ~0ULL << (64 - es->bit_count) : 0;
+    es->bit_padding_count = 0;
+}
+
+// 一个DQT段中可以依次定义多个表，各表按表号存放
+void read_DQT(struct context *ctx)
+{
+    const uint8_t *seg_ptr = ctx->ptr - 2;
+    int length = get_2bytes(ctx);
+    const uint8_t *seg_end = seg_ptr + 2 + length; // parse_segments已检查段长不超出数据
+    while (ctx->ptr < seg_end)
     {
-        for (int j = 0; j < 8; ++j)
+        uint8_t byte = get_byte(ctx);
+        int quantization_size = (byte >> 4) & 0x0F;
+        int table_id = byte & 0x0F;
+        if (table_id > 3 || seg_end - ctx->ptr < (quantization_size == 0 ? 64 : 128))
+        {
+            log_("invalid DQT, id %d, %ld bytes left in segment\n", table_id, seg_end - ctx->ptr);
+            return;
+        }
+
+        struct define_quantization_table *dqt = &ctx->DQTs[table_id];
+        dqt->ptr = seg_ptr;
+        dqt->length = length;
+        dqt->quantization_size = quantization_size;
+        dqt->table_id = table_id;
+        for (int i = 0; i < 8; ++i)
+        {
+            for (int j = 0; j < 8; ++j)
+            {
+                dqt->values[i][j] = dqt->quantization_size == 0 ? get_byte(ctx) : get_2bytes(ctx);
+            }
+        }
+
+        for (int i = 0; i < 64; ++i)
         {
-            dqt->values[i][j] = dqt->quantization_size == 0 ? get_byte(ctx) : get_2bytes(ctx);
+            dqt->natural_values[natural_order[i]] = dqt->values[i / 8][i % 8];
         }
+        dqt->defined = 1;
     }
 }
 
@@ -230,10 +602,12 @@ void dump_DQTs(struct context *ctx)
 {
     printf("DQT\n");
     printf(" virtual addr\toffset\tlength\tquan size\tid\n");
-    for (int i = 0; i < ctx->count_DQTs; ++i)
+    for (int i = 0; i < 4; ++i)
     {
         struct define_quantization_table *dqt = &ctx->DQTs[i];
-        printf(" %p\t%lx\t%d\t%d\t\t%d\n", dqt->ptr, dqt->ptr - ctx->buffer, dqt->length, dqt->quantization_size, dqt->table_id);
+        if (!dqt->defined)
+            continue;
+        printf(" %p\t%lx\t%d\t%d\t\t%d\n", dqt->ptr, dqt->ptr ? dqt->ptr - ctx->buffer : -1L, dqt->length, dqt->quantization_size, dqt->table_id);
         for (int j = 0; j < 8; ++j)
         {
             printf("  ");
@@ -248,43 +622,166 @@ void dump_DQTs(struct context *ctx)
     printf("\n");
 }
 
-void read_DHT(struct context *ctx)
+int calculate_coefficient_vli(uint16_t value, uint16_t mask)
 {
-    ctx->DHTs = realloc(ctx->DHTs, (++ctx->count_DHTs) * sizeof(struct define_huffman_table));
-    struct define_huffman_table *dht = &ctx->DHTs[ctx->count_DHTs - 1];
+    int value_bit_count = 0;
+    uint16_t tmp = mask;
+    while (tmp)
+    {
+        tmp &= (tmp - 1);
+        value_bit_count++;
+    }
 
-    dht->ptr = ctx->ptr - 2;
-    dht->length = get_2bytes(ctx);
-    uint8_t byte = get_byte(ctx);
-    dht->ac_dc_type = (byte >> 4) & 0x0F;
-    dht->table_id = byte & 0x0F;
+    int coeff = (int)value;
+    if (value >> (value_bit_count - 1) == 0)
+        coeff = -((~value) & mask);
 
-    struct define_huffman_table_code_item item = {0x0000, 0x0001};
+    return coeff;
+}
+
+// 根据码字表生成解码用的各级查找表
+void build_DHT_lookup(struct define_huffman_table *dht)
+{
+    // 慢速路径：每个码长的最大码字及码字到items下标的偏移
     int item_index = 0;
     for (int i = 0; i < 16; ++i)
     {
-        dht->leave_counts[i] = get_byte(ctx); // 该层个数
+        int bit_count = i + 1;
         if (dht->leave_counts[i] != 0)
         {
-            dht->leave_count_total += dht->leave_counts[i];
-            dht->items = realloc(dht->items, dht->leave_count_total * sizeof(struct define_huffman_table_code_item));
-            for (int j = 0; j < dht->leave_counts[i]; ++j) // 计算该层每个码字
+            dht->value_offsets[bit_count] = item_index - dht->items[item_index].code;
+            item_index += dht->leave_counts[i];
+            dht->max_codes[bit_count] = dht->items[item_index - 1].code;
+        }
+        else
+        {
+            dht->max_codes[bit_count] = -1;
+        }
+    }
+    dht->max_codes[17] = 0x7FFFFFFF; // 哨兵，保证非法码流时慢速路径也能结束
+
+    // 快速路径：码长不超过HUFFMAN_LOOKUP_BITS的码字，以其为前缀的所有预读值都指向该码字
+    for (int i = 0; i < dht->leave_count_total; ++i)
+    {
+        struct define_huffman_table_code_item *item = &dht->items[i];
+        int bit_count = 0;
+        for (uint16_t tmp = item->mask; tmp; tmp >>= 1)
+            ++bit_count;
+        if (bit_count > HUFFMAN_LOOKUP_BITS)
+            break; // items按码长递增排列，后面的都更长
+
+        int shift = HUFFMAN_LOOKUP_BITS - bit_count;
+        for (int j = 0; j < (1 << shift); ++j)
+        {
+            int index = (item->code << shift) | j;
+            dht->lookup[index] = bit_count << 8 | item->value;
+
+            // 交流表中，若码字与其后的系数位数合起来不超过预读位数，直接把系数也算出来
+            // 系数存在int16_t的高8位，只能合并不超过7位(|系数| <= 127)的，8位的走普通路径
+            int run = (item->value >> 4) & 0x0F;
+            int size = item->value & 0x0F;
+            if (dht->ac_dc_type == 1 && size != 0 && size <= 7 && bit_count + size <= HUFFMAN_LOOKUP_BITS)
+            {
+                uint16_t bits = (index >> (shift - size)) & ((1 << size) - 1);
+                int coeff = calculate_coefficient_vli(bits, (1 << size) - 1);
+                dht->ac_lookup[index] = coeff * 256 + (run << 4) + bit_count + size;
+            }
+        }
+    }
+}
+
+// 按各码长的码字个数和按码字顺序排列的值定义霍夫曼表，码字总数不超过256
+// 与该位置已有的表完全相同时直接沿用之前生成的查找表，MJPEG的每帧通常重复相同的DHT
+// 码字个数超出码长能表示的范围或直流差值位数超过11时返回-1，该表标记为invalid，不生成查找表
+int define_DHT(struct define_huffman_table *dht, int ac_dc_type, int table_id, const uint8_t *leave_counts, const uint8_t *values)
+{
+    int leave_count_total = 0;
+    for (int i = 0; i < 16; ++i)
+        leave_count_total += leave_counts[i];
+
+    int same = dht->lookup_built && dht->leave_count_total == leave_count_total && memcmp(dht->leave_counts, leave_counts, 16) == 0;
+    for (int i = 0; same && i < leave_count_total; ++i)
+        same = dht->items[i].value == values[i];
+    if (same)
+    {
+        dht->defined = 1;
+        return 0;
+    }
+
+    memset(dht, 0, sizeof(struct define_huffman_table)); // 该位置之前的表
+    dht->ac_dc_type = ac_dc_type;
+    dht->table_id = table_id;
+    dht->leave_count_total = leave_count_total;
+    memcpy(dht->leave_counts, leave_counts, 16);
+
+    // 直流的值是差值的位数，baseline最多11位，更大的值会让get_bits读超过16位
+    for (int i = 0; ac_dc_type == 0 && i < leave_count_total; ++i)
+    {
+        if (values[i] > 11)
+        {
+            log_("invalid DHT, type %d, id %d, DC value %d\n", ac_dc_type, table_id, values[i]);
+            dht->invalid = 1;
+            return -1;
+        }
+    }
+
+    struct define_huffman_table_code_item item = {0x0000, 0x0001};
+    int item_index = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        for (int j = 0; j < dht->leave_counts[i]; ++j) // 计算该层每个码字
+        {
+            if (item.code >= 1 << (i + 1)) // 码字超出该码长的范围，查找表下标会越界
             {
-                dht->items[item_index++] = item;
-                ++item.code; // 存在数目的情况下码字要先+1
+                log_("invalid DHT, type %d, id %d, too many codes of length %d\n", ac_dc_type, table_id, i + 1);
+                dht->invalid = 1;
+                return -1;
             }
+            dht->items[item_index] = item;
+            dht->items[item_index].value = values[item_index];
+            ++item_index;
+            ++item.code; // 存在数目的情况下码字要先+1
         }
         item.code <<= 1;   // 再左移
         item.mask <<= 1;   // mask要先左移
         item.mask |= 0x01; // 再+1
     }
-    for (int i = 0; i < dht->leave_count_total; ++i)
-    {
-        dht->items[i].value = get_byte(ctx);
-    }
-    if (dht->length - 2 - 1 - 16 != dht->leave_count_total)
+
+    build_DHT_lookup(dht);
+    dht->defined = 1;
+    dht->lookup_built = 1;
+    return 0;
+}
+
+// 一个DHT段中可以依次定义多个表，各表按[直流/交流][表号]存放
+void read_DHT(struct context *ctx)
+{
+    const uint8_t *seg_ptr = ctx->ptr - 2;
+    int length = get_2bytes(ctx);
+    const uint8_t *seg_end = seg_ptr + 2 + length; // parse_segments已检查段长不超出数据
+    while (ctx->ptr < seg_end)
     {
-        log_("DHT %d seems not simple\n", ctx->count_DHTs - 1);
+        uint8_t byte = get_byte(ctx);
+        int ac_dc_type = (byte >> 4) & 0x0F;
+        int table_id = byte & 0x0F;
+        uint8_t leave_counts[16];
+        int leave_count_total = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            leave_counts[i] = get_byte(ctx); // 该层个数
+            leave_count_total += leave_counts[i];
+        }
+        if (ac_dc_type > 1 || table_id > 3 || leave_count_total > 256 || leave_count_total > seg_end - ctx->ptr)
+        {
+            log_("invalid DHT, type %d, id %d, %d codes, %ld bytes left in segment\n", ac_dc_type, table_id, leave_count_total, seg_end - ctx->ptr);
+            return;
+        }
+
+        struct define_huffman_table *dht = &ctx->DHTs[ac_dc_type][table_id];
+        define_DHT(dht, ac_dc_type, table_id, leave_counts, ctx->ptr);
+        dht->ptr = seg_ptr;
+        dht->length = length;
+        ctx->ptr += leave_count_total;
     }
 }
 
@@ -292,10 +789,12 @@ void dump_DHTs(struct context *ctx)
 {
     printf("DHT\n");
     printf(" virtual addr\toffset\tlength\tac/dc\ttable id\n");
-    for (int i = 0; i < ctx->count_DHTs; ++i)
+    for (int i = 0; i < 8; ++i)
     {
-        struct define_huffman_table *dht = &ctx->DHTs[i];
-        printf(" %p\t%lx\t%d\t%d\t%d\n", dht->ptr, dht->ptr - ctx->buffer, dht->length, dht->ac_dc_type, dht->table_id);
+        struct define_huffman_table *dht = &ctx->DHTs[i / 4][i % 4];
+        if (!dht->defined)
+            continue;
+        printf(" %p\t%lx\t%d\t%d\t%d\n", dht->ptr, dht->ptr ? dht->ptr - ctx->buffer : -1L, dht->length, dht->ac_dc_type, dht->table_id);
         printf("  code\tvalue\tmask\n");
         for (int j = 0; j < min(dht->leave_count_total, 20); ++j)
         {
@@ -319,7 +818,7 @@ void read_SOF0(struct context *ctx)
     sof0->height = get_2bytes(ctx);
     sof0->width = get_2bytes(ctx);
     sof0->color_channel_count = get_byte(ctx);
-    for (int i = 0; i < ctx->SOF0.color_channel_count; ++i)
+    for (int i = 0; i < min(sof0->color_channel_count, 3); ++i) // 只支持3个分量，CMYK等由check_segments拒绝
     {
         struct start_of_frame_0_channel_info *ci = &sof0->channel_info[i];
 
@@ -339,7 +838,7 @@ void dump_SOF0(struct context *ctx)
     printf(" %p\t%lx\t%d\t%d\t\t%dx%d\t\t%d\n",
         sof0->ptr, sof0->ptr - ctx->buffer, sof0->length, sof0->accuracy, sof0->width, sof0->height, sof0->color_channel_count);
     printf("  color id\thorizontal sample rate\tvertical sample rate\tdqt id\n");
-    for (int i = 0; i < sof0->color_channel_count; ++i)
+    for (int i = 0; i < min(sof0->color_channel_count, 3); ++i)
     {
         struct start_of_frame_0_channel_info *ci = &sof0->channel_info[i];
         printf("  %d\t\t%d\t\t\t%d\t\t\t%d\n",
@@ -355,9 +854,9 @@ void read_SOS(struct context *ctx)
     sos->ptr = ctx->ptr - 2;
     sos->length = get_2bytes(ctx);
     sos->color_channel_count = get_byte(ctx);
-    for (int i = 0; i < 3; ++i)
+    for (int i = 0; i < sos->color_channel_count; ++i)
     {
-        struct start_of_scan_channel_info *ci = &sos->channel_info[i];
+        struct start_of_scan_channel_info *ci = &sos->channel_info[min(i, 2)]; // 超过3个分量时只为了跳过数据，由check_segments拒绝
 
         ci->color_id = get_byte(ctx);
         uint8_t byte = get_byte(ctx);
@@ -368,6 +867,13 @@ void read_SOS(struct context *ctx)
     sos->not_baseline_1 = get_byte(ctx);
     sos->not_baseline_2 = get_byte(ctx);
     ctx->compress_data = ctx->ptr;
+    init_bits(&ctx->entropy, ctx->compress_data, ctx->buffer + ctx->length);
+}
+
+void read_DRI(struct context *ctx)
+{
+    get_2bytes(ctx); // 长度固定为4
+    ctx->restart_interval = get_2bytes(ctx);
 }
 
 void dump_SOS(struct context *ctx)
@@ -379,7 +885,7 @@ void dump_SOS(struct context *ctx)
     printf(" %p\t%lx\t%d\t%d\t\t\t0x%02x%02x%02x\n",
         sos->ptr, sos->ptr - ctx->buffer, sos->length, sos->color_channel_count, sos->not_baseline_0, sos->not_baseline_1, sos->not_baseline_2);
     printf("  color id\tdc dht id\tac dht id\n");
-    for (int i = 0; i < sos->color_channel_count; ++i)
+    for (int i = 0; i < min(sos->color_channel_count, 3); ++i)
     {
         struct start_of_scan_channel_info *ci = &sos->channel_info[i];
         printf("  %d\t\t%d\t\t%d\n", ci->color_id, ci->dc_dht_id, ci->ac_dht_id);
@@ -387,17 +893,22 @@ void dump_SOS(struct context *ctx)
     printf("\n");
 }
 
+// 图像中没有定义时使用Annex K的标准表，表号为0/1时总能找到
 struct define_huffman_table *find_DHT_by_type_and_id(struct context *ctx, int ac_dc_type, int table_id)
 {
-    for (int i = 0; i < ctx->count_DHTs; ++i)
+    if (table_id > 3)
+        return NULL;
+
+    struct define_huffman_table *dht = &ctx->DHTs[ac_dc_type][table_id];
+    if (!dht->defined && !dht->invalid && table_id < 2)
     {
-        if (ctx->DHTs[i].ac_dc_type == ac_dc_type && ctx->DHTs[i].table_id == table_id)
-        {
-            return &ctx->DHTs[i];
-        }
+        const struct standard_huffman_table *std = &standard_DHTs[ac_dc_type][table_id];
+        define_DHT(dht, ac_dc_type, table_id, std->leave_counts, std->values);
+        dht->ptr = NULL;
+        dht->length = 0;
     }
 
-    return NULL;
+    return dht->defined ? dht : NULL;
 }
 
 // 根据color_id(YCbCr)找到相应的直流霍夫曼表和交流霍夫曼表
@@ -421,453 +932,2261 @@ struct define_quantization_table *find_DQT_by_color_id(struct context *ctx, int
         struct start_of_frame_0_channel_info *info = &ctx->SOF0.channel_info[i];
         if (info->color_id == color_id)
         {
-            for (int j = 0; j < ctx->count_DQTs; ++j)
-            {
-                if (ctx->DQTs[j].table_id == info->dqt_table_id)
-                {
-                    return &ctx->DQTs[j];
-                }
-            }
+            if (info->dqt_table_id < 4 && ctx->DQTs[info->dqt_table_id].defined)
+                return &ctx->DQTs[info->dqt_table_id];
         }
     }
 
     return NULL;
 }
 
-int calculate_coefficient_vli(uint16_t value, uint16_t mask)
+int get_next_vli_value(struct entropy_state *es, int next_value_bit_count)
 {
-    int value_bit_count = 0;
-    uint16_t tmp = mask;
-    while (tmp)
+    if (next_value_bit_count == 0) // 差分为0时没有后续bit
+        return 0;
+
+    int value = get_bits(es, next_value_bit_count);
+    if (value < (1 << (next_value_bit_count - 1))) // 最高位为0表示负数
+        value -= (1 << next_value_bit_count) - 1;
+
+    return value;
+}
+
+// 解码一个霍夫曼码字，返回码字对应的值，非法码字返回-1且不读取，不输出日志，推测解码时直接使用
+static inline __attribute__((always_inline)) int lookup_huffman(struct entropy_state *es, struct define_huffman_table *dht)
+{
+    uint16_t entry = dht->lookup[peek_bits(es, HUFFMAN_LOOKUP_BITS)];
+    if (entry) // 快速路径：码长不超过预读位数
     {
-        tmp &= (tmp - 1);
-        value_bit_count++;
+        consume_bits(es, entry >> 8);
+        return entry & 0xFF;
     }
 
-    int coeff = (int)value;
-    if (value >> (value_bit_count - 1) == 0)
-        coeff = -((~value) & mask);
+    // 慢速路径：预读16bit后逐bit加长，直到码字不大于该码长的最大码字
+    uint16_t bits = peek_bits(es, 16);
+    int bit_count = HUFFMAN_LOOKUP_BITS + 1;
+    while (bit_count <= 16 && bits >> (16 - bit_count) > dht->max_codes[bit_count])
+    {
+        ++bit_count;
+    }
 
-    return coeff;
+    if (bit_count > 16)
+        return -1;
+
+    consume_bits(es, bit_count);
+    return dht->items[(bits >> (16 - bit_count)) + dht->value_offsets[bit_count]].value;
 }
 
-int get_next_vli_value(struct context *ctx, int next_value_bit_count)
+// 解码一个霍夫曼码字，返回码字对应的值，非法码字返回-1
+int decode_huffman(struct context *ctx, struct entropy_state *es, struct define_huffman_table *dht)
 {
-    uint16_t next_value = 0, next_mask = 0;
-    for (int i = 0; i < next_value_bit_count; ++i)
+    int value = lookup_huffman(es, dht);
+    if (value < 0)
     {
-        next_value <<= 1;
-        next_value |= get_bit(ctx);
-        next_mask <<= 1;
-        next_mask |= 0x01;
+        log_("should not be here, code: %x, dht: %d, %d, offset: %ld\n",
+            peek_bits(es, 16), dht->ac_dc_type, dht->table_id, es->bit_ptr - ctx->buffer);
     }
+    return value;
+}
 
-    return calculate_coefficient_vli(next_value, next_mask);
+// 第row行(分量内的全局行号)像素在条带环形缓冲中的位置
+uint8_t *get_plane_line(struct context *ctx, int color_id, int row)
+{
+    int height = ctx->plane_heights[color_id];
+    int slot = row / height % ctx->MCU_row_ring_size;
+    return ctx->planes[color_id] + ((long)slot * height + row % height) * ctx->plane_widths[color_id];
+}
+
+// 已读取的压缩数据bit位置，只用于计算两次之间的差，0xFF后填充的0x00按8 bit计入
+int64_t bit_position(struct entropy_state *es)
+{
+    return (int64_t)(uintptr_t)es->bit_ptr * 8 - es->bit_count + es->bit_padding_count;
 }
 
-void read_block(struct context *ctx, int color_id, struct block *blk)
+// 下一个要读取的bit在压缩数据中的位置(字节地址 * 8 + 字节内的bit)，与位缓冲中装了多少数据无关，不同的熵解码状态之间可以比较
+// 位缓冲中剩余的数据bit来自bit_ptr之前的几个数据字节，向前数时跳过0xFF之后填充的0x00；读到补入的0之后位置继续增加
+int64_t exact_bit_position(struct entropy_state *es)
 {
-    int count_values = 0;
-    struct define_huffman_table *dc_dht = NULL, *ac_dht = NULL;
-    find_DHT_by_color_id(ctx, color_id, &dc_dht, &ac_dht);
-    // [TODO] check pointer
+    int remaining = es->bit_count - es->bit_padding_count;
+    if (remaining <= 0)
+        return (int64_t)(uintptr_t)es->bit_ptr * 8 - remaining;
 
-    int found_0x00 = 0;                        // 标识是否遇到了0x00，如果遇到，说明该block解析结束
-    struct define_huffman_table *dht = dc_dht; // 首先查找直流分量
-    while (count_values < 64)                  // 一共就64个数
+    const uint8_t *p = es->bit_ptr;
+    int byte_count = (remaining + 7) / 8;
+    for (int i = 0; i < byte_count; ++i)
     {
-        uint16_t test_code = 0, test_mask = 0; // 要与霍夫曼表匹配的码字和mask
-        uint8_t test_value = 0;                // 霍夫曼表中该码字对应的值
-        int found = 0;                         // 标识查找到当前码字
-        for (int i = 0; i < 16; ++i)           // 一共最长就16位
-        {
-            test_code <<= 1;
-            test_code |= get_bit(ctx);
-            test_mask <<= 1;
-            test_mask |= 0x01;
-            for (int j = 0; j < dht->leave_count_total; ++j) // 遍历dht表
-            {
-                struct define_huffman_table_code_item *item = &dht->items[j];
-                if (test_mask == item->mask && test_code == item->code) // 位数相同（mask）并且code相同为找到
-                {
-                    found = 1;
-                    test_value = item->value;
-                    break;
-                }
-            }
+        --p;
+        if (*p == 0x00 && p[-1] == 0xFF)
+            --p;
+    }
+    return (int64_t)(uintptr_t)p * 8 + byte_count * 8 - remaining;
+}
+
+// 熵解码一个block，反量化后的系数按自然顺序存入blk
+// counters不为NULL时统计EOB位置和0游程；总是内联，调用处传常量NULL时统计代码被去掉，不统计时没有额外开销
+static inline __attribute__((always_inline)) void read_block(struct context *ctx, struct entropy_state *es, int color_id, struct block *blk,
+    struct decode_counters *counters)
+{
+    memset(blk->coefficient, 0, sizeof(blk->coefficient)); // block会被复用，先清0
+
+    struct define_huffman_table *dc_dht = ctx->dc_DHTs[color_id], *ac_dht = ctx->ac_DHTs[color_id];
+    uint16_t *quantization = ctx->quantizations[color_id];
+
+    // 系数解码后直接乘以量化值写到自然顺序的位置，反量化和反zigzag不再单独处理
+    // 合法码流中反量化后的系数不会超出int16范围
+
+    // 第一个是直流分量，值为差分系数的位数
+    int value = decode_huffman(ctx, es, dc_dht);
+    if (value >= 0)
+    {
+        es->dc_global_coefficient[color_id] += get_next_vli_value(es, value);
+        blk->coefficient[0] = es->dc_global_coefficient[color_id] * quantization[0];
+    }
 
-            if (found) // 与霍夫曼表成功匹配，解析值
+    // 后面都是交流分量，一共就64个数
+    int count_values = 1;
+    while (value >= 0 && count_values < 64)
+    {
+        int16_t combined = ac_dht->ac_lookup[peek_bits(es, HUFFMAN_LOOKUP_BITS)];
+        if (combined) // 码字和系数都在预读范围内，查表一次得到
+        {
+            consume_bits(es, combined & 0x0F);
+            count_values += (combined >> 4) & 0x0F;
+            if (counters)
+                ++counters->zero_runs[(combined >> 4) & 0x0F];
+            if (count_values < 64)
             {
-                if (count_values == 0) // 第一个是直流分量，处理之后后面都是交流分量
-                {
-                    dht = ac_dht; // 找到了dc，接下来切换到交流表
-                    ctx->dc_global_coefficient[color_id] += get_next_vli_value(ctx, test_value);
-                    blk->coefficient[0][0] = ctx->dc_global_coefficient[color_id];
-                    ++count_values;
-                }
-                else // 处理ac，稍微复杂
-                {
-                    if (test_value == 0x00) // 如果找到0x00，后面全0，可以结束
-                    {
-                        found_0x00 = 1;
-                        break;
-                    }
-
-                    uint8_t next_zero_count = (test_value >> 4) & 0x0F;      // 高4位为接下来有几个0
-                    uint8_t next_value_bit_count = (test_value >> 0) & 0x0F; // 低4位为接下来的数需要读几个bit
-                    if (test_value == 0xF0)
-                    {
-                        next_zero_count = 16;
-                        next_value_bit_count = 0;
-                    }
-
-                    for (int k = 0; k < next_zero_count; ++k)
-                    {
-                        blk->coefficient[count_values / 8][count_values % 8] = 0;
-                        ++count_values;
-                    }
-
-                    if (next_value_bit_count > 0)
-                    {
-                        blk->coefficient[count_values / 8][count_values % 8] = get_next_vli_value(ctx, next_value_bit_count);
-                        ++count_values;
-                    }
-                }
-                break;
+                int index = natural_order[count_values];
+                blk->coefficient[index] = (combined >> 8) * quantization[index];
             }
+            ++count_values;
+            continue;
         }
 
-        if (!found)
+        value = decode_huffman(ctx, es, ac_dht);
+        if (value <= 0) // 如果找到0x00，后面全0，可以结束
+            break;
+
+        int next_zero_count = (value >> 4) & 0x0F;      // 高4位为接下来有几个0
+        int next_value_bit_count = (value >> 0) & 0x0F; // 低4位为接下来的数需要读几个bit
+        if (value == 0xF0)
         {
-            log_("should not be here, test_code: %x, test_mask: %x, dht: %d, %d, offset: %ld->%ld\n",
-                test_code, test_mask, dht->ac_dc_type, dht->table_id, ctx->compress_data - ctx->buffer, ctx->bit_offset);
-            // exit(0);
+            next_zero_count = 16;
+            next_value_bit_count = 0;
         }
 
-        if (found_0x00)
+        count_values += next_zero_count; // block初始即为全0，跳过即可
+        if (counters)
+            ++counters->zero_runs[next_zero_count];
+        if (next_value_bit_count > 0 && count_values < 64)
         {
-            break;
+            int index = natural_order[count_values];
+            blk->coefficient[index] = get_next_vli_value(es, next_value_bit_count) * quantization[index];
+            ++count_values;
         }
     }
 
-    // 反量化
-    struct define_quantization_table *dqt = find_DQT_by_color_id(ctx, color_id);
-    for (int i = 0; i < 8; ++i)
+    if (counters)
     {
-        for (int j = 0; j < 8; ++j)
-        {
-            blk->dequantized[i][j] = blk->coefficient[i][j] * dqt->values[i][j];
-        }
+        ++counters->decoded_blocks;
+        ++counters->eob_positions[min(count_values, JPEG_STATS_EOB_POSITIONS - 1)];
     }
+}
 
-    // 反zigzag
-    for (int i = 0; i < 8; ++i)
+// 只熵解码不保存系数，用于裁剪区域以外的block，直流差分仍要累加，读取的bit与read_block相同
+void skip_block(struct context *ctx, struct entropy_state *es, int color_id)
+{
+    struct define_huffman_table *dc_dht = ctx->dc_DHTs[color_id], *ac_dht = ctx->ac_DHTs[color_id];
+
+    int value = decode_huffman(ctx, es, dc_dht);
+    if (value >= 0)
+        es->dc_global_coefficient[color_id] += get_next_vli_value(es, value);
+
+    int count_values = 1;
+    while (value >= 0 && count_values < 64)
     {
-        for (int j = 0; j < 8; ++j)
+        int16_t combined = ac_dht->ac_lookup[peek_bits(es, HUFFMAN_LOOKUP_BITS)];
+        if (combined)
         {
-            int index = dezigzag[i][j];
-            blk->dezigzaged[i][j] = blk->dequantized[index / 8][index % 8];
+            consume_bits(es, combined & 0x0F);
+            count_values += ((combined >> 4) & 0x0F) + 1;
+            continue;
         }
-    }
 
-    // 反离散余弦
-    for (int i = 0; i < 8; ++i)
-    {
-        for (int j = 0; j < 8; ++j)
-        {
-            double v = 0;
-            for (int x = 0; x < 8; ++x)
-            {
-                for (int y = 0; y < 8; ++y)
-                {
-                    double c_x = x == 0 ? 1.0f / sqrt(2) : 1.0f;
-                    double c_y = y == 0 ? 1.0f / sqrt(2) : 1.0f;
+        value = decode_huffman(ctx, es, ac_dht);
+        if (value <= 0)
+            break;
 
-                    v += c_x * c_y * cos(((2 * i + 1) * x * PI) / 16) * cos(((2 * j + 1) * y * PI) / 16) * blk->dezigzaged[x][y];
-                }
-            }
-            blk->idcted[i][j] = v / 4;
+        int next_zero_count = (value >> 4) & 0x0F;
+        int next_value_bit_count = (value >> 0) & 0x0F;
+        if (value == 0xF0)
+        {
+            next_zero_count = 16;
+            next_value_bit_count = 0;
         }
-    }
-}
 
-void read_MCU(struct context *ctx, struct MCU *mcu)
-{
-    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
-    {
-        mcu->blocks[color_id] = calloc(ctx->MCU_vertical_block_counts[color_id], sizeof(struct block *));
-        for (int i = 0; i < ctx->MCU_vertical_block_counts[color_id]; ++i)
+        count_values += next_zero_count;
+        if (next_value_bit_count > 0 && count_values < 64)
         {
-            mcu->blocks[color_id][i] = calloc(ctx->MCU_horizontal_block_counts[color_id], sizeof(struct block));
-            for (int j = 0; j < ctx->MCU_horizontal_block_counts[color_id]; ++j)
-            {
-                read_block(ctx, color_id, &mcu->blocks[color_id][i][j]);
-            }
+            get_bits(es, next_value_bit_count);
+            ++count_values;
         }
     }
 }
 
-void read_compressed_data(struct context *ctx)
+// 推测解码一个block，只累加直流差分，读取的bit与read_block相同；非法码字、直流差分超过11位或交流系数超过63个时返回-1
+int speculate_block(struct context *ctx, struct entropy_state *es, int color_id)
 {
-    ctx->horizontal_MCU_count = ctx->SOF0.width / ctx->SOF0.channel_info[0].horizontal_sample_rate / BLOCK_HORIZONTAL_PIXEL_COUNT;
-    ctx->vertical_MCU_count = ctx->SOF0.height / ctx->SOF0.channel_info[0].vertical_sample_rate / BLOCK_VERTICAL_PIXEL_COUNT;
-    for (int i = 0; i < ctx->SOF0.color_channel_count; ++i)
-    {
-        struct start_of_frame_0_channel_info *info = &ctx->SOF0.channel_info[i];
-        ctx->MCU_horizontal_block_counts[info->color_id] = info->horizontal_sample_rate;
-        ctx->MCU_vertical_block_counts[info->color_id] = info->vertical_sample_rate;
-    }
+    struct define_huffman_table *dc_dht = ctx->dc_DHTs[color_id], *ac_dht = ctx->ac_DHTs[color_id];
+
+    int value = lookup_huffman(es, dc_dht);
+    if (value < 0 || value > 11)
+        return -1;
+    es->dc_global_coefficient[color_id] += get_next_vli_value(es, value);
 
-    ctx->MCUs = calloc(ctx->vertical_MCU_count, sizeof(struct MCU *));
-    for (int i = 0; i < ctx->vertical_MCU_count; ++i)
+    int count_values = 1;
+    while (count_values < 64)
     {
-        ctx->MCUs[i] = calloc(ctx->horizontal_MCU_count, sizeof(struct MCU));
-        for (int j = 0; j < ctx->horizontal_MCU_count; ++j)
+        int16_t combined = ac_dht->ac_lookup[peek_bits(es, HUFFMAN_LOOKUP_BITS)];
+        if (combined)
         {
-            read_MCU(ctx, &ctx->MCUs[i][j]);
+            consume_bits(es, combined & 0x0F);
+            count_values += ((combined >> 4) & 0x0F) + 1;
+            continue;
         }
-    }
 
-    // 去掉头的压缩数据起始点 + 读取的bit长度 / 8 + EOI
-    log_("file length: %d, read length: %lf\n", ctx->length, ctx->compress_data - ctx->buffer + ctx->bit_offset / 8.0f + 2);
+        value = lookup_huffman(es, ac_dht);
+        if (value < 0)
+            return -1;
+        if (value == 0)
+            break;
 
-    // 转RGB
-    int horizontal_MCU_pixel_count = ctx->MCU_horizontal_block_counts[COLOR_ID_Y] * 8;
-    int vertical_MCU_pixel_count = ctx->MCU_vertical_block_counts[COLOR_ID_Y] * 8;
-    int horizontal_pixel_count = ctx->horizontal_MCU_count * horizontal_MCU_pixel_count;
-    int vertical_pixel_count = ctx->vertical_MCU_count * vertical_MCU_pixel_count;
+        int next_zero_count = (value >> 4) & 0x0F;
+        int next_value_bit_count = (value >> 0) & 0x0F;
+        if (value == 0xF0)
+        {
+            next_zero_count = 16;
+            next_value_bit_count = 0;
+        }
 
-    ctx->data_length = vertical_pixel_count * horizontal_pixel_count * 3;
-    ctx->RGBs = calloc(ctx->data_length, sizeof(uint8_t));
+        count_values += next_zero_count;
+        if (next_value_bit_count > 0 && count_values < 64)
+        {
+            get_bits(es, next_value_bit_count);
+            ++count_values;
+        }
+    }
 
-    int ptr = 0;
+    return count_values > 64 ? -1 : 0;
+}
 
-    for (int i = 0; i < vertical_pixel_count; ++i)
+int speculate_MCU(struct context *ctx, struct entropy_state *es)
+{
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
     {
-        int MCU_i = i / vertical_MCU_pixel_count;
-        int block_i = i % vertical_MCU_pixel_count / BLOCK_VERTICAL_PIXEL_COUNT;
-        int idcted_i = i % vertical_MCU_pixel_count % BLOCK_VERTICAL_PIXEL_COUNT;
-        for (int j = 0; j < horizontal_pixel_count; ++j)
+        int block_count = ctx->MCU_vertical_block_counts[color_id] * ctx->MCU_horizontal_block_counts[color_id];
+        for (int i = 0; i < block_count; ++i)
         {
-            int MCU_j = j / horizontal_MCU_pixel_count;
-            int block_j = j % horizontal_MCU_pixel_count / BLOCK_HORIZONTAL_PIXEL_COUNT;
-            int idcted_j = j % horizontal_MCU_pixel_count % BLOCK_HORIZONTAL_PIXEL_COUNT;
+            if (speculate_block(ctx, es, color_id) != 0)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+void skip_MCU(struct context *ctx, struct entropy_state *es)
+{
+    uint64_t start = stats_enabled(ctx) ? read_ticks() : 0;
+    int64_t position = stats_enabled(ctx) ? bit_position(es) : 0;
+    int MCU_block_count = 0;
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        int block_count = ctx->MCU_vertical_block_counts[color_id] * ctx->MCU_horizontal_block_counts[color_id];
+        for (int i = 0; i < block_count; ++i)
+            skip_block(ctx, es, color_id);
+        MCU_block_count += block_count;
+    }
+    if (stats_enabled(ctx))
+    {
+        es->counters->MCU_ticks += read_ticks() - start;
+        es->counters->bits += bit_position(es) - position;
+        es->counters->skipped_blocks += MCU_block_count;
+    }
+}
+
+// 第color_id个分量每个MCU中横向/纵向的block个数，Y_h为0时为通用实现，从context中取，否则为常量：Y为Y_h x Y_v，色度为chroma x chroma
+#define layout_horizontal_blocks(_color_id) (Y_h ? ((_color_id) == COLOR_ID_Y ? Y_h : chroma) : ctx->MCU_horizontal_block_counts[_color_id])
+#define layout_vertical_blocks(_color_id) (Y_h ? ((_color_id) == COLOR_ID_Y ? Y_v : chroma) : ctx->MCU_vertical_block_counts[_color_id])
+
+static inline __attribute__((always_inline)) void read_MCU_blocks(struct context *ctx, struct entropy_state *es, struct MCU *mcu,
+    struct decode_counters *counters, int Y_h, int Y_v, int chroma)
+{
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        for (int i = 0; i < layout_vertical_blocks(color_id); ++i)
+            for (int j = 0; j < layout_horizontal_blocks(color_id); ++j)
+                read_block(ctx, es, color_id, &mcu->blocks[color_id][i][j], counters);
+    }
+}
+
+static inline __attribute__((always_inline)) void idct_MCU(struct context *ctx, struct MCU *mcu, int MCU_i, int MCU_j, int Y_h, int Y_v, int chroma)
+{
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        int stride = ctx->plane_widths[color_id];
+        for (int i = 0; i < layout_vertical_blocks(color_id); ++i)
+        {
+            uint8_t *line = get_plane_line(ctx, color_id, MCU_i * ctx->plane_heights[color_id] + i * ctx->block_sizes[color_id]);
+            for (int j = 0; j < layout_horizontal_blocks(color_id); ++j)
+            {
+                int x = (MCU_j * layout_horizontal_blocks(color_id) + j) * ctx->block_sizes[color_id];
+                ctx->idcts[color_id](mcu->blocks[color_id][i][j].coefficient, line + x, stride); // 反离散余弦 + 加128
+            }
+        }
+    }
+}
+
+// 第MCU_i行中裁剪列范围内的MCU，按其中已熵解码的系数IDCT
+static inline __attribute__((always_inline)) void idct_MCU_row_layout(struct context *ctx, int MCU_i, int Y_h, int Y_v, int chroma)
+{
+    struct MCU *row = ctx->MCUs[MCU_i % ctx->MCU_row_ring_size];
+    for (int j = ctx->MCU_col_begin; j < ctx->MCU_col_end; ++j)
+        idct_MCU(ctx, &row[j], MCU_i, j, Y_h, Y_v, chroma);
+}
 
-            int Y = ctx->MCUs[MCU_i][MCU_j].blocks[COLOR_ID_Y][block_i][block_j].idcted[idcted_i][idcted_j] % 256;
-            int Cb = (ctx->MCUs[MCU_i][MCU_j].blocks[COLOR_ID_Cb][block_i / 2][block_j / 2].idcted[idcted_i][idcted_j] + 128) % 256;
-            int Cr = (ctx->MCUs[MCU_i][MCU_j].blocks[COLOR_ID_Cr][block_i / 2][block_j / 2].idcted[idcted_i][idcted_j] + 128) % 256;
+#undef layout_horizontal_blocks
+#undef layout_vertical_blocks
 
-            int R = (65536 * Y + 91881 * (Cr - 128)) >> 16;
-            int G = (65536 * Y - 22554 * (Cb - 128) - 46802 * (Cr - 128)) >> 16;
-            int B = (65536 * Y + 116130 * (Cb - 128)) >> 16;
+// 先熵解码MCU中所有block，再逐个IDCT，两步分开后统计耗时时每个MCU只计时3次；不统计时走没有统计代码的熵解码
+static inline __attribute__((always_inline)) void read_MCU_layout(struct context *ctx, struct entropy_state *es, struct MCU *mcu, int MCU_i, int MCU_j,
+    int Y_h, int Y_v, int chroma)
+{
+    if (!stats_enabled(ctx))
+    {
+        read_MCU_blocks(ctx, es, mcu, NULL, Y_h, Y_v, chroma);
+        idct_MCU(ctx, mcu, MCU_i, MCU_j, Y_h, Y_v, chroma);
+        return;
+    }
+
+    uint64_t start = read_ticks();
+    int64_t position = bit_position(es);
+    read_MCU_blocks(ctx, es, mcu, es->counters, Y_h, Y_v, chroma);
+    uint64_t idct_start = read_ticks();
+    idct_MCU(ctx, mcu, MCU_i, MCU_j, Y_h, Y_v, chroma);
+
+    uint64_t end = read_ticks();
+    es->counters->MCU_ticks += end - start;
+    es->counters->idct_ticks += end - idct_start;
+    es->counters->bits += bit_position(es) - position;
+}
+
+// 两阶段解码只熵解码，IDCT的计时由重建阶段统计
+static inline __attribute__((always_inline)) void entropy_MCU_layout(struct context *ctx, struct entropy_state *es, struct MCU *mcu,
+    int Y_h, int Y_v, int chroma)
+{
+    if (!stats_enabled(ctx))
+    {
+        read_MCU_blocks(ctx, es, mcu, NULL, Y_h, Y_v, chroma);
+        return;
+    }
+
+    uint64_t start = read_ticks();
+    int64_t position = bit_position(es);
+    read_MCU_blocks(ctx, es, mcu, es->counters, Y_h, Y_v, chroma);
+    es->counters->MCU_ticks += read_ticks() - start;
+    es->counters->bits += bit_position(es) - position;
+}
+
+// 每种采样组合一组read_MCU_func等实现，块数在编译时确定，循环展开，不再逐个block查询采样率
+// entropy_MCU只熵解码，不用MCU位置，参数只为与read_MCU_func签名一致
+#define DEFINE_READ_MCU(_name, _Y_h, _Y_v, _chroma)                                                              \
+    void read_MCU_##_name(struct context *ctx, struct entropy_state *es, struct MCU *mcu, int MCU_i, int MCU_j)    \
+    {                                                                                                            \
+        read_MCU_layout(ctx, es, mcu, MCU_i, MCU_j, _Y_h, _Y_v, _chroma);                                         \
+    }                                                                                                            \
+    void entropy_MCU_##_name(struct context *ctx, struct entropy_state *es, struct MCU *mcu, int MCU_i, int MCU_j) \
+    {                                                                                                            \
+        (void)MCU_i;                                                                                             \
+        (void)MCU_j;                                                                                             \
+        entropy_MCU_layout(ctx, es, mcu, _Y_h, _Y_v, _chroma);                                                    \
+    }                                                                                                            \
+    void idct_MCU_row_##_name(struct context *ctx, int MCU_i)                                                    \
+    {                                                                                                            \
+        idct_MCU_row_layout(ctx, MCU_i, _Y_h, _Y_v, _chroma);                                                     \
+    }
+
+DEFINE_READ_MCU(generic, 0, 0, 0)
+DEFINE_READ_MCU(444, 1, 1, 1)
+DEFINE_READ_MCU(422, 2, 1, 1)
+DEFINE_READ_MCU(420, 2, 2, 1)
+DEFINE_READ_MCU(440, 1, 2, 1)
+DEFINE_READ_MCU(gray, 1, 1, 0)
+
+#undef DEFINE_READ_MCU
 
-            ctx->RGBs[ptr++] = (uint8_t)R;
-            ctx->RGBs[ptr++] = (uint8_t)G;
-            ctx->RGBs[ptr++] = (uint8_t)B;
+// 按各分量每个MCU中的block个数选定MCU解码实现
+void init_layout(struct context *ctx)
+{
+    static const read_MCU_func read_MCUs[] = {read_MCU_generic, read_MCU_444, read_MCU_422, read_MCU_420, read_MCU_440, read_MCU_gray};
+    static const read_MCU_func entropy_MCUs[] = {entropy_MCU_generic, entropy_MCU_444, entropy_MCU_422, entropy_MCU_420, entropy_MCU_440, entropy_MCU_gray};
+    static const idct_MCU_row_func idct_MCU_rows[] = {idct_MCU_row_generic, idct_MCU_row_444, idct_MCU_row_422, idct_MCU_row_420, idct_MCU_row_440, idct_MCU_row_gray};
+    int *h = ctx->MCU_horizontal_block_counts, *v = ctx->MCU_vertical_block_counts;
+
+    ctx->layout = LAYOUT_GENERIC;
+    if (h[COLOR_ID_Cb] == 0 && h[COLOR_ID_Cr] == 0 && h[COLOR_ID_Y] == 1 && v[COLOR_ID_Y] == 1)
+        ctx->layout = LAYOUT_GRAY;
+    else if (h[COLOR_ID_Cb] == 1 && v[COLOR_ID_Cb] == 1 && h[COLOR_ID_Cr] == 1 && v[COLOR_ID_Cr] == 1 && h[COLOR_ID_Y] <= 2 && v[COLOR_ID_Y] <= 2)
+    {
+        static const int layouts[2][2] = {{LAYOUT_444, LAYOUT_440}, {LAYOUT_422, LAYOUT_420}};
+        ctx->layout = layouts[h[COLOR_ID_Y] - 1][v[COLOR_ID_Y] - 1];
+    }
+    ctx->read_MCU = read_MCUs[ctx->layout];
+    ctx->entropy_MCU = entropy_MCUs[ctx->layout];
+    ctx->idct_MCU_row = idct_MCU_rows[ctx->layout];
+}
+
+// 内存留在MCU_arena中给下一次init_MCUs复用，destroy时才释放
+void free_MCUs(struct context *ctx)
+{
+    ctx->MCUs = NULL;
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        ctx->planes[color_id] = NULL;
+        ctx->upsampled[color_id] = NULL;
+    }
+    ctx->RGBs = NULL;
+    ctx->speculative_chunks = NULL;
+}
+
+// 缩小解码时Y的block输出8/scale_denom像素；色度在水平垂直方向都有2倍下采样时，改用更大的IDCT直接得到更高分辨率的色度，
+// 代替上采样，例如4:2:0缩小1/2时色度仍用8x8 IDCT，不再需要上采样，剩余的采样率差异仍由上采样补齐
+void init_block_sizes(struct context *ctx)
+{
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        int size = BLOCK_HORIZONTAL_PIXEL_COUNT / ctx->scale_denom;
+        if (ctx->MCU_horizontal_block_counts[color_id] != 0)
+        {
+            int horizontal_factor = ctx->MCU_horizontal_block_counts[COLOR_ID_Y] / ctx->MCU_horizontal_block_counts[color_id];
+            int vertical_factor = ctx->MCU_vertical_block_counts[COLOR_ID_Y] / ctx->MCU_vertical_block_counts[color_id];
+            for (int k = 2; size * 2 <= BLOCK_HORIZONTAL_PIXEL_COUNT && horizontal_factor % k == 0 && vertical_factor % k == 0; k *= 2)
+                size *= 2;
         }
+
+        ctx->block_sizes[color_id] = size;
+        ctx->idcts[color_id] = size == BLOCK_HORIZONTAL_PIXEL_COUNT ? ctx->idct : idct_get_scaled(size);
     }
 }
 
-void dump_txts(struct context *ctx)
+// 根据SOF0计算MCU布局，并分配MCU行环形缓冲以及一行MCU的RGB缓冲，内存只与图像宽度相关
+// 宽高不是MCU整数倍时，右侧和下侧不满的MCU同样完整解码，输出时再去掉
+// 所有缓冲的大小先算出来，从MCU_arena一次分配后切分，之前的图像用过更大的内存时不再分配，成功返回0
+int init_MCUs(struct context *ctx)
 {
-    FILE *fp_coefficient = fopen("debug_coefficients.txt", "w");
-    FILE *fp_dequantized = fopen("debug_dequantized.txt", "w");
-    FILE *fp_dezigzaged = fopen("debug_dezigzaged.txt", "w");
-    FILE *fp_idcted = fopen("debug_idcted.txt", "w");
+    int horizontal_block_counts[4] = {0}, vertical_block_counts[4] = {0};
+    for (int i = 0; i < ctx->SOF0.color_channel_count; ++i)
+    {
+        // 只有一个分量时扫描不交错，每个MCU就是一个block，与SOF0中的采样率无关
+        struct start_of_frame_0_channel_info *info = &ctx->SOF0.channel_info[i];
+        horizontal_block_counts[info->color_id] = ctx->SOF0.color_channel_count == 1 ? 1 : info->horizontal_sample_rate;
+        vertical_block_counts[info->color_id] = ctx->SOF0.color_channel_count == 1 ? 1 : info->vertical_sample_rate;
+    }
+    int MCU_width = horizontal_block_counts[COLOR_ID_Y] * BLOCK_HORIZONTAL_PIXEL_COUNT;
+    int MCU_height = vertical_block_counts[COLOR_ID_Y] * BLOCK_VERTICAL_PIXEL_COUNT;
+    int horizontal_MCU_count = (ctx->SOF0.width + MCU_width - 1) / MCU_width;
+    int vertical_MCU_count = (ctx->SOF0.height + MCU_height - 1) / MCU_height;
+
+    // 并行解码时，环形缓冲要容纳一批interval最多跨越的MCU行，再加上等待下一行才能转换的一行和三角滤波用到的前一行
+    int ring_size = MCU_ROW_RING_SIZE;
+    int MCU_count = horizontal_MCU_count * vertical_MCU_count;
+    int thread_count = thread_pool_size(ctx->pool);
+    ctx->window_interval_count = 0;
+    if (thread_count > 1 && ctx->restart_interval > 0 && ctx->restart_interval < MCU_count)
+    {
+        // 每批至少让每个线程分到INTERVALS_PER_THREAD个interval，interval很小时至少覆盖thread_count行MCU，减少同步次数
+        int count = max(thread_count * INTERVALS_PER_THREAD, (thread_count * horizontal_MCU_count + ctx->restart_interval - 1) / ctx->restart_interval);
+        int window_MCU_count = count * ctx->restart_interval;
+        int window_row_count = (window_MCU_count - 1 + horizontal_MCU_count - 1) / horizontal_MCU_count + 1;
+        ctx->window_interval_count = count;
+        ring_size = clip(MCU_ROW_RING_SIZE, max(vertical_MCU_count, MCU_ROW_RING_SIZE), window_row_count + 2);
+    }
+
+    // 没有可以并行的restart interval时两阶段解码，见reconstruct_MCU_rows；环形缓冲同时容纳正在熵解码、IDCT的两批行，
+    // 以及正在转换的一批行和它们上下相邻的行
+    ctx->reconstruct_row_count = 0;
+    if (thread_count > 1 && ctx->window_interval_count == 0 && vertical_MCU_count > 1)
+    {
+        ctx->reconstruct_row_count = max(thread_count, MIN_RECONSTRUCT_ROW_COUNT);
+        ring_size = clip(MCU_ROW_RING_SIZE, max(vertical_MCU_count, MCU_ROW_RING_SIZE), ctx->reconstruct_row_count * 3 + 2);
+    }
+    // 最后一批转换时可以多出等待下一行的一行
+    int slot_count = ctx->reconstruct_row_count > 0 ? ctx->reconstruct_row_count + 1 : 1;
+
+    // 推测解码时各段同时解码图像中任意位置的MCU，环形缓冲容纳整幅图像，内存与图像面积相关
+    int chunk_count = 0;
+    if (ctx->speculative && ctx->reconstruct_row_count > 0)
+    {
+        chunk_count = thread_count;
+        ring_size = max(vertical_MCU_count, MCU_ROW_RING_SIZE);
+    }
+
+    // 与上一张图像的MCU布局相同时，直接复用已分配的内存，只与高度相关的MCU行数需要更新
+    if (ctx->MCUs && horizontal_MCU_count == ctx->horizontal_MCU_count && ring_size == ctx->MCU_row_ring_size && slot_count == ctx->conversion_slot_count &&
+        chunk_count == ctx->speculative_chunk_count &&
+        memcmp(horizontal_block_counts, ctx->MCU_horizontal_block_counts, sizeof(horizontal_block_counts)) == 0 &&
+        memcmp(vertical_block_counts, ctx->MCU_vertical_block_counts, sizeof(vertical_block_counts)) == 0)
+    {
+        ctx->vertical_MCU_count = vertical_MCU_count;
+        return 0;
+    }
+
+    free_MCUs(ctx);
+    ctx->horizontal_MCU_count = horizontal_MCU_count;
+    ctx->vertical_MCU_count = vertical_MCU_count;
+    memcpy(ctx->MCU_horizontal_block_counts, horizontal_block_counts, sizeof(horizontal_block_counts));
+    memcpy(ctx->MCU_vertical_block_counts, vertical_block_counts, sizeof(vertical_block_counts));
+    ctx->MCU_row_ring_size = ring_size;
+    ctx->conversion_slot_count = slot_count;
+    ctx->speculative_chunk_count = chunk_count;
+    init_block_sizes(ctx);
+    init_layout(ctx);
+
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        ctx->plane_widths[color_id] = ctx->horizontal_MCU_count * ctx->MCU_horizontal_block_counts[color_id] * ctx->block_sizes[color_id];
+        ctx->plane_heights[color_id] = ctx->MCU_vertical_block_counts[color_id] * ctx->block_sizes[color_id];
+    }
+    ctx->data_length = ctx->plane_heights[COLOR_ID_Y] * ctx->plane_widths[COLOR_ID_Y] * 3;
+
+    size_t MCU_size = 0; // 一个MCU中各分量的block行指针和block
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        if (ctx->MCU_vertical_block_counts[color_id] == 0)
+            continue;
+        MCU_size += arena_size(ctx->MCU_vertical_block_counts[color_id] * sizeof(struct block *));
+        MCU_size += ctx->MCU_vertical_block_counts[color_id] * arena_size(ctx->MCU_horizontal_block_counts[color_id] * sizeof(struct block));
+    }
+    size_t size = arena_size(ctx->MCU_row_ring_size * sizeof(struct MCU *));
+    size += ctx->MCU_row_ring_size * (arena_size(ctx->horizontal_MCU_count * sizeof(struct MCU)) + ctx->horizontal_MCU_count * MCU_size);
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        size += arena_size((size_t)ctx->MCU_row_ring_size * ctx->plane_widths[color_id] * ctx->plane_heights[color_id]);
+        size += arena_size((size_t)slot_count * ctx->plane_widths[COLOR_ID_Y]);
+    }
+    size += arena_size((size_t)slot_count * ctx->data_length);
+    size += arena_size(chunk_count * sizeof(struct speculative_chunk));
+
+    struct arena *arena = &ctx->MCU_arena;
+    if (size > arena->capacity)
+    {
+        ++ctx->alloc_count;
+        ctx->alloc_bytes += size;
+    }
+    if (arena_reserve(arena, size) != 0)
+    {
+        ctx->horizontal_MCU_count = 0; // 下次不会误用布局相同的判断
+        return -1;
+    }
 
-    for (int MCU_i = 0; MCU_i < ctx->vertical_MCU_count; ++MCU_i)
+    ctx->MCUs = arena_alloc(arena, ctx->MCU_row_ring_size * sizeof(struct MCU *));
+    for (int i = 0; i < ctx->MCU_row_ring_size; ++i)
     {
-        for (int MCU_j = 0; MCU_j < ctx->horizontal_MCU_count; ++MCU_j)
+        ctx->MCUs[i] = arena_alloc(arena, ctx->horizontal_MCU_count * sizeof(struct MCU));
+        for (int j = 0; j < ctx->horizontal_MCU_count; ++j)
         {
-            struct MCU *mcu = &ctx->MCUs[MCU_i][MCU_j];
+            struct MCU *mcu = &ctx->MCUs[i][j];
             for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
             {
-                for (int block_i = 0; block_i < ctx->MCU_vertical_block_counts[color_id]; ++block_i)
+                if (ctx->MCU_vertical_block_counts[color_id] == 0)
+                    continue;
+                mcu->blocks[color_id] = arena_alloc(arena, ctx->MCU_vertical_block_counts[color_id] * sizeof(struct block *));
+                for (int k = 0; k < ctx->MCU_vertical_block_counts[color_id]; ++k)
                 {
-                    for (int block_j = 0; block_j < ctx->MCU_horizontal_block_counts[color_id]; ++block_j)
-                    {
-                        struct block *blk = &mcu->blocks[color_id][block_i][block_j];
-
-                        fprintf(fp_coefficient, "mcu: (%d, %d), color_id: %d, block: (%d, %d)\n", MCU_i, MCU_j, color_id, block_i, block_j);
-                        fprintf(fp_dequantized, "mcu: (%d, %d), color_id: %d, block: (%d, %d)\n", MCU_i, MCU_j, color_id, block_i, block_j);
-                        fprintf(fp_dezigzaged, "mcu: (%d, %d), color_id: %d, block: (%d, %d)\n", MCU_i, MCU_j, color_id, block_i, block_j);
-                        fprintf(fp_idcted, "mcu: (%d, %d), color_id: %d, block: (%d, %d)\n", MCU_i, MCU_j, color_id, block_i, block_j);
-                        for (int i = 0; i < 8; ++i)
-                        {
-                            for (int j = 0; j < 8; ++j)
-                            {
-                                fprintf(fp_coefficient, "%8d\t", blk->coefficient[i][j]);
-                                fprintf(fp_dequantized, "%8d\t", blk->dequantized[i][j]);
-                                fprintf(fp_dezigzaged, "%8d\t", blk->dezigzaged[i][j]);
-                                fprintf(fp_idcted, "%8d\t", blk->idcted[i][j]);
-                            }
-                            fprintf(fp_coefficient, "\n");
-                            fprintf(fp_dequantized, "\n");
-                            fprintf(fp_dezigzaged, "\n");
-                            fprintf(fp_idcted, "\n");
-                        }
-                        fprintf(fp_coefficient, "\n");
-                        fprintf(fp_dequantized, "\n");
-                        fprintf(fp_dezigzaged, "\n");
-                        fprintf(fp_idcted, "\n");
-                    }
+                    mcu->blocks[color_id][k] = arena_alloc(arena, ctx->MCU_horizontal_block_counts[color_id] * sizeof(struct block));
                 }
             }
         }
     }
 
-    fclose(fp_coefficient);
-    fclose(fp_dequantized);
-    fclose(fp_dezigzaged);
-    fclose(fp_idcted);
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        ctx->planes[color_id] = arena_alloc(arena, (size_t)ctx->MCU_row_ring_size * ctx->plane_widths[color_id] * ctx->plane_heights[color_id]);
+        ctx->upsampled[color_id] = arena_alloc(arena, (size_t)slot_count * ctx->plane_widths[COLOR_ID_Y]);
+    }
+    ctx->RGBs = arena_alloc(arena, (size_t)slot_count * ctx->data_length);
+    if (chunk_count > 0)
+        ctx->speculative_chunks = arena_alloc(arena, chunk_count * sizeof(struct speculative_chunk));
+    return 0;
 }
 
-void write_data(struct context *ctx)
+// 输出图像和各分量的有效尺寸，缩小解码时按缩小后的尺寸向上取整；以及各色度分量的上采样方式，每张图像选一次
+void init_conversion(struct context *ctx)
 {
-    int width = ctx->horizontal_MCU_count * ctx->MCU_horizontal_block_counts[COLOR_ID_Y] * 8;
-    int height = ctx->vertical_MCU_count * ctx->MCU_vertical_block_counts[COLOR_ID_Y] * 8;
-
-    char YCbCr_filename[128] = {0}, RGB24_filename[128] = {0};
-    snprintf(YCbCr_filename, 128, "decoded_%dx%d_I420.yuv", width, height);
-    snprintf(RGB24_filename, 128, "decoded_%dx%d_RGB24.yuv", width, height);
+    int max_width = ctx->MCU_horizontal_block_counts[COLOR_ID_Y] * BLOCK_HORIZONTAL_PIXEL_COUNT;
+    int max_height = ctx->MCU_vertical_block_counts[COLOR_ID_Y] * BLOCK_VERTICAL_PIXEL_COUNT;
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        long width = (long)ctx->SOF0.width * ctx->MCU_horizontal_block_counts[color_id] * ctx->block_sizes[color_id];
+        long height = (long)ctx->SOF0.height * ctx->MCU_vertical_block_counts[color_id] * ctx->block_sizes[color_id];
+        ctx->component_widths[color_id] = (width + max_width - 1) / max_width;
+        ctx->component_heights[color_id] = (height + max_height - 1) / max_height;
+    }
+    ctx->image_width = ctx->component_widths[COLOR_ID_Y];
+    ctx->image_height = ctx->component_heights[COLOR_ID_Y];
 
-    // [TODO] 暂时不考虑边缘部分
-    FILE *fp = fopen(YCbCr_filename, "wb");
-    FILE *fp2 = fopen("debug_pixels.txt", "w");
-    FILE *fp3 = fopen(RGB24_filename, "wb");
+    for (int color_id = COLOR_ID_Cb; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        int horizontal_factor = ctx->plane_widths[color_id] ? ctx->plane_widths[COLOR_ID_Y] / ctx->plane_widths[color_id] : 0;
+        int vertical_factor = ctx->plane_heights[color_id] ? ctx->plane_heights[COLOR_ID_Y] / ctx->plane_heights[color_id] : 0;
+        ctx->vertical_factors[color_id] = vertical_factor;
+        if (ctx->upsample_method == UPSAMPLE_FANCY && vertical_factor == 2 && horizontal_factor == 2)
+            ctx->chroma_upsamplers[color_id] = CHROMA_H2V2_FANCY;
+        else if (ctx->upsample_method == UPSAMPLE_FANCY && vertical_factor == 2 && horizontal_factor == 1)
+            ctx->chroma_upsamplers[color_id] = CHROMA_H1V2_FANCY;
+        else if (ctx->upsample_method == UPSAMPLE_FANCY && vertical_factor == 1 && horizontal_factor == 2)
+            ctx->chroma_upsamplers[color_id] = CHROMA_H2V1_FANCY;
+        else
+            ctx->chroma_upsamplers[color_id] = horizontal_factor > 1 ? CHROMA_NEAREST : CHROMA_FULL;
+        ctx->horizontal_factors[color_id] = horizontal_factor;
+    }
+}
 
-    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+// 转换第y行(全分辨率行号)时，该行色度分量上采样后的结果，写到第slot份upsampled
+// 只上采样解码了的MCU列，结果在upsampled中的位置与条带中全分辨率的位置相同；三角滤波在分量的有效尺寸处取边缘，不用补齐MCU的数据
+uint8_t *upsample_line(struct context *ctx, int color_id, int y, int slot)
+{
+    int MCU_width = ctx->plane_widths[color_id] / ctx->horizontal_MCU_count;
+    int begin = ctx->MCU_col_begin * MCU_width;
+    int width = min(ctx->MCU_col_end * MCU_width, ctx->component_widths[color_id]) - begin;
+    int row = y / ctx->vertical_factors[color_id];
+    uint8_t *near = get_plane_line(ctx, color_id, row) + begin;
+    uint8_t *upsampled = ctx->upsampled[color_id] + (long)slot * ctx->plane_widths[COLOR_ID_Y];
+    uint8_t *out = upsampled + begin * ctx->horizontal_factors[color_id];
+
+    // 三角滤波的垂直方向：输出行在该色度行的上半部分时与上一行加权，下半部分时与下一行加权，图像边缘处取自身
+    int far_row = y % 2 == 0 ? max(row - 1, 0) : min(row + 1, ctx->component_heights[color_id] - 1);
+    switch (ctx->chroma_upsamplers[color_id])
     {
-        int horizontal_MCU_pixel_count = ctx->MCU_horizontal_block_counts[color_id] * 8;
-        int vertical_MCU_pixel_count = ctx->MCU_vertical_block_counts[color_id] * 8;
-        int horizontal_pixel_count = ctx->horizontal_MCU_count * horizontal_MCU_pixel_count;
-        int vertical_pixel_count = ctx->vertical_MCU_count * vertical_MCU_pixel_count;
+    case CHROMA_H2V2_FANCY:
+        upsample_h2v2_fancy(near, get_plane_line(ctx, color_id, far_row) + begin, out, width);
+        break;
+    case CHROMA_H1V2_FANCY:
+        upsample_h1v2_fancy(near, get_plane_line(ctx, color_id, far_row) + begin, out, width, y % 2 == 0 ? 1 : 2);
+        break;
+    case CHROMA_H2V1_FANCY:
+        upsample_h2v1_fancy(near, out, width);
+        break;
+    case CHROMA_NEAREST:
+        upsample_nearest(near, out, width, ctx->horizontal_factors[color_id]);
+        break;
+    default:
+        return get_plane_line(ctx, color_id, row); // 水平方向不需要上采样，直接使用条带中的行
+    }
 
-        log_("color_id: %d, mcu: %dx%d, pixel: %dx%d\n", color_id,
-            horizontal_MCU_pixel_count, vertical_MCU_pixel_count,
-            horizontal_pixel_count, vertical_pixel_count);
+    return upsampled;
+}
+
+// 将一行MCU中位于输出区域内的第first_y到last_y-1行(图像中的行号)转为RGB，写入RGB_output或第slot份ctx->RGBs
+void convert_MCU_row(struct context *ctx, int first_y, int last_y, int slot)
+{
+    int x = ctx->crop_x;
+    int width = ctx->crop_width;
 
-        for (int i = 0; i < vertical_pixel_count; ++i)
+    for (int y = first_y; y < last_y; ++y)
+    {
+        uint8_t *RGB = ctx->RGB_output ? ctx->RGB_output + (long)(y - ctx->crop_y) * ctx->RGB_stride : ctx->RGBs + (long)slot * ctx->data_length + (long)(y - first_y) * width * 3;
+        uint8_t *Y = get_plane_line(ctx, COLOR_ID_Y, y);
+        if (ctx->layout == LAYOUT_GRAY)
         {
-            int MCU_i = i / vertical_MCU_pixel_count;
-            int block_i = i % vertical_MCU_pixel_count / BLOCK_VERTICAL_PIXEL_COUNT;
-            int idcted_i = i % vertical_MCU_pixel_count % BLOCK_VERTICAL_PIXEL_COUNT;
-            for (int j = 0; j < horizontal_pixel_count; ++j)
-            {
-                int MCU_j = j / horizontal_MCU_pixel_count;
-                int block_j = j % horizontal_MCU_pixel_count / BLOCK_HORIZONTAL_PIXEL_COUNT;
-                int idcted_j = j % horizontal_MCU_pixel_count % BLOCK_HORIZONTAL_PIXEL_COUNT;
-
-                int YCbCr_idcted = ctx->MCUs[MCU_i][MCU_j].blocks[color_id][block_i][block_j].idcted[idcted_i][idcted_j];
-                uint8_t YCbCr_pixel = (YCbCr_idcted + 128) % 256;
-                fwrite(&YCbCr_pixel, 1, 1, fp);
-                fprintf(fp2, "%d ", YCbCr_pixel);
-            }
+            gray_convert(Y + x, RGB, width);
+            continue;
         }
+
+        uint8_t *Cb = upsample_line(ctx, COLOR_ID_Cb, y, slot);
+        uint8_t *Cr = upsample_line(ctx, COLOR_ID_Cr, y, slot);
+        ctx->color_convert(Y + x, Cb + x, Cr + x, RGB, width);
+    }
+}
+
+// 三角滤波的垂直上采样需要下一行MCU的第一行色度，此时第i行MCU要等第i+1行解码后再转换
+int conversion_delay(struct context *ctx)
+{
+    if (ctx->upsample_method != UPSAMPLE_FANCY)
+        return 0;
+
+    for (int color_id = COLOR_ID_Cb; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        if (ctx->plane_heights[color_id] != 0 && ctx->plane_heights[COLOR_ID_Y] / ctx->plane_heights[color_id] == 2)
+            return 1;
     }
 
-    fwrite(ctx->RGBs, 1, ctx->data_length, fp3);
+    return 0;
 }
 
-int main(int argc, char *argv[])
+// 在压缩数据中查找p之后的第一个marker，跳过0xFF 0x00和填充的0xFF，返回0xFF所在位置，数据结束时返回NULL
+const uint8_t *find_scan_marker(const uint8_t *p, const uint8_t *end)
 {
-    struct context *ctx = calloc(1, sizeof(struct context));
-    if (!ctx)
+    while (p < end - 1 && (p = memchr(p, 0xFF, end - 1 - p)))
     {
-        log_("calloc failed: %s\n", strerror(errno));
-        goto error;
+        if (p[1] == 0xFF) // 0xFF可以重复作为填充
+            p += 1;
+        else if (p[1] == 0x00) // 0xFF 0x00为数据
+            p += 2;
+        else
+            return p;
     }
 
-    if (argc < 2)
+    return NULL;
+}
+
+// 预扫描压缩数据，记录每个restart interval的起始位置(RSTn之后)，第0个为SOS之后的数据起点
+void scan_restart_intervals(struct context *ctx)
+{
+    int MCU_count = ctx->horizontal_MCU_count * ctx->vertical_MCU_count;
+    ctx->interval_count = ctx->restart_interval > 0 ? (MCU_count + ctx->restart_interval - 1) / ctx->restart_interval : 1;
+    if (ctx->interval_count > ctx->interval_capacity)
     {
-        usage(argv[0]);
-        goto error;
+        ctx->interval_capacity = ctx->interval_count;
+        ctx->interval_ptrs = counted_realloc(ctx, ctx->interval_ptrs, ctx->interval_capacity * sizeof(uint8_t *));
     }
+    ctx->interval_ptrs[0] = ctx->compress_data;
 
-    ctx->fp = fopen(argv[1], "rb");
-    if (!ctx->fp)
+    int count = 1;
+    const uint8_t *p = ctx->compress_data;
+    const uint8_t *end = ctx->buffer + ctx->length;
+    while (count < ctx->interval_count && (p = find_scan_marker(p, end)))
     {
-        log_("fopen `%s` failed: %s\n", argv[1], strerror(errno));
-        goto error;
+        uint8_t marker = p[1];
+        if (marker < SEG_RST0 || marker > SEG_RST7) // 其它marker，扫描数据结束
+            break;
+
+        if (marker != SEG_RST0 + (count - 1) % 8)
+            log_("restart marker out of order, expect RST%d, got RST%d, offset: %ld\n", (count - 1) % 8, marker - SEG_RST0, p - ctx->buffer);
+        p += 2;
+        ctx->interval_ptrs[count++] = p;
     }
 
-    fseek(ctx->fp, 0, SEEK_END);
-    ctx->length = ftell(ctx->fp);
-    rewind(ctx->fp);
+    // 缺失的interval从数据末尾开始解码，得到的系数全0
+    if (count < ctx->interval_count)
+        log_("restart intervals: found %d, expect %d\n", count, ctx->interval_count);
+    for (int i = count; i < ctx->interval_count; ++i)
+        ctx->interval_ptrs[i] = end;
+}
+
+// 从第interval_index个restart interval的起始位置开始解码，dc差分清0
+void start_interval(struct context *ctx, struct entropy_state *es, int interval_index)
+{
+    init_bits(es, ctx->interval_ptrs[interval_index], ctx->buffer + ctx->length);
+    memset(es->dc_global_coefficient, 0, sizeof(es->dc_global_coefficient));
+}
 
-    ctx->buffer = calloc(ctx->length, sizeof(uint8_t));
-    if (!ctx->buffer)
+// 第interval_index个restart interval中是否有需要IDCT的MCU，没有时整个interval都不用熵解码
+int interval_in_crop(struct context *ctx, int interval_index)
+{
+    int count = ctx->horizontal_MCU_count;
+    int first = interval_index * ctx->restart_interval;
+    int last = min(first + ctx->restart_interval, count * ctx->vertical_MCU_count) - 1;
+    for (int row = max(first / count, ctx->MCU_row_begin); row <= min(last / count, ctx->MCU_row_end - 1); ++row)
     {
-        log_("calloc failed: %s\n", strerror(errno));
-        goto error;
+        int first_col = row == first / count ? first % count : 0;
+        int last_col = row == last / count ? last % count : count - 1;
+        if (first_col < ctx->MCU_col_end && last_col >= ctx->MCU_col_begin)
+            return 1;
     }
-    ctx->ptr = ctx->buffer;
-    fread(ctx->buffer, 1, ctx->length, ctx->fp);
 
-#define add_seg(type)                                                                                   \
-    do                                                                                                  \
-    {                                                                                                   \
-        ctx->ptr_##type##s = realloc(ctx->ptr_##type##s, (++ctx->count_##type##s) * sizeof(uint8_t *)); \
-        ctx->ptr_##type##s[ctx->count_##type##s - 1] = ctx->ptr - 2;                                    \
-    }                                                                                                   \
-    while (0)
+    return 0;
+}
 
-    while (ctx->ptr - ctx->buffer < ctx->length)
+// 用read_MCU解码第first到last-1个MCU(按光栅顺序编号)，裁剪区域以外的MCU只熵解码，不需要的restart interval直接跳过
+void read_MCUs(struct context *ctx, struct entropy_state *es, int first, int last, read_MCU_func read_MCU)
+{
+    int skip_interval = ctx->restart_interval > 0 && !interval_in_crop(ctx, first / ctx->restart_interval);
+    for (int k = first; k < last; ++k)
     {
-        // 各段均以0xFF起始
-        if (get_byte(ctx) != 0xFF)
+        if (ctx->restart_interval > 0 && k % ctx->restart_interval == 0)
+        {
+            skip_interval = !interval_in_crop(ctx, k / ctx->restart_interval);
+            if (!skip_interval)
+                start_interval(ctx, es, k / ctx->restart_interval);
+        }
+        if (skip_interval)
+        {
+            k = min((k / ctx->restart_interval + 1) * ctx->restart_interval, last) - 1;
             continue;
+        }
 
-        // 下一个字节为区段marker
-        uint8_t byte = get_byte(ctx);
+        int i = k / ctx->horizontal_MCU_count;
+        int j = k % ctx->horizontal_MCU_count;
+        if (i >= ctx->MCU_row_begin && i < ctx->MCU_row_end && j >= ctx->MCU_col_begin && j < ctx->MCU_col_end)
+            read_MCU(ctx, es, &ctx->MCUs[i % ctx->MCU_row_ring_size][j], i, j);
+        else
+            skip_MCU(ctx, es);
+    }
+}
+
+// 把一个restart interval的计数加到总计数，并行解码时各线程同时调用
+void add_counters(struct context *ctx, const struct decode_counters *counters)
+{
+    uint64_t *total = (uint64_t *)&ctx->counters;
+    const uint64_t *values = (const uint64_t *)counters;
+    for (int i = 0; i < (int)(sizeof(struct decode_counters) / sizeof(uint64_t)); ++i)
+    {
+        if (values[i])
+            __atomic_fetch_add(&total[i], values[i], __ATOMIC_RELAXED);
+    }
+}
+
+struct interval_window
+{
+    struct context *ctx;
+    int first_interval; // 本批第一个restart interval的序号
+};
+
+// 线程池任务，解码本批中的第task_index个restart interval
+void read_interval(void *opaque, int task_index)
+{
+    struct interval_window *window = opaque;
+    struct context *ctx = window->ctx;
+    int interval_index = window->first_interval + task_index;
+    int MCU_count = ctx->horizontal_MCU_count * ctx->vertical_MCU_count;
+
+    struct decode_counters counters = {0};
+    struct entropy_state es = {0};
+    es.counters = &counters;
+    int first = interval_index * ctx->restart_interval;
+    read_MCUs(ctx, &es, first, min(first + ctx->restart_interval, MCU_count), ctx->read_MCU);
+    if (stats_enabled(ctx))
+        add_counters(ctx, &counters);
+
+    if (interval_index == ctx->interval_count - 1) // 保留最后的状态，用于统计读取长度
+    {
+        ctx->entropy = es;
+        ctx->entropy.counters = &ctx->counters;
+    }
+}
+
+// 前decoded_row_count行MCU已解码完成时，可以转换的MCU行数，不超过区域最后一行所在的MCU行
+int ready_row_count(struct context *ctx, int decoded_row_count)
+{
+    int ready_row_count = decoded_row_count;
+    if (decoded_row_count < ctx->vertical_MCU_count) // 最后一行之前，需要等下一行解码后才能转换
+        ready_row_count -= conversion_delay(ctx);
+
+    // 只输出与区域相交的行，区域最后一行之后的MCU行不再转换
+    int height = ctx->plane_heights[COLOR_ID_Y];
+    int crop_row_end = (ctx->crop_y + ctx->crop_height + height - 1) / height;
+    return min(ready_row_count, crop_row_end);
+}
+
+// 第row行MCU中位于输出区域内的图像行[first_y, last_y)
+void MCU_row_lines(struct context *ctx, int row, int *first_y, int *last_y)
+{
+    int height = ctx->plane_heights[COLOR_ID_Y];
+    *first_y = max(row * height, ctx->crop_y);
+    *last_y = min((row + 1) * height, ctx->crop_y + ctx->crop_height);
+}
+
+// 把已转换到RGB_output或第slot份RGBs的第row行MCU交给输出回调
+void emit_MCU_row(struct context *ctx, int row, int slot)
+{
+    if (!ctx->output)
+        return;
+
+    int first_y, last_y;
+    MCU_row_lines(ctx, row, &first_y, &last_y);
+    struct jpeg_rows rows = {0};
+    rows.MCU_row = row;
+    rows.row_count = last_y - first_y;
+    rows.y = first_y - ctx->crop_y;
+    rows.RGB = ctx->RGB_output ? ctx->RGB_output + (long)rows.y * ctx->RGB_stride : ctx->RGBs + (long)slot * ctx->data_length;
+    rows.RGB_stride = ctx->RGB_output ? ctx->RGB_stride : ctx->crop_width * 3;
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        if (ctx->plane_heights[color_id] == 0)
+            continue;
+        rows.planes[color_id - 1] = get_plane_line(ctx, color_id, row * ctx->plane_heights[color_id]);
+        rows.plane_strides[color_id - 1] = ctx->plane_widths[color_id];
+        rows.plane_row_counts[color_id - 1] = ctx->plane_heights[color_id];
+    }
+    ctx->output_MCU_row = row;
+    ctx->output(ctx->output_opaque, &rows);
+    ctx->output_MCU_row = -1;
+}
+
+// 前decoded_row_count行MCU已解码完成，转换并输出其中所有可以输出的行
+void output_MCU_rows(struct context *ctx, int decoded_row_count)
+{
+    for (int end = ready_row_count(ctx, decoded_row_count); ctx->output_row_count < end; ++ctx->output_row_count)
+    {
+        int first_y, last_y;
+        MCU_row_lines(ctx, ctx->output_row_count, &first_y, &last_y);
+        uint64_t start = stats_enabled(ctx) ? read_ticks() : 0;
+        convert_MCU_row(ctx, first_y, last_y, 0);
+        if (stats_enabled(ctx))
+            ctx->color_ticks += read_ticks() - start;
+
+        emit_MCU_row(ctx, ctx->output_row_count, 0);
+    }
+}
+
+// 两阶段解码的一步，三个阶段依次相差一步，在线程池中同时执行：
+// 第0个任务熵解码下一批MCU行，之后每行一个任务，IDCT上一步熵解码的行，以及转换上一步之前已IDCT、可以转换的行
+struct reconstruct_step
+{
+    struct context *ctx;
+    int first_MCU; // 熵解码的MCU范围[first_MCU, last_MCU)，为空时没有熵解码任务
+    int last_MCU;
+    int idct_row; // IDCT的MCU行范围[idct_row, idct_row_end)
+    int idct_row_end;
+    int convert_row; // 转换的MCU行范围[convert_row, convert_row_end)
+    int convert_row_end;
+};
+
+void reconstruct_task(void *opaque, int task_index)
+{
+    struct reconstruct_step *step = opaque;
+    struct context *ctx = step->ctx;
+    uint64_t start = stats_enabled(ctx) ? read_ticks() : 0;
+    struct decode_counters counters = {0};
 
-        switch (byte)
+    // 熵解码任务同一时间只有一个，直接使用ctx->entropy，计数先记到局部，与IDCT任务的计数一起原子地加到总计数
+    if (step->first_MCU < step->last_MCU && task_index-- == 0)
+    {
+        ctx->entropy.counters = &counters;
+        read_MCUs(ctx, &ctx->entropy, step->first_MCU, step->last_MCU, ctx->entropy_MCU);
+        ctx->entropy.counters = &ctx->counters;
+    }
+    else if (task_index < step->idct_row_end - step->idct_row)
+    {
+        int row = step->idct_row + task_index;
+        if (row >= ctx->MCU_row_begin && row < ctx->MCU_row_end)
+            ctx->idct_MCU_row(ctx, row);
+        if (stats_enabled(ctx))
         {
-        // 若为0x00则是普通数据，要求图像数据中所有0xFF都要接一个0x00
-        case 0x00: break;
-        case SEG_SOI: ctx->ptr_SOI = ctx->ptr - 2; break;
-        case SEG_APP0: add_seg(APP0); break;
-        case SEG_SOF0: read_SOF0(ctx); break;
-        case SEG_DQT: read_DQT(ctx); break;
-        case SEG_DHT: read_DHT(ctx); break;
-        case SEG_SOS: read_SOS(ctx); break;
-        case SEG_EOI: ctx->ptr_EOI = ctx->ptr - 2; break;
+            counters.idct_ticks = read_ticks() - start;
+            counters.MCU_ticks = counters.idct_ticks;
         }
     }
+    else
+    {
+        int row = step->convert_row + task_index - (step->idct_row_end - step->idct_row);
+        int first_y, last_y;
+        MCU_row_lines(ctx, row, &first_y, &last_y);
+        convert_MCU_row(ctx, first_y, last_y, row % ctx->conversion_slot_count);
+        if (stats_enabled(ctx))
+            __atomic_fetch_add(&ctx->color_ticks, read_ticks() - start, __ATOMIC_RELAXED);
+    }
 
-    // dump_DQTs(ctx);
-    // dump_DHTs(ctx);
-    // dump_SOF0(ctx);
-    // dump_SOS(ctx);
+    if (stats_enabled(ctx))
+        add_counters(ctx, &counters);
+}
 
-    read_compressed_data(ctx);
+// 没有可以并行的restart interval时，熵解码只能串行，把IDCT、上采样和颜色转换分出来按MCU行并行，与熵解码流水进行
+// 每一步熵解码reconstruct_row_count行，同时IDCT上一步熵解码的行、转换再之前IDCT完成的行，转换的行在一步结束后按顺序输出
+void reconstruct_MCU_rows(struct context *ctx, int start_MCU, int last_MCU)
+{
+    int count = ctx->horizontal_MCU_count;
+    int entropy_row = start_MCU / count; // 之前的行已熵解码
+    int idct_row = entropy_row;          // 之前的行已IDCT
+    struct reconstruct_step step = {ctx};
+    while (1)
+    {
+        int entropy_row_end = min(entropy_row + ctx->reconstruct_row_count, ctx->MCU_row_end);
+        step.first_MCU = max(entropy_row * count, start_MCU);
+        step.last_MCU = min(entropy_row_end * count, last_MCU);
+        step.idct_row = idct_row;
+        step.idct_row_end = entropy_row;
+        step.convert_row = ctx->output_row_count;
+        step.convert_row_end = max(ready_row_count(ctx, idct_row), ctx->output_row_count);
+
+        int task_count = (step.first_MCU < step.last_MCU) + (step.idct_row_end - step.idct_row) + (step.convert_row_end - step.convert_row);
+        if (task_count == 0)
+            break;
+        thread_pool_run(ctx->pool, reconstruct_task, &step, task_count);
+
+        for (; ctx->output_row_count < step.convert_row_end; ++ctx->output_row_count)
+            emit_MCU_row(ctx, ctx->output_row_count, ctx->output_row_count % ctx->conversion_slot_count);
+        idct_row = entropy_row;
+        entropy_row = entropy_row_end;
+    }
+}
 
-    dump_txts(ctx);
+// 按MCU顺序可以转换的行全部解码完成后，每次并行转换conversion_slot_count行，再按顺序输出
+void convert_MCU_rows(struct context *ctx, int decoded_row_count)
+{
+    struct reconstruct_step step = {ctx};
+    int end = ready_row_count(ctx, decoded_row_count);
+    while (ctx->output_row_count < end)
+    {
+        step.convert_row = ctx->output_row_count;
+        step.convert_row_end = min(step.convert_row + ctx->conversion_slot_count, end);
+        thread_pool_run(ctx->pool, reconstruct_task, &step, step.convert_row_end - step.convert_row);
 
-    write_data(ctx);
+        for (; ctx->output_row_count < step.convert_row_end; ++ctx->output_row_count)
+            emit_MCU_row(ctx, ctx->output_row_count, ctx->output_row_count % ctx->conversion_slot_count);
+    }
+}
 
-error:
-#define free_seg(type)                \
-    do                                \
-    {                                 \
-        if (ctx->ptr_##type##s)       \
-            free(ctx->ptr_##type##s); \
-        ctx->count_##type##s = 0;     \
-    }                                 \
-    while (0)
+struct speculation
+{
+    struct context *ctx;
+    struct speculative_chunk *chunks;
+    int chunk_count;
+    int last_MCU; // 最后一个需要的MCU之后
+};
 
-    if (!ctx)
-        exit(0);
-
-    free_seg(APP0);
-    // free_seg(SOF0);
-    if (ctx->DQTs)
-        free(ctx->DQTs);
-    if (ctx->DHTs)
-        free(ctx->DHTs);
-    // free_seg(SOS);
-    if (ctx->buffer)
-        free(ctx->buffer);
-    if (ctx->fp)
-        fclose(ctx->fp);
-}
\ No newline at end of file
+// 线程池任务，推测解码第task_index段，第0段从扫描开头以真实状态开始，不记录
+void speculate_chunk(void *opaque, int task_index)
+{
+    struct speculation *spec = opaque;
+    struct context *ctx = spec->ctx;
+    struct speculative_chunk *chunk = &spec->chunks[task_index];
+    int MCU_count = ctx->horizontal_MCU_count * ctx->vertical_MCU_count;
+    uint64_t start = stats_enabled(ctx) ? read_ticks() : 0;
+
+    struct entropy_state es = {0};
+    init_bits(&es, chunk->begin, ctx->buffer + ctx->length);
+    chunk->record_count = 0;
+    chunk->failed = 0;
+    int MCU = 0;
+    for (int64_t position = exact_bit_position(&es); position < chunk->end_position && MCU < MCU_count; position = exact_bit_position(&es))
+    {
+        if (task_index > 0 && chunk->record_count < SPECULATIVE_RECORD_COUNT)
+        {
+            struct speculative_record *record = &chunk->records[chunk->record_count++];
+            record->position = position;
+            record->MCU = MCU;
+            memcpy(record->dc, es.dc_global_coefficient, sizeof(record->dc));
+        }
+
+        if (speculate_MCU(ctx, &es) == 0)
+        {
+            ++MCU;
+            continue;
+        }
+
+        // 起点没有对齐到码字，跳过1 bit重新开始，之前记录的起点不可能是真实的MCU起点
+        if (task_index == 0)
+        {
+            chunk->failed = 1;
+            break;
+        }
+        chunk->record_count = 0;
+        consume_bits(&es, 1);
+    }
+    chunk->end_state = es;
+    chunk->end_MCU = MCU;
+
+    if (stats_enabled(ctx))
+        __atomic_fetch_add(&ctx->counters.MCU_ticks, read_ticks() - start, __ATOMIC_RELAXED);
+}
+
+// 线程池任务，第task_index段同步了时，从它的真实起点解码到下一个同步了的段开始
+void decode_segment(void *opaque, int task_index)
+{
+    struct speculation *spec = opaque;
+    struct context *ctx = spec->ctx;
+    struct speculative_chunk *chunk = &spec->chunks[task_index];
+    if (chunk->first_MCU < 0)
+        return;
+
+    int next = task_index + 1;
+    while (next < spec->chunk_count && spec->chunks[next].first_MCU < 0)
+        ++next;
+    int last = next < spec->chunk_count ? spec->chunks[next].first_MCU : spec->last_MCU;
+
+    struct decode_counters counters = {0};
+    struct entropy_state es = chunk->state;
+    es.counters = &counters;
+    read_MCUs(ctx, &es, chunk->first_MCU, last, ctx->read_MCU);
+    if (stats_enabled(ctx))
+        add_counters(ctx, &counters);
+
+    if (next == spec->chunk_count) // 保留最后的状态，用于检查压缩数据是否提前结束
+    {
+        ctx->entropy = es;
+        ctx->entropy.counters = &ctx->counters;
+    }
+}
+
+// 从真实状态cur(第*cur_MCU个MCU开始处)继续解码，直到与chunk记录的某个MCU起点位置相同，此后chunk的推测解码就是真实的解码，
+// 直流差分和MCU序号加上同步处的差值即得到chunk结束时的真实状态；到chunk结束仍没有同步时cur停在chunk结束处，
+// 遇到非法码字返回-1
+int chain_chunk(struct context *ctx, struct speculative_chunk *chunk, struct entropy_state *cur, int *cur_MCU)
+{
+    int MCU_count = ctx->horizontal_MCU_count * ctx->vertical_MCU_count;
+    int r = 0;
+    chunk->first_MCU = -1;
+    for (int64_t position = exact_bit_position(cur); *cur_MCU < MCU_count && position < chunk->end_position; position = exact_bit_position(cur))
+    {
+        while (r < chunk->record_count && chunk->records[r].position < position)
+            ++r;
+
+        if (r < chunk->record_count && chunk->records[r].position == position)
+        {
+            struct speculative_record *record = &chunk->records[r];
+            chunk->first_MCU = *cur_MCU;
+            chunk->state = *cur;
+
+            *cur_MCU = chunk->end_MCU + *cur_MCU - record->MCU;
+            int dc[4];
+            memcpy(dc, cur->dc_global_coefficient, sizeof(dc));
+            *cur = chunk->end_state;
+            for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+                cur->dc_global_coefficient[color_id] += dc[color_id] - record->dc[color_id];
+            return 0;
+        }
+
+        if (speculate_MCU(ctx, cur) != 0)
+            return -1;
+        ++*cur_MCU;
+    }
+
+    return 0;
+}
+
+// 没有restart marker时并行熵解码的推测方式：
+// 1. 按字节把扫描数据平均分段，每段从字节边界开始推测解码，只解析码字和直流差分，霍夫曼码在几个码字内通常会与真实的码字边界重合，
+//    同时MCU内的block也要对齐，之后的解码与真实的解码完全相同，因此记录每段开头各MCU的起点位置
+// 2. 从第0段的结束处串行地向后解码，直到与下一段某个记录的MCU起点位置相同，得到该段的真实起点，再跳到该段结束处，依次串联各段
+// 3. 从各段的真实起点并行地完整解码和IDCT，最后并行转换
+// 熵解码要多解析一遍，线程数不少于3时才有收益；某段开头没有同步时并入前一段解码；第0段或串联时遇到非法码字返回-1，由调用者串行解码
+int speculative_decode(struct context *ctx, int last_MCU)
+{
+    const uint8_t *end = ctx->buffer + ctx->length;
+    const uint8_t *scan_end = find_scan_marker(ctx->compress_data, end);
+    if (!scan_end)
+        scan_end = end;
+    int chunk_count = min(ctx->speculative_chunk_count, (int)((scan_end - ctx->compress_data) / MIN_SPECULATIVE_CHUNK_LENGTH));
+    if (chunk_count < 2)
+        return -1;
+
+    struct speculation spec = {ctx, ctx->speculative_chunks, chunk_count, last_MCU};
+    for (int k = 0; k < chunk_count; ++k)
+    {
+        // 不从0xFF之后填充的0x00开始
+        const uint8_t *begin = ctx->compress_data + (scan_end - ctx->compress_data) * k / chunk_count;
+        if (k > 0 && begin[-1] == 0xFF && begin[0] == 0x00)
+            ++begin;
+        spec.chunks[k].begin = begin;
+        if (k > 0)
+            spec.chunks[k - 1].end_position = (int64_t)(uintptr_t)begin * 8;
+    }
+    spec.chunks[chunk_count - 1].end_position = (int64_t)(uintptr_t)scan_end * 8;
+
+    thread_pool_run(ctx->pool, speculate_chunk, &spec, chunk_count);
+    if (spec.chunks[0].failed)
+        return -1;
+
+    uint64_t start = stats_enabled(ctx) ? read_ticks() : 0;
+    struct entropy_state cur = spec.chunks[0].end_state;
+    int cur_MCU = spec.chunks[0].end_MCU;
+    int previous_MCU = 0;
+    spec.chunks[0].first_MCU = 0;
+    memset(&spec.chunks[0].state, 0, sizeof(struct entropy_state));
+    init_bits(&spec.chunks[0].state, ctx->compress_data, end);
+    for (int k = 1; k < chunk_count; ++k)
+    {
+        struct speculative_chunk *chunk = &spec.chunks[k];
+        if (chain_chunk(ctx, chunk, &cur, &cur_MCU) != 0)
+            return -1;
+
+        // 起点在需要的MCU之后的段不再解码
+        if (chunk->first_MCU <= previous_MCU || chunk->first_MCU >= last_MCU)
+            chunk->first_MCU = -1;
+        else
+            previous_MCU = chunk->first_MCU;
+    }
+    if (stats_enabled(ctx))
+        ctx->counters.MCU_ticks += read_ticks() - start;
+
+    thread_pool_run(ctx->pool, decode_segment, &spec, chunk_count);
+    convert_MCU_rows(ctx, ctx->MCU_row_end);
+    return 0;
+}
+
+// 解码压缩数据，每解码完一行就转换并交给输出回调，MCU行缓冲循环复用
+// 有多个restart interval且线程数大于1时，按批并行解码interval，每批完成后输出已完整的行；没有时熵解码串行，其余阶段并行
+// 裁剪时解码到区域最后一行(以及上采样用到的下一行)为止；有restart interval时从区域第一个MCU所在的interval开始
+// 从扫描开头开始解码：重置位缓冲和直流预测，同一次解析后可以多次解码
+void start_scan(struct context *ctx)
+{
+    init_bits(&ctx->entropy, ctx->compress_data, ctx->buffer + ctx->length);
+    memset(ctx->entropy.dc_global_coefficient, 0, sizeof(ctx->entropy.dc_global_coefficient));
+}
+
+void read_compressed_data(struct context *ctx)
+{
+    start_scan(ctx);
+    scan_restart_intervals(ctx);
+    ctx->output_row_count = ctx->crop_y / ctx->plane_heights[COLOR_ID_Y];
+
+    int first_MCU = ctx->MCU_row_begin * ctx->horizontal_MCU_count + ctx->MCU_col_begin;
+    int last_MCU = (ctx->MCU_row_end - 1) * ctx->horizontal_MCU_count + ctx->MCU_col_end; // 最后一个需要的MCU之后
+    int first_interval = ctx->restart_interval > 0 ? first_MCU / ctx->restart_interval : 0;
+    int start_MCU = first_interval * ctx->restart_interval;
+
+    if (ctx->window_interval_count > 0)
+    {
+        int MCU_count = ctx->horizontal_MCU_count * ctx->vertical_MCU_count;
+        int interval_end = min((last_MCU + ctx->restart_interval - 1) / ctx->restart_interval, ctx->interval_count);
+        struct interval_window window = {ctx, first_interval};
+        while (window.first_interval < interval_end)
+        {
+            int count = min(ctx->window_interval_count, interval_end - window.first_interval);
+            thread_pool_run(ctx->pool, read_interval, &window, count);
+            window.first_interval += count;
+
+            int decoded_MCU_count = min(window.first_interval * ctx->restart_interval, MCU_count);
+            output_MCU_rows(ctx, decoded_MCU_count >= last_MCU ? ctx->MCU_row_end : decoded_MCU_count / ctx->horizontal_MCU_count);
+        }
+    }
+    else if (ctx->reconstruct_row_count > 0)
+    {
+        if (ctx->speculative_chunk_count == 0 || speculative_decode(ctx, last_MCU) != 0)
+            reconstruct_MCU_rows(ctx, start_MCU, last_MCU);
+    }
+    else
+    {
+        for (int i = start_MCU / ctx->horizontal_MCU_count; i < ctx->MCU_row_end; ++i)
+        {
+            read_MCUs(ctx, &ctx->entropy, max(i * ctx->horizontal_MCU_count, start_MCU), min((i + 1) * ctx->horizontal_MCU_count, last_MCU), ctx->read_MCU);
+            output_MCU_rows(ctx, i + 1);
+        }
+    }
+
+    // 位缓冲末尾的补0已被读取，说明压缩数据比MCU个数要求的短
+    if (ctx->entropy.bit_padding_count > ctx->entropy.bit_count)
+        log_("compressed data ended %d bits early\n", ctx->entropy.bit_padding_count - ctx->entropy.bit_count);
+}
+
+
+// 只解码系数时各分量的系数平面，每个block占一个struct block，按block行列排列
+struct coefficient_planes
+{
+    struct context *ctx;
+    struct block *planes[4];
+    int block_widths[4]; // 每行的block个数
+};
+
+// 线程池任务，熵解码第task_index个restart interval(没有restart marker时为整个扫描)，MCU的block直接指向系数平面中的位置
+void read_coefficient_interval(void *opaque, int task_index)
+{
+    struct coefficient_planes *coefficients = opaque;
+    struct context *ctx = coefficients->ctx;
+    int MCU_count = ctx->horizontal_MCU_count * ctx->vertical_MCU_count;
+    int first = task_index * ctx->restart_interval;
+    int last = ctx->restart_interval > 0 ? min(first + ctx->restart_interval, MCU_count) : MCU_count;
+
+    struct decode_counters counters = {0};
+    struct entropy_state es = {0};
+    es.counters = &counters;
+    start_interval(ctx, &es, task_index);
+
+    struct block *block_rows[4][4]; // 采样率最大为4
+    struct MCU mcu = {{NULL, block_rows[COLOR_ID_Y], block_rows[COLOR_ID_Cb], block_rows[COLOR_ID_Cr]}};
+    for (int k = first; k < last; ++k)
+    {
+        int i = k / ctx->horizontal_MCU_count;
+        int j = k % ctx->horizontal_MCU_count;
+        for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+        {
+            int h = ctx->MCU_horizontal_block_counts[color_id], v = ctx->MCU_vertical_block_counts[color_id];
+            for (int r = 0; r < v; ++r)
+                block_rows[color_id][r] = coefficients->planes[color_id] + (long)(i * v + r) * coefficients->block_widths[color_id] + j * h;
+        }
+        ctx->entropy_MCU(ctx, &es, &mcu, i, j);
+    }
+    if (stats_enabled(ctx))
+        add_counters(ctx, &counters);
+
+    if (task_index == ctx->interval_count - 1) // 保留最后的状态，用于检查压缩数据是否提前结束
+    {
+        ctx->entropy = es;
+        ctx->entropy.counters = &ctx->counters;
+    }
+}
+
+// 熵解码整幅图像的系数到coefficient_arena中的各分量系数平面，反量化表换为全1，得到的即为量化后的系数，成功返回0
+int read_coefficients(struct context *ctx, struct jpeg_coefficients *out)
+{
+    struct coefficient_planes coefficients = {ctx};
+    size_t size = 0;
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        coefficients.block_widths[color_id] = ctx->horizontal_MCU_count * ctx->MCU_horizontal_block_counts[color_id];
+        size += arena_size((size_t)coefficients.block_widths[color_id] * ctx->vertical_MCU_count * ctx->MCU_vertical_block_counts[color_id] * sizeof(struct block));
+    }
+
+    struct arena *arena = &ctx->coefficient_arena;
+    if (size > arena->capacity)
+    {
+        ++ctx->alloc_count;
+        ctx->alloc_bytes += size;
+    }
+    if (arena_reserve(arena, size) != 0)
+        return -1;
+
+    memset(out, 0, sizeof(struct jpeg_coefficients));
+    out->component_count = ctx->SOF0.color_channel_count;
+    uint16_t ones[64];
+    uint16_t *quantizations[4];
+    for (int i = 0; i < 64; ++i)
+        ones[i] = 1;
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        int height = ctx->vertical_MCU_count * ctx->MCU_vertical_block_counts[color_id];
+        coefficients.planes[color_id] = arena_alloc(arena, (size_t)coefficients.block_widths[color_id] * height * sizeof(struct block));
+        quantizations[color_id] = ctx->quantizations[color_id];
+        if (height == 0)
+            continue;
+
+        out->block_widths[color_id - 1] = coefficients.block_widths[color_id];
+        out->block_heights[color_id - 1] = height;
+        out->planes[color_id - 1] = coefficients.planes[color_id]->coefficient;
+        memcpy(out->quantization_tables[color_id - 1], quantizations[color_id], sizeof(out->quantization_tables[0]));
+        ctx->quantizations[color_id] = ones;
+    }
+
+    start_scan(ctx);
+    scan_restart_intervals(ctx);
+    thread_pool_run(ctx->pool, read_coefficient_interval, &coefficients, ctx->interval_count);
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+        ctx->quantizations[color_id] = quantizations[color_id];
+
+    if (ctx->entropy.bit_padding_count > ctx->entropy.bit_count)
+        log_("compressed data ended %d bits early\n", ctx->entropy.bit_padding_count - ctx->entropy.bit_count);
+    return 0;
+}
+
+// 增量解码时位缓冲读到了已送入数据的末尾(而不是停在marker处)，补入的0不是真正的数据
+int bits_exhausted(struct context *ctx, struct entropy_state *es)
+{
+    return es->bit_end == ctx->buffer + ctx->length && es->bit_end - es->bit_ptr < 2;
+}
+
+// 增量解码：从ctx->next_MCU开始逐个解码，每完成一行就输出，返回0为全部解码完成
+// 某个MCU读到了已送入数据的末尾时恢复到该MCU开始前的状态，返回1等待更多数据；last非0时数据已全部送入，按截断数据补0解码
+int read_compressed_data_incremental(struct context *ctx, int last)
+{
+    struct entropy_state *es = &ctx->entropy;
+    const uint8_t *end = ctx->buffer + ctx->length;
+    int MCU_count = ctx->horizontal_MCU_count * ctx->vertical_MCU_count;
+    struct decode_counters saved_counters;
+    for (; ctx->next_MCU < MCU_count; ++ctx->next_MCU)
+    {
+        int k = ctx->next_MCU;
+        struct entropy_state saved = *es; // 包括interval开始前的状态，恢复后重新查找同一个RSTn
+        if (stats_enabled(ctx))
+            saved_counters = ctx->counters; // 重新解码时不重复计数
+        if (ctx->restart_interval > 0 && k > 0 && k % ctx->restart_interval == 0)
+        {
+            // 上一个interval之后为RSTn，找到之后才能开始下一个；扫描数据已在其它marker处结束时，之后的interval系数全0
+            const uint8_t *p = es->bit_end == end ? find_scan_marker(es->bit_ptr, end) : NULL;
+            if (!p && es->bit_end == end && !last)
+                return 1;
+
+            int interval_index = k / ctx->restart_interval;
+            if (p && p[1] >= SEG_RST0 && p[1] <= SEG_RST7)
+            {
+                if (p[1] != SEG_RST0 + (interval_index - 1) % 8)
+                    log_("restart marker out of order, expect RST%d, got RST%d, offset: %ld\n", (interval_index - 1) % 8, p[1] - SEG_RST0, p - ctx->buffer);
+                init_bits(es, p + 2, end);
+            }
+            else
+            {
+                p = p ? p : es->bit_end;
+                init_bits(es, p, p);
+            }
+            memset(es->dc_global_coefficient, 0, sizeof(es->dc_global_coefficient));
+        }
+
+        int i = k / ctx->horizontal_MCU_count;
+        int j = k % ctx->horizontal_MCU_count;
+        if (i >= ctx->MCU_row_begin && i < ctx->MCU_row_end && j >= ctx->MCU_col_begin && j < ctx->MCU_col_end)
+            ctx->read_MCU(ctx, es, &ctx->MCUs[i % ctx->MCU_row_ring_size][j], i, j);
+        else
+            skip_MCU(ctx, es);
+
+        if (!last && es->bit_padding_count > es->bit_count && bits_exhausted(ctx, es))
+        {
+            *es = saved;
+            if (stats_enabled(ctx))
+                ctx->counters = saved_counters;
+            return 1;
+        }
+        if (j == ctx->horizontal_MCU_count - 1)
+            output_MCU_rows(ctx, i + 1);
+    }
+
+    if (es->bit_padding_count > es->bit_count)
+        log_("compressed data ended %d bits early\n", es->bit_padding_count - es->bit_count);
+
+    return 0;
+}
+
+// 增量解码时输入缓冲追加了数据，缓冲可能已移动，将指向旧缓冲的指针平移到新缓冲，位缓冲去掉数据不足时补入的0后继续读取新数据
+void extend_input(struct context *ctx, const uint8_t *buffer, int length)
+{
+#define rebase(_p) ((_p) ? buffer + ((uintptr_t)(_p) - (uintptr_t)ctx->buffer) : NULL)
+    struct entropy_state *es = &ctx->entropy;
+    int at_end = es->bit_end == ctx->buffer + ctx->length;
+    if (at_end && es->bit_end - es->bit_ptr < 2)
+        unpad_bits(es);
+
+    ctx->ptr = rebase(ctx->ptr);
+    ctx->ptr_SOI = rebase(ctx->ptr_SOI);
+    for (int i = 0; i < ctx->count_APP0s; ++i)
+        ctx->ptr_APP0s[i] = rebase(ctx->ptr_APP0s[i]);
+    for (int i = 0; i < 4; ++i)
+        ctx->DQTs[i].ptr = rebase(ctx->DQTs[i].ptr);
+    for (int i = 0; i < 8; ++i)
+        ctx->DHTs[i / 4][i % 4].ptr = rebase(ctx->DHTs[i / 4][i % 4].ptr);
+    ctx->SOF0.ptr = rebase(ctx->SOF0.ptr);
+    ctx->SOS.ptr = rebase(ctx->SOS.ptr);
+    ctx->compress_data = rebase(ctx->compress_data);
+    es->bit_ptr = rebase(es->bit_ptr);
+    es->bit_end = at_end ? buffer + length : rebase(es->bit_end);
+    ctx->buffer = buffer;
+    ctx->length = length;
+#undef rebase
+}
+
+// 输出区域为(x, y, width, height)，覆盖的MCU需要反量化和IDCT；有色度且使用三角滤波时，上采样要用到相邻的色度，再向外多取一个MCU
+void set_crop(struct context *ctx, int x, int y, int width, int height)
+{
+    int MCU_width = ctx->plane_widths[COLOR_ID_Y] / max(ctx->horizontal_MCU_count, 1); // check_segments已拒绝宽高为0的图像
+    int MCU_height = ctx->plane_heights[COLOR_ID_Y];
+    int margin = ctx->SOF0.color_channel_count > 1 && ctx->upsample_method == UPSAMPLE_FANCY ? 1 : 0;
+
+    ctx->crop_x = x;
+    ctx->crop_y = y;
+    ctx->crop_width = width;
+    ctx->crop_height = height;
+    ctx->MCU_col_begin = max(x / MCU_width - margin, 0);
+    ctx->MCU_col_end = min((x + width - 1) / MCU_width + 1 + margin, ctx->horizontal_MCU_count);
+    ctx->MCU_row_begin = max(y / MCU_height - margin, 0);
+    ctx->MCU_row_end = min((y + height - 1) / MCU_height + 1 + margin, ctx->vertical_MCU_count);
+}
+
+// 创建解码context，同一个context可以依次解码多张图像，pool为NULL时restart interval串行解码
+// scale_denom为1/2/4/8，缩小解码时用只取低频系数的小尺寸IDCT直接得到缩小的图像，条带、上采样和颜色转换都按缩小后的尺寸进行
+struct context *create_context(int idct_method, int upsample_method, int scale_denom, struct thread_pool *pool)
+{
+    struct context *ctx = calloc(1, sizeof(struct context));
+    if (!ctx)
+    {
+        log_("calloc failed: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    ctx->idct_method = idct_method;
+    ctx->idct = idct_get(idct_method, simd_level());
+    if (!ctx->idct)
+    {
+        log_("unsupported idct method: %d\n", idct_method);
+        free(ctx);
+        return NULL;
+    }
+    ctx->scale_denom = scale_denom;
+    ctx->upsample_method = upsample_method;
+    ctx->color_convert = color_get(simd_level());
+    ctx->pool = pool;
+
+    return ctx;
+}
+
+// 表的内容和生成的霍夫曼查找表总是保留，再次定义相同的表时不再重新生成；keep为0时之后的图像不能再使用这些表
+// 保留的表不再指向上一张图像的数据
+void reset_tables(struct context *ctx, int keep)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        ctx->DQTs[i].ptr = NULL;
+        ctx->DQTs[i].defined &= keep != 0;
+    }
+    for (int i = 0; i < 8; ++i)
+    {
+        ctx->DHTs[i / 4][i % 4].ptr = NULL;
+        ctx->DHTs[i / 4][i % 4].defined &= keep != 0;
+        ctx->DHTs[i / 4][i % 4].invalid &= keep != 0;
+    }
+}
+
+// 清除上一张图像的解析结果，interval位置、MCU环形缓冲等内存保留给下一张图像复用，各表见reset_tables
+void reset_context(struct context *ctx)
+{
+    ctx->length = 0;
+    ctx->buffer = NULL;
+    ctx->ptr = NULL;
+    ctx->ptr_SOI = NULL;
+    ctx->count_APP0s = 0;
+    memset(&ctx->SOF0, 0, sizeof(ctx->SOF0));
+    reset_tables(ctx, ctx->keep_tables);
+    memset(&ctx->SOS, 0, sizeof(ctx->SOS));
+    ctx->compress_data = NULL;
+    ctx->restart_interval = 0;
+    ctx->interval_count = 0;
+    memset(&ctx->entropy, 0, sizeof(ctx->entropy));
+    ctx->entropy.counters = &ctx->counters; // 串行和增量解码直接累加到总计数
+    ctx->RGB_output = NULL;
+    ctx->output = NULL;
+    ctx->output_opaque = NULL;
+    ctx->output_MCU_row = -1;
+    ctx->parse_ticks = 0;
+    ctx->color_ticks = 0;
+    memset(&ctx->counters, 0, sizeof(ctx->counters));
+    ctx->alloc_count = 0;
+    ctx->alloc_bytes = 0;
+}
+
+void destroy_context(struct context *ctx)
+{
+    if (!ctx)
+        return;
+
+    free_MCUs(ctx);
+    arena_free(&ctx->MCU_arena);
+    arena_free(&ctx->coefficient_arena);
+    thread_pool_destroy(ctx->pool);
+    free(ctx->interval_ptrs);
+    free(ctx->ptr_APP0s);
+    free(ctx);
+}
+
+// 检查解码用到的各表都已定义，避免解码时访问空指针
+int check_segments(struct context *ctx)
+{
+    if (ctx->SOF0.color_channel_count != 1 && ctx->SOF0.color_channel_count != 3)
+    {
+        log_("SOF0 not found or unsupported color channel count: %d\n", ctx->SOF0.color_channel_count);
+        return -1;
+    }
+    if (ctx->SOF0.width == 0 || ctx->SOF0.height == 0) // 高为0时由DNL给出，不支持
+    {
+        log_("unsupported image size: %dx%d\n", ctx->SOF0.width, ctx->SOF0.height);
+        return -1;
+    }
+    if (!ctx->compress_data)
+    {
+        log_("SOS not found\n");
+        return -1;
+    }
+    // 只支持包含所有分量的单个交错扫描，channel_info最多存3个分量
+    if (ctx->SOS.color_channel_count != ctx->SOF0.color_channel_count)
+    {
+        log_("unsupported SOS color channel count: %d, SOF0: %d\n", ctx->SOS.color_channel_count, ctx->SOF0.color_channel_count);
+        return -1;
+    }
+    // 单分量图像的分量id不一定是1，不论id是多少都按Y解码；SOS中的id与SOF0不一致时不改，下面查找DHT时报错
+    if (ctx->SOF0.color_channel_count == 1)
+    {
+        if (ctx->SOS.channel_info[0].color_id == ctx->SOF0.channel_info[0].color_id)
+            ctx->SOS.channel_info[0].color_id = COLOR_ID_Y;
+        ctx->SOF0.channel_info[0].color_id = COLOR_ID_Y;
+    }
+
+    for (int i = 0; i < ctx->SOF0.color_channel_count; ++i)
+    {
+        struct start_of_frame_0_channel_info *info = &ctx->SOF0.channel_info[i];
+        if (info->color_id < COLOR_ID_Y || info->color_id > COLOR_ID_Cr ||
+            info->horizontal_sample_rate < 1 || info->vertical_sample_rate < 1)
+        {
+            log_("unsupported color channel: id %d, sample rate %dx%d\n", info->color_id, info->horizontal_sample_rate, info->vertical_sample_rate);
+            return -1;
+        }
+
+        struct define_huffman_table *dc_dht = NULL, *ac_dht = NULL;
+        find_DHT_by_color_id(ctx, info->color_id, &dc_dht, &ac_dht);
+        struct define_quantization_table *dqt = find_DQT_by_color_id(ctx, info->color_id);
+        if (!dc_dht || !ac_dht || !dqt)
+        {
+            log_("DQT or DHT of color_id %d not found\n", info->color_id);
+            return -1;
+        }
+        ctx->dc_DHTs[info->color_id] = dc_dht;
+        ctx->ac_DHTs[info->color_id] = ac_dht;
+        ctx->quantizations[info->color_id] = dqt->natural_values;
+    }
+
+    // 上采样只支持整数倍，色度的采样率要能整除Y的采样率；只有一个分量时不交错，不看采样率
+    int horizontal_sample_rates[4] = {0}, vertical_sample_rates[4] = {0};
+    for (int i = 0; i < ctx->SOF0.color_channel_count; ++i)
+    {
+        horizontal_sample_rates[ctx->SOF0.channel_info[i].color_id] = ctx->SOF0.channel_info[i].horizontal_sample_rate;
+        vertical_sample_rates[ctx->SOF0.channel_info[i].color_id] = ctx->SOF0.channel_info[i].vertical_sample_rate;
+    }
+    for (int color_id = COLOR_ID_Cb; color_id <= COLOR_ID_Cr && ctx->SOF0.color_channel_count > 1; ++color_id)
+    {
+        if (horizontal_sample_rates[color_id] == 0 || horizontal_sample_rates[COLOR_ID_Y] % horizontal_sample_rates[color_id] != 0 ||
+            vertical_sample_rates[color_id] == 0 || vertical_sample_rates[COLOR_ID_Y] % vertical_sample_rates[color_id] != 0)
+        {
+            log_("unsupported sampling, color_id %d: %dx%d, Y: %dx%d\n", color_id, horizontal_sample_rates[color_id], vertical_sample_rates[color_id],
+                horizontal_sample_rates[COLOR_ID_Y], vertical_sample_rates[COLOR_ID_Y]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// 从p开始查找下一个marker，跳过填充的0xFF以及marker之间的无效数据
+// 找到时返回0xFF所在位置，length为段长(包含长度字节，SOI/EOI/RSTn等没有段长的marker为0)；数据在读到段长之前结束时返回NULL
+const uint8_t *next_marker(const uint8_t *p, const uint8_t *end, int *marker, int *length)
+{
+    for (; p + 1 < end; ++p)
+    {
+        if (p[0] != 0xFF || p[1] == 0xFF || p[1] == 0x00)
+            continue;
+
+        *marker = p[1];
+        *length = 0;
+        if (*marker == SEG_SOI || *marker == SEG_EOI || (*marker >= SEG_RST0 && *marker <= SEG_RST7) || *marker == SEG_TEM)
+            return p;
+        if (end - p < 4)
+            return NULL;
+        *length = p[2] << 8 | p[3];
+        return p;
+    }
+
+    return NULL;
+}
+
+// 按段长逐个解析区段直到SOS，不扫描压缩数据，也不会把APPn等区段内容中的0xFF误认为marker
+// 压缩数据在SOS之后，由read_compressed_data解码
+int parse_segments(struct context *ctx)
+{
+#define add_seg(type)                                                                                                       \
+    do                                                                                                                      \
+    {                                                                                                                       \
+        if (ctx->count_##type##s == ctx->capacity_##type##s)                                                                \
+        {                                                                                                                   \
+            ctx->capacity_##type##s = ctx->capacity_##type##s ? ctx->capacity_##type##s * 2 : 4;                            \
+            ctx->ptr_##type##s = counted_realloc(ctx, ctx->ptr_##type##s, ctx->capacity_##type##s * sizeof(uint8_t *));     \
+        }                                                                                                                   \
+        ctx->ptr_##type##s[ctx->count_##type##s++] = ctx->ptr - 2;                                                          \
+    }                                                                                                                       \
+    while (0)
+
+    const uint8_t *end = ctx->buffer + ctx->length;
+    const uint8_t *p = ctx->buffer;
+    int marker, length;
+    while (!ctx->compress_data && (p = next_marker(p, end, &marker, &length)))
+    {
+        if (length != 0 && (length < 2 || length > end - p - 2))
+        {
+            log_("%s segment at offset %ld truncated or invalid, length: %d\n", marker_name(marker), p - ctx->buffer, length);
+            break;
+        }
+
+        ctx->ptr = p + 2;
+        switch (marker)
+        {
+        case SEG_SOI: ctx->ptr_SOI = p; break;
+        case SEG_APP0: add_seg(APP0); break;
+        case SEG_SOF0: read_SOF0(ctx); break;
+        case SEG_DQT: read_DQT(ctx); break;
+        case SEG_DHT: read_DHT(ctx); break;
+        case SEG_SOS: read_SOS(ctx); break;
+        case SEG_DRI: read_DRI(ctx); break;
+        }
+        p += 2 + length;
+    }
+
+    // dump_DQTs(ctx);
+    // dump_DHTs(ctx);
+    // dump_SOF0(ctx);
+    // dump_SOS(ctx);
+
+    return check_segments(ctx);
+}
+
+// 解析数据中SOS之前的DQT/DHT，用于从只有表的数据或其它帧中取表，表不指向这些数据；replace非0时先清除之前的表
+void parse_tables(struct context *ctx, int replace)
+{
+    reset_tables(ctx, !replace);
+
+    const uint8_t *end = ctx->buffer + ctx->length;
+    const uint8_t *p = ctx->buffer;
+    int marker, length;
+    while ((p = next_marker(p, end, &marker, &length)) && marker != SEG_SOS)
+    {
+        if (length != 0 && (length < 2 || length > end - p - 2))
+        {
+            log_("%s segment at offset %ld truncated or invalid, length: %d\n", marker_name(marker), p - ctx->buffer, length);
+            break;
+        }
+
+        ctx->ptr = p + 2;
+        if (marker == SEG_DQT)
+            read_DQT(ctx);
+        else if (marker == SEG_DHT)
+            read_DHT(ctx);
+        p += 2 + length;
+    }
+
+    reset_tables(ctx, 1);
+}
+
+// 在多帧拼接的数据中找到从SOI开始的一帧：按段长跳过区段，在压缩数据中查找marker，跳过RSTn，直到EOI
+// 帧中没有EOI时到下一个SOI或数据结束为止，complete为0
+int find_frame(const uint8_t *data, const uint8_t *end, struct jpeg_frame *frame)
+{
+    memset(frame, 0, sizeof(struct jpeg_frame));
+
+    const uint8_t *p = data;
+    int marker, length;
+    while ((p = next_marker(p, end, &marker, &length)) && marker != SEG_SOI)
+        p += 2;
+    if (!p)
+        return -1;
+
+    const uint8_t *start = p;
+    frame->offset = start - data;
+    p += 2;
+    while ((p = next_marker(p, end, &marker, &length)) && marker != SEG_SOI)
+    {
+        if (marker == SEG_EOI)
+        {
+            frame->complete = 1;
+            frame->size = p + 2 - start;
+            return 0;
+        }
+        if (length > end - p - 2)
+            break;
+        frame->has_DQT |= marker == SEG_DQT;
+        frame->has_DHT |= marker == SEG_DHT;
+
+        p += 2 + length;
+        if (marker == SEG_SOS)
+        {
+            while ((p = find_scan_marker(p, end)) && p[1] >= SEG_RST0 && p[1] <= SEG_RST7)
+                p += 2;
+            if (!p)
+                break;
+        }
+    }
+
+    frame->size = (p && marker == SEG_SOI ? p : end) - start;
+    return 0;
+}
+
+int is_SOF(int marker)
+{
+    return marker >= SEG_SOF0 && marker <= SEG_SOF15 && marker != SEG_DHT && marker != SEG_JPG && marker != SEG_DAC;
+}
+
+// 只用到数据指针和SOF0/DRI的结果，不分配内存
+int probe_segments(struct context *ctx, struct jpeg_probe_info *info)
+{
+    const uint8_t *end = ctx->buffer + ctx->length;
+    const uint8_t *p = ctx->buffer;
+    int marker, length;
+    if (ctx->length >= 2 && (p[0] != 0xFF || p[1] != SEG_SOI))
+    {
+        log_("not a JPEG, SOI not found\n");
+        return -1;
+    }
+
+    while ((p = next_marker(p, end, &marker, &length)))
+    {
+        if (length != 0 && length < 2)
+        {
+            log_("%s segment at offset %ld invalid, length: %d\n", marker_name(marker), p - ctx->buffer, length);
+            return -1;
+        }
+        if (length > end - p - 2) // 截断的区段不计入
+            break;
+
+        if (info->segment_count < JPEG_PROBE_MAX_SEGMENTS)
+        {
+            struct jpeg_segment *seg = &info->segments[info->segment_count];
+            seg->marker = marker;
+            seg->offset = p - ctx->buffer;
+            seg->length = length;
+        }
+        ++info->segment_count;
+
+        ctx->ptr = p + 2;
+        if (is_SOF(marker))
+        {
+            read_SOF0(ctx);
+            info->frame_marker = marker;
+        }
+        else if (marker == SEG_DRI)
+        {
+            read_DRI(ctx);
+        }
+        p += 2 + length;
+
+        if (marker == SEG_SOS)
+        {
+            info->complete = 1;
+            info->header_length = p - ctx->buffer;
+            break;
+        }
+    }
+
+    return info->frame_marker ? 0 : 1;
+}
+
+#define PUSH_NONE 0    // 没有在增量解码
+#define PUSH_HEADERS 1 // 等待区段数据
+#define PUSH_SCAN 2    // 解码压缩数据中
+#define PUSH_DONE 3    // 已解码完成
+#define PUSH_FAILED 4  // 出错
+
+struct jpeg_decoder
+{
+    struct context *ctx;
+    struct input input; // 当前图像的数据
+    int parsed;         // 当前图像的区段已成功解析
+    int push_state;     // 增量解码的状态，PUSH_NONE等
+};
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+// 指令集检测和IDCT常量表为全局状态，只初始化一次
+static void init_globals()
+{
+    simd_init();
+    idct_init();
+}
+
+struct jpeg_decoder *jpeg_decoder_create(const struct jpeg_decoder_options *options)
+{
+    struct jpeg_decoder_options default_options = {0};
+    if (!options)
+        options = &default_options;
+
+    pthread_once(&init_once, init_globals);
+
+    struct jpeg_decoder *dec = calloc(1, sizeof(struct jpeg_decoder));
+    if (!dec)
+    {
+        log_("calloc failed: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    int scale_denom = options->scale_denom > 1 ? options->scale_denom : 1;
+    if (scale_denom != 1 && scale_denom != 2 && scale_denom != 4 && scale_denom != 8)
+    {
+        log_("unsupported scale: 1/%d\n", scale_denom);
+        free(dec);
+        return NULL;
+    }
+
+    struct thread_pool *pool = options->thread_count > 1 ? thread_pool_create(options->thread_count) : NULL;
+    dec->ctx = create_context(options->idct_method, options->upsample_method, scale_denom, pool);
+    if (!dec->ctx)
+    {
+        thread_pool_destroy(pool);
+        free(dec);
+        return NULL;
+    }
+    dec->ctx->collect_stats = options->collect_stats;
+    dec->ctx->keep_tables = options->keep_tables;
+    dec->ctx->speculative = options->speculative;
+
+    return dec;
+}
+
+void jpeg_decoder_destroy(struct jpeg_decoder *dec)
+{
+    if (!dec)
+        return;
+
+    destroy_context(dec->ctx);
+    input_free(&dec->input);
+    free(dec);
+}
+
+void jpeg_decoder_reset(struct jpeg_decoder *dec)
+{
+    reset_context(dec->ctx);
+    input_close(&dec->input);
+    dec->parsed = 0;
+    dec->push_state = PUSH_NONE;
+}
+
+static void fill_info(struct context *ctx, struct jpeg_info *info)
+{
+    if (!info)
+        return;
+
+    memset(info, 0, sizeof(struct jpeg_info));
+    info->width = ctx->image_width;
+    info->height = ctx->image_height;
+    info->component_count = ctx->SOF0.color_channel_count;
+    for (int color_id = COLOR_ID_Y; color_id <= COLOR_ID_Cr; ++color_id)
+    {
+        info->horizontal_sample_rates[color_id - 1] = ctx->MCU_horizontal_block_counts[color_id];
+        info->vertical_sample_rates[color_id - 1] = ctx->MCU_vertical_block_counts[color_id];
+        info->block_sizes[color_id - 1] = ctx->block_sizes[color_id];
+        info->component_widths[color_id - 1] = ctx->component_widths[color_id];
+        info->component_heights[color_id - 1] = ctx->component_heights[color_id];
+    }
+    info->horizontal_MCU_count = ctx->horizontal_MCU_count;
+    info->vertical_MCU_count = ctx->vertical_MCU_count;
+    info->restart_interval = ctx->restart_interval;
+}
+
+// 解析dec->input中的数据
+static int parse_input(struct jpeg_decoder *dec, struct jpeg_info *info)
+{
+    struct context *ctx = dec->ctx;
+
+    reset_context(ctx);
+    dec->parsed = 0;
+    if (dec->input.size > INT_MAX)
+    {
+        log_("data too large: %zu\n", dec->input.size);
+        return -1;
+    }
+
+    ctx->start_ns = monotonic_ns();
+    ctx->start_ticks = read_ticks();
+    ctx->buffer = dec->input.data;
+    ctx->ptr = dec->input.data;
+    ctx->length = dec->input.size;
+    if (parse_segments(ctx) != 0)
+        return -1;
+
+    if (init_MCUs(ctx) != 0)
+        return -1;
+    init_conversion(ctx);
+    set_crop(ctx, 0, 0, ctx->image_width, ctx->image_height);
+    dec->parsed = 1;
+    if (stats_enabled(ctx))
+        ctx->parse_ticks = read_ticks() - ctx->start_ticks;
+
+    fill_info(ctx, info);
+    return 0;
+}
+
+int jpeg_decoder_parse_headers(struct jpeg_decoder *dec, const uint8_t *data, size_t size, struct jpeg_info *info)
+{
+    if (!data)
+    {
+        log_("data is NULL\n");
+        jpeg_decoder_reset(dec);
+        return -1;
+    }
+
+    input_set_memory(&dec->input, data, size);
+    dec->push_state = PUSH_NONE;
+    return parse_input(dec, info);
+}
+
+int jpeg_decoder_parse_file(struct jpeg_decoder *dec, const char *filename, struct jpeg_info *info)
+{
+    if (input_open_file(&dec->input, filename) != 0)
+    {
+        jpeg_decoder_reset(dec);
+        return -1;
+    }
+
+    dec->push_state = PUSH_NONE;
+    return parse_input(dec, info);
+}
+
+int jpeg_decoder_set_crop(struct jpeg_decoder *dec, int x, int y, int width, int height)
+{
+    struct context *ctx = dec->ctx;
+    int image_width = ctx->image_width;
+    int image_height = ctx->image_height;
+    if (!dec->parsed || dec->push_state != PUSH_NONE || x < 0 || y < 0 || width <= 0 || height <= 0 || x > image_width - width || y > image_height - height)
+    {
+        log_("headers not parsed, decoding incrementally or invalid crop: (%d, %d) %dx%d\n", x, y, width, height);
+        return -1;
+    }
+
+    set_crop(ctx, x, y, width, height);
+    return 0;
+}
+
+int jpeg_decoder_decode(struct jpeg_decoder *dec, uint8_t *RGB, int stride)
+{
+    if (!dec->parsed || !RGB || stride < dec->ctx->crop_width * 3)
+    {
+        log_("headers not parsed or invalid output, stride: %d\n", stride);
+        return -1;
+    }
+
+    struct context *ctx = dec->ctx;
+    ctx->RGB_output = RGB;
+    ctx->RGB_stride = stride;
+    ctx->output = NULL;
+    read_compressed_data(ctx);
+    ctx->RGB_output = NULL;
+
+    return 0;
+}
+
+int jpeg_decoder_decode_rows(struct jpeg_decoder *dec, jpeg_row_callback callback, void *opaque)
+{
+    if (!dec->parsed)
+    {
+        log_("headers not parsed\n");
+        return -1;
+    }
+
+    struct context *ctx = dec->ctx;
+    ctx->RGB_output = NULL;
+    ctx->output = callback;
+    ctx->output_opaque = opaque;
+    read_compressed_data(ctx);
+    ctx->output = NULL;
+    ctx->output_opaque = NULL;
+
+    return 0;
+}
+
+int jpeg_decoder_decode_coefficients(struct jpeg_decoder *dec, struct jpeg_coefficients *coefficients)
+{
+    if (!dec->parsed || !coefficients)
+    {
+        log_("headers not parsed or invalid output\n");
+        return -1;
+    }
+
+    return read_coefficients(dec->ctx, coefficients);
+}
+
+int jpeg_decoder_push(struct jpeg_decoder *dec, const uint8_t *data, size_t size, struct jpeg_info *info, jpeg_row_callback callback, void *opaque)
+{
+    struct context *ctx = dec->ctx;
+    if (dec->push_state == PUSH_DONE || dec->push_state == PUSH_FAILED)
+        return dec->push_state == PUSH_DONE ? 0 : -1;
+    if (dec->push_state == PUSH_NONE)
+    {
+        jpeg_decoder_reset(dec);
+        dec->push_state = PUSH_HEADERS;
+    }
+
+    int last = size == 0;
+    if (!last)
+    {
+        if (!data || input_append(&dec->input, data, size) != 0 || dec->input.size > INT_MAX)
+        {
+            log_("data is NULL, append failed or data too large: %zu\n", dec->input.size);
+            goto fail;
+        }
+        if (dec->parsed)
+            extend_input(ctx, dec->input.data, dec->input.size);
+    }
+
+    // 区段按段长解析，先确认SOS之前的区段已全部送入，再一次解析
+    if (dec->push_state == PUSH_HEADERS)
+    {
+        struct jpeg_probe_info probe_info;
+        int ret = dec->input.data ? jpeg_decoder_probe(dec->input.data, dec->input.size, &probe_info) : -1;
+        if (ret < 0 || (last && !(ret == 0 && probe_info.complete)))
+        {
+            log_("invalid data or data ended before SOS, %zu bytes\n", dec->input.size);
+            goto fail;
+        }
+        if (!(ret == 0 && probe_info.complete))
+            return 1;
+
+        if (parse_input(dec, NULL) != 0)
+            goto fail;
+        start_scan(ctx);
+        ctx->next_MCU = 0;
+        ctx->output_row_count = 0;
+        dec->push_state = PUSH_SCAN;
+    }
+
+    fill_info(ctx, info);
+    ctx->RGB_output = NULL;
+    ctx->output = callback;
+    ctx->output_opaque = opaque;
+    int ret = read_compressed_data_incremental(ctx, last);
+    ctx->output = NULL;
+    ctx->output_opaque = NULL;
+
+    if (ret == 0)
+        dec->push_state = PUSH_DONE;
+    return ret;
+
+fail:
+    dec->push_state = PUSH_FAILED;
+    return -1;
+}
+
+int jpeg_decoder_load_tables(struct jpeg_decoder *dec, const uint8_t *data, size_t size, int replace)
+{
+    jpeg_decoder_reset(dec);
+    struct context *ctx = dec->ctx;
+    if (!ctx->keep_tables) // 否则下次解析时reset_tables会清除载入的表
+    {
+        log_("keep_tables is 0, loaded tables would be dropped by the next parse\n");
+        return -1;
+    }
+    if (!data || size > INT_MAX)
+    {
+        log_("data is NULL or too large: %zu\n", size);
+        return -1;
+    }
+
+    ctx->buffer = data;
+    ctx->length = size;
+    parse_tables(ctx, replace);
+    ctx->buffer = NULL;
+    ctx->ptr = NULL;
+    ctx->length = 0;
+    return 0;
+}
+
+int jpeg_decoder_find_frame(const uint8_t *data, size_t size, struct jpeg_frame *frame)
+{
+    if (!data || !frame)
+    {
+        log_("data or frame is NULL\n");
+        return -1;
+    }
+
+    return find_frame(data, data + size, frame);
+}
+
+int jpeg_decoder_stats(struct jpeg_decoder *dec, struct jpeg_stats *stats)
+{
+    struct context *ctx = dec->ctx;
+    if (!stats_enabled(ctx) || !dec->parsed || !stats)
+        return -1;
+
+    memset(stats, 0, sizeof(struct jpeg_stats));
+    struct decode_counters *counters = &ctx->counters;
+    stats->parse_ticks = ctx->parse_ticks;
+    stats->entropy_ticks = counters->MCU_ticks - counters->idct_ticks;
+    stats->idct_ticks = counters->idct_ticks;
+    stats->color_ticks = ctx->color_ticks;
+
+    // 从解析开始到现在的计数与纳秒数之比即为每个计数的时长
+    uint64_t ticks = read_ticks() - ctx->start_ticks;
+    uint64_t ns = monotonic_ns() - ctx->start_ns;
+    double seconds_per_tick = ticks > 0 ? ns / 1e9 / ticks : 0;
+    stats->parse_seconds = stats->parse_ticks * seconds_per_tick;
+    stats->entropy_seconds = stats->entropy_ticks * seconds_per_tick;
+    stats->idct_seconds = stats->idct_ticks * seconds_per_tick;
+    stats->color_seconds = stats->color_ticks * seconds_per_tick;
+
+    stats->bits = counters->bits;
+    stats->decoded_blocks = counters->decoded_blocks;
+    stats->skipped_blocks = counters->skipped_blocks;
+    memcpy(stats->eob_positions, counters->eob_positions, sizeof(stats->eob_positions));
+    memcpy(stats->zero_runs, counters->zero_runs, sizeof(stats->zero_runs));
+    stats->alloc_count = ctx->alloc_count;
+    stats->alloc_bytes = ctx->alloc_bytes;
+
+    return 0;
+}
+
+// JSON时为[a,b,...]，CSV时为a;b;...
+static void write_histogram(FILE *fp, const uint64_t *values, int count, int format)
+{
+    fputs(format == JPEG_STATS_JSON ? "[" : "", fp);
+    for (int i = 0; i < count; ++i)
+        fprintf(fp, "%s%llu", i == 0 ? "" : format == JPEG_STATS_JSON ? "," : ";", (unsigned long long)values[i]);
+    fputs(format == JPEG_STATS_JSON ? "]" : "", fp);
+}
+
+int jpeg_decoder_write_stats(const struct jpeg_stats *stats, const char *name, int format, FILE *fp)
+{
+    if (!fp || (format != JPEG_STATS_JSON && format != JPEG_STATS_CSV) || (!stats && format != JPEG_STATS_CSV))
+    {
+        log_("invalid stats output, format: %d\n", format);
+        return -1;
+    }
+
+    if (!stats)
+    {
+        fprintf(fp, "image,parse_ms,entropy_ms,idct_ms,color_ms,parse_ticks,entropy_ticks,idct_ticks,color_ticks,"
+                    "bits,decoded_blocks,skipped_blocks,alloc_count,alloc_bytes,eob_positions,zero_runs\n");
+        return 0;
+    }
+
+    // 名字按原样输出，只替换会破坏格式的引号、反斜杠和逗号
+    char escaped[256] = {0};
+    int length = 0;
+    for (const char *p = name ? name : ""; *p && length < (int)sizeof(escaped) - 1; ++p)
+        escaped[length++] = *p == '"' || *p == '\\' || (*p == ',' && format == JPEG_STATS_CSV) ? '_' : *p;
+
+    unsigned long long values[] = {stats->parse_ticks, stats->entropy_ticks, stats->idct_ticks, stats->color_ticks,
+        stats->bits, stats->decoded_blocks, stats->skipped_blocks};
+    if (format == JPEG_STATS_JSON)
+    {
+        fprintf(fp, "{\"image\":\"%s\",\"parse_ms\":%.3f,\"entropy_ms\":%.3f,\"idct_ms\":%.3f,\"color_ms\":%.3f,"
+                    "\"parse_ticks\":%llu,\"entropy_ticks\":%llu,\"idct_ticks\":%llu,\"color_ticks\":%llu,"
+                    "\"bits\":%llu,\"decoded_blocks\":%llu,\"skipped_blocks\":%llu,\"alloc_count\":%d,\"alloc_bytes\":%zu,\"eob_positions\":",
+            escaped, stats->parse_seconds * 1e3, stats->entropy_seconds * 1e3, stats->idct_seconds * 1e3, stats->color_seconds * 1e3,
+            values[0], values[1], values[2], values[3], values[4], values[5], values[6], stats->alloc_count, stats->alloc_bytes);
+        write_histogram(fp, stats->eob_positions, JPEG_STATS_EOB_POSITIONS, format);
+        fputs(",\"zero_runs\":", fp);
+        write_histogram(fp, stats->zero_runs, JPEG_STATS_ZERO_RUNS, format);
+        fputs("}\n", fp);
+    }
+    else
+    {
+        fprintf(fp, "%s,%.3f,%.3f,%.3f,%.3f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%d,%zu,",
+            escaped, stats->parse_seconds * 1e3, stats->entropy_seconds * 1e3, stats->idct_seconds * 1e3, stats->color_seconds * 1e3,
+            values[0], values[1], values[2], values[3], values[4], values[5], values[6], stats->alloc_count, stats->alloc_bytes);
+        write_histogram(fp, stats->eob_positions, JPEG_STATS_EOB_POSITIONS, format);
+        fputs(",", fp);
+        write_histogram(fp, stats->zero_runs, JPEG_STATS_ZERO_RUNS, format);
+        fputs("\n", fp);
+    }
+
+    return ferror(fp) ? -1 : 0;
+}
+
+const int16_t *jpeg_decoder_coefficients(struct jpeg_decoder *dec, int MCU_row, int MCU_col, int component, int block_row, int block_col)
+{
+    struct context *ctx = dec->ctx;
+    int color_id = component + 1;
+    // 环形缓冲中其它行可能已被后面的行覆盖，只允许取正在回调的行
+    if (!dec->parsed || MCU_row < 0 || MCU_row >= ctx->vertical_MCU_count || MCU_row != ctx->output_MCU_row ||
+        color_id < COLOR_ID_Y || color_id > COLOR_ID_Cr || MCU_col < 0 || MCU_col >= ctx->horizontal_MCU_count ||
+        block_row < 0 || block_row >= ctx->MCU_vertical_block_counts[color_id] ||
+        block_col < 0 || block_col >= ctx->MCU_horizontal_block_counts[color_id])
+        return NULL;
+
+    struct MCU *mcu = &ctx->MCUs[MCU_row % ctx->MCU_row_ring_size][MCU_col];
+    return mcu->blocks[color_id][block_row][block_col].coefficient;
+}
+
+int jpeg_decoder_probe(const uint8_t *data, size_t size, struct jpeg_probe_info *info)
+{
+    if (!data || !info)
+    {
+        log_("data or info is NULL\n");
+        return -1;
+    }
+
+    memset(info, 0, sizeof(struct jpeg_probe_info));
+    struct context ctx = {0};
+    ctx.buffer = data;
+    ctx.length = min(size, INT_MAX);
+    int ret = probe_segments(&ctx, info);
+    if (ret < 0)
+        return ret;
+
+    info->width = ctx.SOF0.width;
+    info->height = ctx.SOF0.height;
+    info->component_count = ctx.SOF0.color_channel_count;
+    for (int i = 0; i < min(ctx.SOF0.color_channel_count, 3); ++i)
+    {
+        info->horizontal_sample_rates[i] = ctx.SOF0.channel_info[i].horizontal_sample_rate;
+        info->vertical_sample_rates[i] = ctx.SOF0.channel_info[i].vertical_sample_rate;
+    }
+    info->restart_interval = ctx.restart_interval;
+
+    return ret;
+}
+
+const char *jpeg_decoder_simd_name()
+{
+    pthread_once(&init_once, init_globals);
+    return simd_name(simd_level());
+}
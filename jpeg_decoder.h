@@ -0,0 +1,205 @@
+#ifndef JPEG_DECODER_H
+#define JPEG_DECODER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JPEG_DECODER_API __attribute__((visibility("default")))
+
+// IDCT方法，精度和速度的取舍：FLOAT为按公式计算的参考结果；INT与之只差舍入误差，有SIMD实现；
+// FAST为16位定点的快速算法，比INT快但误差更大，各方法的PSNR和吞吐量可以用bench -q测量
+#define JPEG_IDCT_INT 0   // 精确定点可分离IDCT，默认
+#define JPEG_IDCT_FLOAT 1 // 精确浮点参考实现，很慢
+#define JPEG_IDCT_FAST 2  // 快速16位定点AAN
+
+#define JPEG_UPSAMPLE_FANCY 0   // 三角滤波，默认
+#define JPEG_UPSAMPLE_NEAREST 1 // 最近邻
+
+// 全部为0时即为默认配置
+struct jpeg_decoder_options
+{
+    int idct_method;     // JPEG_IDCT_INT/JPEG_IDCT_FLOAT/JPEG_IDCT_FAST
+    int upsample_method; // JPEG_UPSAMPLE_FANCY/JPEG_UPSAMPLE_NEAREST
+    int thread_count;    // 并行解码的线程数，有restart interval时并行熵解码各interval，没有时熵解码串行，IDCT和颜色转换按MCU行并行；<=1为串行
+    int scale_denom;     // 输出缩小为1/scale_denom，可为1/2/4/8，0同1
+    int collect_stats;   // 非0时统计各阶段耗时和熵解码计数，见jpeg_decoder_stats；编译时定义JPEG_DECODER_NO_STATS则忽略
+    int keep_tables;     // 非0时DQT/DHT在图像之间保留，图像中没有定义的表沿用之前的图像，用于MJPEG等多帧数据
+    int speculative;     // 非0且没有restart marker、thread_count>1时，把压缩数据分段推测并行熵解码，整幅图像的MCU和分量平面同时保留在内存中
+};
+
+struct jpeg_info
+{
+    int width;                      // 输出图像宽(缩小后)，不是MCU宽的整数倍时右侧不满的MCU只输出图像内的部分
+    int height;                     // 输出图像高(缩小后)
+    int component_count;            // 1:灰度/3:YCbCr
+    int horizontal_sample_rates[3]; // Y/Cb/Cr的水平采样率，即每个MCU中横向block个数
+    int vertical_sample_rates[3];   // Y/Cb/Cr的垂直采样率，即每个MCU中纵向block个数
+    int horizontal_MCU_count;       // 横向MCU个数
+    int vertical_MCU_count;         // 纵向MCU个数
+    int restart_interval;           // 每个restart interval的MCU个数，0为没有restart marker
+    int block_sizes[3];             // Y/Cb/Cr每个block输出的像素边长，原尺寸为8，缩小解码时色度可能大于Y
+    int component_widths[3];        // Y/Cb/Cr在分量平面中的有效像素宽，之后到plane_strides为补齐MCU的数据
+    int component_heights[3];       // Y/Cb/Cr的有效像素行数，最后一行MCU中之后的行为补齐MCU的数据
+};
+
+// 每输出一行MCU回调一次，指针只在回调期间有效；设置了裁剪区域时只回调与区域相交的MCU行
+struct jpeg_rows
+{
+    int MCU_row;              // MCU行号
+    int y;                    // 第一行像素在输出图像(裁剪时为区域)中的行号
+    int row_count;            // 像素行数，即一行MCU的高度，最后一行MCU或裁剪时为其中位于图像或区域内的行数
+    const uint8_t *RGB;       // row_count行RGB24，裁剪时每行为区域的宽度
+    int RGB_stride;           // RGB每行的字节数
+    const uint8_t *planes[3]; // Y/Cb/Cr分量IDCT后的像素，各为plane_row_counts[i]行，包括补齐MCU的部分，灰度图只有Y；裁剪时只有区域覆盖的MCU有效
+    int plane_strides[3];     // 各分量每行的字节数
+    int plane_row_counts[3];  // 各分量在这一行MCU中的像素行数
+};
+
+#define JPEG_PROBE_MAX_SEGMENTS 32
+
+struct jpeg_segment
+{
+    int marker;    // 0xFF之后的marker字节，例如0xD8为SOI
+    size_t offset; // marker在数据中的偏移
+    int length;    // 段长，包含长度字节，不包含marker，SOI/EOI/RSTn为0
+};
+
+// 只解析到第一个SOS的元数据，字段与jpeg_info相同的含义相同
+struct jpeg_probe_info
+{
+    int width;
+    int height;
+    int component_count;            // 可能为4(CMYK)等解码器不支持的值
+    int horizontal_sample_rates[3]; // 前3个分量的水平采样率
+    int vertical_sample_rates[3];   // 前3个分量的垂直采样率
+    int frame_marker;               // 帧头marker，0xC0为baseline，解码器只支持baseline
+    int restart_interval;           // SOS之前DRI中的值
+    int complete;                   // 1:解析到了SOS；0:数据在SOS之前结束
+    size_t header_length;           // complete时为压缩数据的起始偏移
+    int segment_count;              // 区段个数，超过JPEG_PROBE_MAX_SEGMENTS的只计数
+    struct jpeg_segment segments[JPEG_PROBE_MAX_SEGMENTS];
+};
+
+#define JPEG_STATS_EOB_POSITIONS 65 // EOB位置分布的项数
+#define JPEG_STATS_ZERO_RUNS 17      // 0游程分布的项数
+
+#define JPEG_STATS_JSON 1 // 一行JSON对象
+#define JPEG_STATS_CSV 2  // 一行逗号分隔，直方图各项以分号分隔
+
+// 当前图像的统计，并行解码时为各线程之和
+struct jpeg_stats
+{
+    double parse_seconds;   // 区段解析和解码缓冲初始化
+    double entropy_seconds; // 霍夫曼解码，反量化与之合并在一起
+    double idct_seconds;    // IDCT
+    double color_seconds;   // 色度上采样和颜色转换
+
+    uint64_t parse_ticks; // 各阶段的原始计数，x86上为TSC周期，其它平台为纳秒
+    uint64_t entropy_ticks;
+    uint64_t idct_ticks;
+    uint64_t color_ticks;
+
+    uint64_t bits;           // 熵解码读取的压缩数据bit数，0xFF后填充的0x00也计入，RSTn不计入
+    uint64_t decoded_blocks; // 熵解码后做了IDCT的block数
+    uint64_t skipped_blocks; // 裁剪区域以外只熵解码的block数
+
+    uint64_t eob_positions[JPEG_STATS_EOB_POSITIONS]; // 第k项为在zigzag位置k(1~63)遇到EOB的block数，第64项为没有EOB的block数
+    uint64_t zero_runs[JPEG_STATS_ZERO_RUNS];         // 第n项为前面有n(0~15)个0的AC非0系数个数，第16项为ZRL个数
+
+    int alloc_count;    // 解析和解码这张图像时解码器内部的内存分配次数，复用上一张图像的缓冲时不分配
+    size_t alloc_bytes; // 这些分配的总字节数
+};
+
+// MJPEG等多帧依次拼接的数据中的一帧
+struct jpeg_frame
+{
+    size_t offset;  // SOI在数据中的偏移
+    size_t size;    // 从SOI到EOI(包含)的字节数
+    int complete;   // 1:找到了EOI；0:在下一个SOI或数据结束之前没有EOI，size到此为止，数据可能还没有全部到达
+    int has_DQT;    // 帧中有DQT
+    int has_DHT;    // 帧中有DHT
+};
+
+// 整幅图像熵解码后量化的DCT系数，见jpeg_decoder_decode_coefficients
+struct jpeg_coefficients
+{
+    int component_count;                 // 1:灰度/3:YCbCr
+    int block_widths[3];                 // Y/Cb/Cr每行的block个数，包括右侧补齐MCU的block
+    int block_heights[3];                // Y/Cb/Cr的block行数，包括下侧补齐MCU的block
+    const int16_t *planes[3];            // Y/Cb/Cr的系数平面，第(row, col)个block为planes[c] + ((size_t)row * block_widths[c] + col) * 64开始的64个系数，自然顺序
+    uint16_t quantization_tables[3][64]; // Y/Cb/Cr的量化表，自然顺序，系数乘以同一位置的量化值即为反量化后的值
+};
+
+typedef void (*jpeg_row_callback)(void *opaque, const struct jpeg_rows *rows);
+
+struct jpeg_decoder;
+
+// options为NULL时使用默认配置，失败返回NULL
+JPEG_DECODER_API struct jpeg_decoder *jpeg_decoder_create(const struct jpeg_decoder_options *options);
+JPEG_DECODER_API void jpeg_decoder_destroy(struct jpeg_decoder *dec);
+
+// 清除当前图像的状态，DQT/DHT/MCU等内存保留，解码尺寸相同的下一张图像时不再分配
+JPEG_DECODER_API void jpeg_decoder_reset(struct jpeg_decoder *dec);
+
+// 解析data中的各区段直到压缩数据，会先reset；直接在data上解码不复制，data在解码完成前必须保持有效，成功返回0
+JPEG_DECODER_API int jpeg_decoder_parse_headers(struct jpeg_decoder *dec, const uint8_t *data, size_t size, struct jpeg_info *info);
+
+// 只读映射文件后解析，映射在reset、解析下一张图像或destroy时解除，成功返回0
+JPEG_DECODER_API int jpeg_decoder_parse_file(struct jpeg_decoder *dec, const char *filename, struct jpeg_info *info);
+
+// 只解码输出(x, y, width, height)区域，坐标为输出(缩小后)图像中的像素，在解析之后、解码之前调用，重新解析后恢复为整幅图像
+// 区域以外的MCU只做熵解码，区域最后一行之后不再解码，有restart interval时跳过不需要的interval，成功返回0
+JPEG_DECODER_API int jpeg_decoder_set_crop(struct jpeg_decoder *dec, int x, int y, int width, int height);
+
+// 解码为RGB24写到RGB，每行stride字节，设置了裁剪区域时只写区域大小，成功返回0
+JPEG_DECODER_API int jpeg_decoder_decode(struct jpeg_decoder *dec, uint8_t *RGB, int stride);
+
+// 逐行MCU解码，每行调用一次callback，成功返回0
+JPEG_DECODER_API int jpeg_decoder_decode_rows(struct jpeg_decoder *dec, jpeg_row_callback callback, void *opaque);
+
+// 只熵解码，不反量化、不IDCT、不转换颜色，得到整幅图像各分量量化后的系数，在解析之后调用，不受裁剪和缩小的影响
+// 系数平面在解码器内部，下次调用或destroy之前有效；有restart interval且thread_count>1时各interval并行解码，成功返回0
+JPEG_DECODER_API int jpeg_decoder_decode_coefficients(struct jpeg_decoder *dec, struct jpeg_coefficients *coefficients);
+
+// 增量解码，数据分块到达时逐块送入，不必等整个文件；每次尽可能向后解析和解码，每完成一行MCU调用一次callback
+// 第一次调用开始新图像(会先reset)，送入的数据复制到内部缓冲；区段在SOS之前的数据全部到达后解析，之后每次调用时填写info(可为NULL)
+// 数据在marker或MCU中间不足时停在该MCU之前，下次送入数据后继续；size为0表示数据已全部送入，剩余的MCU按截断数据补0解码
+// 返回1需要更多数据，0解码完成，-1出错；完成或出错后再次调用返回相同结果，调用jpeg_decoder_reset后开始下一张图像，不支持裁剪
+JPEG_DECODER_API int jpeg_decoder_push(struct jpeg_decoder *dec, const uint8_t *data, size_t size, struct jpeg_info *info, jpeg_row_callback callback, void *opaque);
+
+// 解析data中SOS之前的DQT/DHT，覆盖之前保留的同一表号的表，replace非0时先清除之前保留的所有表，会先reset，不复制data
+// 用于从只有表的数据或之前的帧中取表，创建时keep_tables须非0，否则返回-1，成功返回0
+// 解码时用到的霍夫曼表0/1没有定义则使用Annex K的标准表；定义与之前相同的霍夫曼表时不再重新生成查找表
+JPEG_DECODER_API int jpeg_decoder_load_tables(struct jpeg_decoder *dec, const uint8_t *data, size_t size, int replace);
+
+// 在MJPEG等多帧拼接的数据中查找下一帧，按段长跳过区段，扫描压缩数据直到EOI，不分配内存；找到SOI返回0，没有更多帧返回-1
+// 下一帧从data + frame->offset + frame->size开始查找
+JPEG_DECODER_API int jpeg_decoder_find_frame(const uint8_t *data, size_t size, struct jpeg_frame *frame);
+
+// 取当前图像到目前为止的统计，创建时collect_stats为0、编译时关闭了统计或还没有解析时返回-1
+JPEG_DECODER_API int jpeg_decoder_stats(struct jpeg_decoder *dec, struct jpeg_stats *stats);
+
+// 把一张图像的统计写为一行JPEG_STATS_JSON/JPEG_STATS_CSV，name为图像名；CSV时stats为NULL则写表头，成功返回0
+JPEG_DECODER_API int jpeg_decoder_write_stats(const struct jpeg_stats *stats, const char *name, int format, FILE *fp);
+
+// 在callback中取第MCU_row行第MCU_col个MCU中component(0:Y/1:Cb/2:Cr)分量第(block_row, block_col)个block反量化后的系数，自然顺序，供调试使用
+// MCU_row必须是当前回调的行(jpeg_rows.MCU_row)，其它行或参数越界时返回NULL
+JPEG_DECODER_API const int16_t *jpeg_decoder_coefficients(struct jpeg_decoder *dec, int MCU_row, int MCU_col, int component, int block_row, int block_col);
+
+// 按段长依次解析区段直到第一个SOS，不读取压缩数据，不分配内存，可以只传文件开头的一部分
+// 找到帧头返回0(数据在SOS之前结束时complete为0)，数据在帧头之前结束返回1，需要更多数据，不是JPEG或区段非法返回-1
+JPEG_DECODER_API int jpeg_decoder_probe(const uint8_t *data, size_t size, struct jpeg_probe_info *info);
+
+// 运行时选用的指令集：none/sse2/avx2
+JPEG_DECODER_API const char *jpeg_decoder_simd_name();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
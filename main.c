@@ -0,0 +1,773 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "thread_pool.h"
+#include "jpeg_decoder.h"
+#include "output.h"
+
+void usage(const char *name)
+{
+    log_("%s [-i int|float|fast] [-u fancy|nearest] [-s 1|2|4|8] [-c x,y,w,h] [-j threads] [-e] [-f formats] [-d json|csv] <filename>\n", name);
+    log_("%s [-i int|float|fast] [-u fancy|nearest] [-s 1|2|4|8] [-f formats] [-d json|csv] -k bytes <filename>\n", name);
+    log_("%s [-i int|float|fast] [-u fancy|nearest] [-s 1|2|4|8] [-c x,y,w,h] [-j threads] [-e] [-f formats] [-d json|csv] [-o dir] <filename|dir|->...\n", name);
+    log_("%s [-i int|float|fast] [-u fancy|nearest] [-s 1|2|4|8] [-c x,y,w,h] [-j threads] [-e] [-f formats] [-d json|csv] -m <filename>\n", name);
+    log_("%s -p <filename|dir|->...\n", name);
+    log_("  -i  IDCT method, int: accurate fixed-point separable (default), float: accurate reference, slow, fast: 16-bit fixed-point AAN, less accurate\n");
+    log_("  -u  chroma upsampling, fancy: triangle filter (default), nearest: replicate\n");
+    log_("  -s  scale denominator, output is 1/N of the original size using reduced IDCTs, default: 1\n");
+    log_("  -c  decode only the rectangle at (x, y) of size w x h in output pixels, only rgb24, rgba and pnm are written\n");
+    log_("  -j  threads, single file: decode restart intervals in parallel, or without restart markers IDCT and color conversion in parallel with entropy decoding, batch: worker threads each decoding one image at a time, default: online CPU count\n");
+    log_("  -e  without restart markers, split the compressed data into one chunk per thread and entropy decode them speculatively in parallel, keeps the whole image in memory\n");
+    log_("  -o  batch output directory, outputs are named after the inputs, default: .\n");
+    log_("  -k  push the file to the decoder in chunks of this many bytes, as if it arrived over the network\n");
+    log_("  -f  comma separated output formats, one file each, default: i420,rgb24\n");
+    log_("      i420, nv12, yuv444p: YUV planes, chroma resampled from the image's sampling, gray images get 128 chroma\n");
+    log_("      rgb24, rgba: packed pixels; pnm: PPM, or PGM for gray images; coef: dequantized coefficients, 64 int16 per block in MCU order\n");
+    log_("  -d  print one line of decoder statistics per image to stdout: stage timings, bits, blocks, EOB positions, zero runs, allocations\n");
+    log_("  -m  motion JPEG, the input is concatenated JPEG frames, decoded by worker threads and written in frame order to one file per format, rgb24 by default, only rgb24, rgba and pnm\n");
+    log_("      frames without DQT/DHT use the tables of the last frame that had them, missing Huffman tables default to the Annex K ones\n");
+    log_("  -p  probe only, print size, sampling and segment layout parsed from the start of each file up to SOS\n");
+    log_("batch mode: several inputs, a directory of .jpg/.jpeg, - for a list of filenames on stdin, or -o given\n");
+}
+
+// 输出区域，width为0时不裁剪
+struct crop
+{
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+// stats_format为JPEG_STATS_JSON/JPEG_STATS_CSV时把解码器的统计输出一行到stdout，批量解码时多个线程同时输出，整行加锁
+void print_stats(struct jpeg_decoder *dec, const char *filename, int stats_format)
+{
+    struct jpeg_stats stats;
+    if (!stats_format)
+        return;
+    if (jpeg_decoder_stats(dec, &stats) != 0)
+    {
+        log_("no statistics for `%s`, the library was built with STATS=0\n", filename);
+        return;
+    }
+
+    flockfile(stdout);
+    jpeg_decoder_write_stats(&stats, filename, stats_format, stdout);
+    funlockfile(stdout);
+}
+
+// 解码一张图像，输出文件名以prefix开头，formats为OUTPUT_I420等的组合，crop不为NULL时只解码该区域，stats_format见print_stats；成功时info为图像信息
+int decode_file(struct jpeg_decoder *dec, const char *filename, const char *prefix, int formats, int stats_format, const struct crop *crop, struct jpeg_info *info)
+{
+    struct output out = {0};
+    struct jpeg_info image_info;
+    int cropped = 0;
+    int ret = -1;
+
+    if (jpeg_decoder_parse_file(dec, filename, &image_info) != 0)
+        goto end;
+
+    if (crop && crop->width > 0)
+    {
+        if (jpeg_decoder_set_crop(dec, crop->x, crop->y, crop->width, crop->height) != 0)
+            goto end;
+        cropped = 1;
+        image_info.width = crop->width;
+        image_info.height = crop->height;
+    }
+
+    if (output_open(&out, formats, prefix, dec, &image_info, cropped) != 0)
+        goto end;
+
+    ret = jpeg_decoder_decode_rows(dec, output_write_rows, &out);
+    if (output_close(&out) != 0) // 写出YUV平面和缓冲中剩余的数据
+        ret = -1;
+    if (ret == 0)
+        print_stats(dec, filename, stats_format);
+    if (info)
+        *info = image_info;
+
+end:
+    output_close(&out); // 出错时关闭已打开的文件
+    jpeg_decoder_reset(dec); // 解除文件映射
+    return ret;
+}
+
+struct push_output
+{
+    struct output out;
+    struct jpeg_decoder *dec;
+    struct jpeg_info info;
+    int formats;
+    const char *prefix;
+    int opened;             // 已打开输出文件
+    int failed;             // 打开输出文件失败
+    size_t pushed_size;     // 已送入解码器的字节数
+    size_t first_row_size;  // 输出第一行MCU时已送入的字节数
+};
+
+// 增量解码的输出回调，第一次回调时图像信息已确定，此时再打开输出文件
+void write_pushed_data(void *opaque, const struct jpeg_rows *rows)
+{
+    struct push_output *push = opaque;
+    if (!push->opened)
+    {
+        if (push->failed || output_open(&push->out, push->formats, push->prefix, push->dec, &push->info, 0) != 0)
+        {
+            push->failed = 1;
+            return;
+        }
+        push->opened = 1;
+        push->first_row_size = push->pushed_size;
+    }
+
+    output_write_rows(&push->out, rows);
+}
+
+// 模拟数据分块到达，每读到chunk_size字节就送入解码器，读完后通知数据结束，formats见decode_file，stats_format见print_stats
+int push_file(struct jpeg_decoder *dec, const char *filename, const char *prefix, size_t chunk_size, int formats, int stats_format)
+{
+    struct push_output push = {0};
+    push.dec = dec;
+    push.formats = formats;
+    push.prefix = prefix;
+    uint8_t *chunk = NULL;
+    int ret = -1;
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+    {
+        log_("fopen `%s` failed: %s\n", filename, strerror(errno));
+        goto end;
+    }
+
+    chunk = malloc(chunk_size);
+    size_t read_size;
+    do
+    {
+        read_size = fread(chunk, 1, chunk_size, fp);
+        push.pushed_size += read_size;
+        ret = jpeg_decoder_push(dec, chunk, read_size, &push.info, write_pushed_data, &push);
+    } while (ret > 0 && read_size > 0);
+
+    if (push.opened && output_close(&push.out) != 0)
+        push.failed = 1;
+    if (ret == 0 && !push.failed)
+    {
+        log_("pushed %zu bytes in %zu byte chunks, first MCU row after %zu bytes\n", push.pushed_size, chunk_size, push.first_row_size);
+        print_stats(dec, filename, stats_format);
+    }
+    ret = ret == 0 && !push.failed ? 0 : -1;
+
+end:
+    if (fp)
+        fclose(fp);
+    free(chunk);
+    output_close(&push.out);
+    jpeg_decoder_reset(dec);
+    return ret;
+}
+
+struct batch
+{
+    char **filenames;
+    int count;
+    const char *output_dir;
+    const struct crop *crop;
+    int formats;                    // 见decode_file
+    int stats_format;               // 见print_stats
+    struct jpeg_decoder **decoders; // 每个工作线程一个，依次解码多张图像
+
+    int next;         // 下一个待解码的文件
+    int failed_count; // 解码失败的文件数
+    long pixel_count; // 已解码的像素总数
+};
+
+// 线程池任务，第task_index个工作线程用自己的解码器不断领取文件解码
+void batch_worker(void *opaque, int task_index)
+{
+    struct batch *batch = opaque;
+
+    int i;
+    while ((i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED)) < batch->count)
+    {
+        // 输出文件以输入文件去掉目录和扩展名命名
+        const char *name = strrchr(batch->filenames[i], '/');
+        name = name ? name + 1 : batch->filenames[i];
+        const char *ext = strrchr(name, '.');
+        int name_length = ext && ext != name ? ext - name : (int)strlen(name);
+
+        char prefix[PATH_MAX] = {0};
+        snprintf(prefix, PATH_MAX, "%s/%.*s", batch->output_dir, name_length, name);
+
+        struct jpeg_info info;
+        if (decode_file(batch->decoders[task_index], batch->filenames[i], prefix, batch->formats, batch->stats_format, batch->crop, &info) != 0)
+        {
+            log_("decode `%s` failed\n", batch->filenames[i]);
+            __atomic_fetch_add(&batch->failed_count, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        __atomic_fetch_add(&batch->pixel_count, (long)info.width * info.height, __ATOMIC_RELAXED);
+    }
+}
+
+void add_batch_file(struct batch *batch, const char *filename)
+{
+    batch->filenames = realloc(batch->filenames, (++batch->count) * sizeof(char *));
+    batch->filenames[batch->count - 1] = strdup(filename);
+}
+
+// 输入可以是文件、目录(其中的.jpg/.jpeg文件)或-(从stdin逐行读取文件名)
+void collect_batch_files(struct batch *batch, const char *input)
+{
+    struct stat st;
+    if (strcmp(input, "-") == 0)
+    {
+        char line[PATH_MAX];
+        while (fgets(line, sizeof(line), stdin))
+        {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] != '\0')
+                add_batch_file(batch, line);
+        }
+    }
+    else if (stat(input, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        DIR *dir = opendir(input);
+        if (!dir)
+        {
+            log_("opendir `%s` failed: %s\n", input, strerror(errno));
+            return;
+        }
+
+        struct dirent *entry;
+        while ((entry = readdir(dir)))
+        {
+            const char *ext = strrchr(entry->d_name, '.');
+            if (!ext || (strcasecmp(ext, ".jpg") != 0 && strcasecmp(ext, ".jpeg") != 0))
+                continue;
+
+            char path[PATH_MAX] = {0};
+            snprintf(path, PATH_MAX, "%s/%s", input, entry->d_name);
+            add_batch_file(batch, path);
+        }
+        closedir(dir);
+    }
+    else
+    {
+        add_batch_file(batch, input);
+    }
+}
+
+// MJPEG流：帧在工作线程之间流水线解码，领取帧和按顺序写出时加锁
+struct stream
+{
+    const char *filename;
+    const uint8_t *data; // 映射的整个文件
+    size_t size;
+    const char *prefix;
+    const struct crop *crop;
+    int formats;                    // 只能为RGB类格式
+    int stats_format;               // 见print_stats
+    struct jpeg_decoder **decoders; // 每个工作线程一个，依次解码领到的帧，保留霍夫曼查找表
+
+    pthread_mutex_t mutex;
+    pthread_cond_t written;      // written_count增加时通知
+    size_t next_offset;          // 从这里查找下一帧
+    int frame_count;             // 已领取的帧数，即下一帧的序号
+    struct jpeg_frame DQT_frame; // 目前最后一个带DQT和带DHT的帧，offset为在整个文件中的偏移，size为0表示还没有
+    struct jpeg_frame DHT_frame;
+    int written_count;           // 已按顺序写出(或失败)的帧数
+    int failed_count;            // 解码失败的帧数
+    struct output out;           // 第一个成功解码的帧写出时打开，以该帧的尺寸命名，之后尺寸不同的帧不写出
+    int opened;
+};
+
+// 解码frame为RGB24，buffer按需扩大，成功时info为帧的信息，宽高为裁剪区域的宽高
+// 解码器中的表先替换为之前最后带DQT和带DHT的帧中的表，按先后顺序取，帧中自己定义的表在解析时覆盖
+int decode_frame(struct stream *stream, struct jpeg_decoder *dec, const struct jpeg_frame *frame, const struct jpeg_frame *table_frames,
+    uint8_t **buffer, size_t *buffer_size, struct jpeg_info *info)
+{
+    const struct jpeg_frame *older = table_frames[0].offset < table_frames[1].offset ? &table_frames[0] : &table_frames[1];
+    const struct jpeg_frame *newer = older == &table_frames[0] ? &table_frames[1] : &table_frames[0];
+    int replace = 1;
+    if (older->size > 0 && older->offset != newer->offset)
+    {
+        if (jpeg_decoder_load_tables(dec, stream->data + older->offset, older->size, replace) != 0)
+            return -1;
+        replace = 0;
+    }
+    if (newer->size > 0 && jpeg_decoder_load_tables(dec, stream->data + newer->offset, newer->size, replace) != 0)
+        return -1;
+    if (jpeg_decoder_parse_headers(dec, stream->data + frame->offset, frame->size, info) != 0)
+        return -1;
+    if (stream->crop->width > 0)
+    {
+        if (jpeg_decoder_set_crop(dec, stream->crop->x, stream->crop->y, stream->crop->width, stream->crop->height) != 0)
+            return -1;
+        info->width = stream->crop->width;
+        info->height = stream->crop->height;
+    }
+
+    size_t frame_size = (size_t)info->width * info->height * 3;
+    if (frame_size > *buffer_size)
+    {
+        uint8_t *new_buffer = realloc(*buffer, frame_size);
+        if (!new_buffer)
+        {
+            log_("realloc %zu bytes failed\n", frame_size);
+            return -1;
+        }
+        *buffer = new_buffer;
+        *buffer_size = frame_size;
+    }
+
+    return jpeg_decoder_decode(dec, *buffer, info->width * 3);
+}
+
+// 轮到第index帧时写出，失败的帧不写出，只计数
+void write_frame(struct stream *stream, int index, int ret, struct jpeg_decoder *dec, const uint8_t *RGB, const struct jpeg_info *info)
+{
+    if (ret == 0 && !stream->opened)
+    {
+        ret = output_open(&stream->out, stream->formats, stream->prefix, NULL, info, 0);
+        stream->opened = ret == 0;
+    }
+    if (ret == 0 && (info->width != stream->out.info.width || info->height != stream->out.info.height))
+    {
+        log_("frame %d is %dx%d, the first frame is %dx%d\n", index, info->width, info->height, stream->out.info.width, stream->out.info.height);
+        ret = -1;
+    }
+    if (ret != 0)
+    {
+        log_("decode frame %d of `%s` failed\n", index, stream->filename);
+        ++stream->failed_count;
+        return;
+    }
+
+    // 整帧作为一行写出，PNM每帧写一个文件头
+    struct jpeg_rows rows = {0};
+    rows.row_count = info->height;
+    rows.RGB = RGB;
+    rows.RGB_stride = info->width * 3;
+    output_write_rows(&stream->out, &rows);
+
+    if (stream->stats_format)
+    {
+        char name[PATH_MAX] = {0};
+        snprintf(name, PATH_MAX, "%s#%d", stream->filename, index);
+        print_stats(dec, name, stream->stats_format);
+    }
+}
+
+// 线程池任务，第task_index个工作线程不断领取下一帧解码，解码完等前面的帧都写出后再写出，保证输出按帧的顺序
+void stream_worker(void *opaque, int task_index)
+{
+    struct stream *stream = opaque;
+    struct jpeg_decoder *dec = stream->decoders[task_index];
+    uint8_t *buffer = NULL;
+    size_t buffer_size = 0;
+
+    while (1)
+    {
+        // 分帧只扫描marker，比解码快得多，在锁内按顺序进行，同时记下每帧之前最后带DQT和带DHT的帧
+        struct jpeg_frame frame, table_frames[2];
+        int index = -1;
+        pthread_mutex_lock(&stream->mutex);
+        if (stream->next_offset < stream->size &&
+            jpeg_decoder_find_frame(stream->data + stream->next_offset, stream->size - stream->next_offset, &frame) == 0)
+        {
+            frame.offset += stream->next_offset;
+            stream->next_offset = frame.offset + frame.size;
+            index = stream->frame_count++;
+            table_frames[0] = stream->DQT_frame;
+            table_frames[1] = stream->DHT_frame;
+            if (frame.has_DQT)
+                stream->DQT_frame = frame;
+            if (frame.has_DHT)
+                stream->DHT_frame = frame;
+        }
+        pthread_mutex_unlock(&stream->mutex);
+        if (index < 0)
+            break;
+
+        if (!frame.complete)
+            log_("frame %d of `%s` at offset %zu has no EOI\n", index, stream->filename, frame.offset);
+
+        struct jpeg_info info;
+        int ret = decode_frame(stream, dec, &frame, table_frames, &buffer, &buffer_size, &info);
+
+        pthread_mutex_lock(&stream->mutex);
+        while (stream->written_count != index)
+            pthread_cond_wait(&stream->written, &stream->mutex);
+        pthread_mutex_unlock(&stream->mutex);
+
+        write_frame(stream, index, ret, dec, buffer, &info);
+        jpeg_decoder_reset(dec);
+
+        pthread_mutex_lock(&stream->mutex);
+        ++stream->written_count;
+        pthread_cond_broadcast(&stream->written);
+        pthread_mutex_unlock(&stream->mutex);
+    }
+
+    free(buffer);
+}
+
+// 解码MJPEG文件，输出文件名以prefix开头，formats中只输出RGB类格式，返回失败的帧数，文件无法读取时返回-1
+int decode_stream(const char *filename, const char *prefix, int thread_count, const struct jpeg_decoder_options *options, int formats, int stats_format,
+    const struct crop *crop)
+{
+    struct stream stream = {0};
+    stream.filename = filename;
+    stream.prefix = prefix;
+    stream.crop = crop;
+    stream.formats = formats & ~OUTPUT_COMPONENT_FORMATS;
+    stream.stats_format = stats_format;
+    pthread_mutex_init(&stream.mutex, NULL);
+    pthread_cond_init(&stream.written, NULL);
+    struct thread_pool *pool = NULL;
+    int ret = -1;
+
+    if (stream.formats != formats)
+        log_("only rgb24, rgba and pnm are written for motion JPEG\n");
+
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        log_("open `%s` failed or empty: %s\n", filename, strerror(errno));
+        goto end;
+    }
+    stream.size = st.st_size;
+    stream.data = mmap(NULL, stream.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (stream.data == MAP_FAILED)
+    {
+        log_("mmap `%s` failed: %s\n", filename, strerror(errno));
+        stream.data = NULL;
+        goto end;
+    }
+    madvise((void *)stream.data, stream.size, MADV_SEQUENTIAL);
+
+    // 帧之间并行，每帧内不再并行解码restart interval；各解码器保留表，没有表的帧从之前带表的帧取表
+    struct jpeg_decoder_options frame_options = *options;
+    frame_options.thread_count = 1;
+    frame_options.keep_tables = 1;
+    pool = thread_pool_create(thread_count);
+    thread_count = thread_pool_size(pool);
+    stream.decoders = calloc(thread_count, sizeof(struct jpeg_decoder *));
+    for (int i = 0; i < thread_count; ++i)
+    {
+        stream.decoders[i] = jpeg_decoder_create(&frame_options);
+        if (!stream.decoders[i])
+            goto end;
+    }
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    thread_pool_run(pool, stream_worker, &stream, thread_count);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    int decoded_count = stream.frame_count - stream.failed_count;
+    log_("stream: %d frames, %d failed, %d threads, %.3f s, %.2f frames/s, %.2f MP/s\n",
+        decoded_count, stream.failed_count, thread_count, seconds,
+        seconds > 0 ? decoded_count / seconds : 0, seconds > 0 ? (double)decoded_count * stream.out.info.width * stream.out.info.height / 1e6 / seconds : 0);
+    ret = stream.frame_count > 0 ? stream.failed_count : -1;
+    if (stream.frame_count == 0)
+        log_("no JPEG frame found in `%s`\n", filename);
+
+end:
+    for (int i = 0; stream.decoders && i < thread_count; ++i)
+        jpeg_decoder_destroy(stream.decoders[i]);
+    free(stream.decoders);
+    thread_pool_destroy(pool);
+    if (stream.opened && output_close(&stream.out) != 0)
+        ret = -1;
+    if (stream.data)
+        munmap((void *)stream.data, stream.size);
+    if (fd >= 0)
+        close(fd);
+    pthread_cond_destroy(&stream.written);
+    pthread_mutex_destroy(&stream.mutex);
+    return ret;
+}
+
+// 只读取文件开头解析到SOS为止，数据不够时每次多读一倍，结果输出一行到stdout
+int probe_file(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp)
+    {
+        log_("fopen `%s` failed: %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    uint8_t *data = NULL;
+    size_t size = 0, capacity = 0;
+    struct jpeg_probe_info info;
+    int ret = -1;
+    while (1)
+    {
+        if (size == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 4096;
+            data = realloc(data, capacity);
+        }
+        size_t read_size = fread(data + size, 1, capacity - size, fp);
+        size += read_size;
+
+        ret = jpeg_decoder_probe(data, size, &info);
+        if (ret < 0 || (ret == 0 && info.complete) || read_size == 0)
+            break;
+    }
+    fclose(fp);
+    free(data);
+
+    if (ret != 0)
+    {
+        log_("probe `%s` failed, %s in %zu bytes\n", filename, ret > 0 ? "frame header not found" : "invalid data", size);
+        return -1;
+    }
+
+    printf("%s: %dx%d, components: %d, sampling:", filename, info.width, info.height, info.component_count);
+    for (int i = 0; i < info.component_count && i < 3; ++i)
+        printf(" %dx%d", info.horizontal_sample_rates[i], info.vertical_sample_rates[i]);
+    printf(", SOF%d, restart interval: %d, %s: %zu bytes read, segments:", info.frame_marker - 0xC0, info.restart_interval,
+        info.complete ? "header" : "truncated", info.complete ? info.header_length : size);
+    for (int i = 0; i < info.segment_count && i < JPEG_PROBE_MAX_SEGMENTS; ++i)
+        printf(" %02X@%zu+%d", info.segments[i].marker, info.segments[i].offset, info.segments[i].length);
+    printf(info.segment_count > JPEG_PROBE_MAX_SEGMENTS ? " ...\n" : "\n");
+
+    return 0;
+}
+
+// 批量解码，每个线程一个解码器串行解码分到的图像，返回失败的文件数
+int decode_batch(struct batch *batch, int thread_count, const struct jpeg_decoder_options *options)
+{
+    struct thread_pool *pool = thread_pool_create(thread_count);
+    thread_count = thread_pool_size(pool);
+    batch->decoders = calloc(thread_count, sizeof(struct jpeg_decoder *));
+    for (int i = 0; i < thread_count; ++i)
+    {
+        batch->decoders[i] = jpeg_decoder_create(options);
+        if (!batch->decoders[i])
+        {
+            batch->failed_count = batch->count;
+            goto end;
+        }
+    }
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    thread_pool_run(pool, batch_worker, batch, thread_count);
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    int decoded_count = batch->count - batch->failed_count;
+    log_("batch: %d images, %d failed, %d threads, %.3f s, %.2f images/s, %.2f MP/s\n",
+        decoded_count, batch->failed_count, thread_count, seconds,
+        seconds > 0 ? decoded_count / seconds : 0, seconds > 0 ? batch->pixel_count / 1e6 / seconds : 0);
+
+end:
+    for (int i = 0; i < thread_count; ++i)
+        jpeg_decoder_destroy(batch->decoders[i]);
+    free(batch->decoders);
+    thread_pool_destroy(pool);
+    return batch->failed_count;
+}
+
+int main(int argc, char *argv[])
+{
+    int ret = 1;
+    int opt;
+    int thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    struct jpeg_decoder_options options = {0};
+    const char *output_dir = NULL;
+    int probe = 0;
+    struct crop crop = {0};
+    long chunk_size = 0;
+    int stats_format = 0;
+    int stream = 0;
+    int formats = 0; // 0为没有指定-f
+    while ((opt = getopt(argc, argv, "i:u:s:c:j:k:f:d:o:emp")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            if (strcmp(optarg, "int") == 0)
+                options.idct_method = JPEG_IDCT_INT;
+            else if (strcmp(optarg, "float") == 0)
+                options.idct_method = JPEG_IDCT_FLOAT;
+            else if (strcmp(optarg, "fast") == 0)
+                options.idct_method = JPEG_IDCT_FAST;
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'u':
+            if (strcmp(optarg, "fancy") == 0)
+                options.upsample_method = JPEG_UPSAMPLE_FANCY;
+            else if (strcmp(optarg, "nearest") == 0)
+                options.upsample_method = JPEG_UPSAMPLE_NEAREST;
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            options.scale_denom = atoi(optarg);
+            if (options.scale_denom != 1 && options.scale_denom != 2 && options.scale_denom != 4 && options.scale_denom != 8)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'c':
+            if (sscanf(optarg, "%d,%d,%d,%d", &crop.x, &crop.y, &crop.width, &crop.height) != 4 || crop.width <= 0 || crop.height <= 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'j':
+            thread_count = atoi(optarg);
+            if (thread_count < 1)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'k':
+            chunk_size = atol(optarg);
+            if (chunk_size < 1)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'f':
+            formats = output_parse_formats(optarg);
+            if (!formats)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'd':
+            if (strcmp(optarg, "json") == 0)
+                stats_format = JPEG_STATS_JSON;
+            else if (strcmp(optarg, "csv") == 0)
+                stats_format = JPEG_STATS_CSV;
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            options.collect_stats = 1;
+            break;
+        case 'o':
+            output_dir = optarg;
+            break;
+        case 'e':
+            options.speculative = 1;
+            break;
+        case 'm':
+            stream = 1;
+            break;
+        case 'p':
+            probe = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // 默认格式中的I420在MJPEG和裁剪时不输出，不必提示
+    if (!formats)
+        formats = stream || crop.width > 0 ? OUTPUT_RGB24 : OUTPUT_DEFAULT_FORMATS;
+
+    struct batch batch = {0};
+    if (probe)
+    {
+        for (int i = optind; i < argc; ++i)
+            collect_batch_files(&batch, argv[i]);
+        ret = 0;
+        for (int i = 0; i < batch.count; ++i)
+        {
+            if (probe_file(batch.filenames[i]) != 0)
+                ret = 1;
+        }
+        goto end;
+    }
+
+    log_("idct: %s, upsample: %s, scale: 1/%d, simd: %s, threads: %d\n",
+        options.idct_method == JPEG_IDCT_FLOAT ? "float" : options.idct_method == JPEG_IDCT_FAST ? "fast" : "int",
+        options.upsample_method == JPEG_UPSAMPLE_NEAREST ? "nearest" : "fancy",
+        options.scale_denom > 1 ? options.scale_denom : 1, jpeg_decoder_simd_name(), thread_count);
+
+    if (stats_format == JPEG_STATS_CSV)
+        jpeg_decoder_write_stats(NULL, NULL, JPEG_STATS_CSV, stdout);
+
+    if (stream)
+    {
+        if (optind + 1 != argc || output_dir || chunk_size > 0)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        return decode_stream(argv[optind], "decoded", thread_count, &options, formats, stats_format, &crop) == 0 ? 0 : 1;
+    }
+
+    // 单个文件时在当前目录输出固定文件名；多个输入、目录、stdin列表或指定了输出目录时为批量模式
+    struct stat st;
+    const char *input = argv[optind];
+    if (optind + 1 == argc && !output_dir && strcmp(input, "-") != 0 && !(stat(input, &st) == 0 && S_ISDIR(st.st_mode)))
+    {
+        options.thread_count = thread_count;
+        struct jpeg_decoder *dec = jpeg_decoder_create(&options);
+        if (dec && chunk_size > 0)
+            ret = push_file(dec, input, "decoded", chunk_size, formats, stats_format) == 0 ? 0 : 1;
+        else if (dec)
+            ret = decode_file(dec, input, "decoded", formats, stats_format, &crop, NULL) == 0 ? 0 : 1;
+        jpeg_decoder_destroy(dec);
+        return ret;
+    }
+
+    batch.output_dir = output_dir ? output_dir : ".";
+    batch.crop = &crop;
+    batch.formats = formats;
+    batch.stats_format = stats_format;
+    for (int i = optind; i < argc; ++i)
+        collect_batch_files(&batch, argv[i]);
+
+    ret = decode_batch(&batch, thread_count, &options) == 0 ? 0 : 1;
+
+end:
+    for (int i = 0; i < batch.count; ++i)
+        free(batch.filenames[i]);
+    free(batch.filenames);
+    return ret;
+}
@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "log.h"
+#include "output.h"
+
+#define min(_a, _b) ((_a) < (_b) ? (_a) : (_b))
+
+#define OUTPUT_BUFFER_SIZE (1 << 20) // 每个文件的写缓冲，逐行写入的数据攒满后一次write
+
+// 按格式的bit位置排列，suffix为NULL时文件名由格式自己决定
+static const struct
+{
+    const char *name;
+    const char *suffix;
+} format_infos[OUTPUT_FORMAT_COUNT] = {
+    {"i420", "_I420.yuv"},
+    {"nv12", "_NV12.yuv"},
+    {"yuv444p", "_444P.yuv"},
+    {"rgb24", "_RGB24.yuv"},
+    {"rgba", "_RGBA.yuv"},
+    {"pnm", NULL},
+    {"coef", "_coefficients.raw"},
+};
+
+int output_parse_formats(const char *names)
+{
+    int formats = 0;
+    const char *p = names;
+    while (*p)
+    {
+        int length = strcspn(p, ",");
+        int i = 0;
+        while (i < OUTPUT_FORMAT_COUNT && !(strlen(format_infos[i].name) == (size_t)length && strncmp(p, format_infos[i].name, length) == 0))
+            ++i;
+        if (i == OUTPUT_FORMAT_COUNT)
+        {
+            log_("unknown output format `%.*s`\n", length, p);
+            return 0;
+        }
+        formats |= 1 << i;
+        p += length + (p[length] == ',');
+    }
+
+    return formats;
+}
+
+// 写出iov中的全部数据，处理被信号打断和部分写入
+static int write_vector(int fd, struct iovec *iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t ret = writev(fd, iov, count);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+        {
+            log_("write failed: %s\n", strerror(errno));
+            return -1;
+        }
+
+        while (count > 0 && (size_t)ret >= iov->iov_len)
+        {
+            ret -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (uint8_t *)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
+}
+
+static int flush_file(struct output *out, struct output_file *file)
+{
+    struct iovec iov = {file->buffer, file->length};
+    file->length = 0;
+    if (!out->failed && iov.iov_len > 0 && write_vector(file->fd, &iov, 1) != 0)
+        out->failed = 1;
+    return out->failed ? -1 : 0;
+}
+
+// 数据先复制到缓冲，放不下时先写出缓冲，不小于缓冲的数据直接写出
+static void write_file(struct output *out, struct output_file *file, const void *data, size_t size)
+{
+    if (file->length + size > OUTPUT_BUFFER_SIZE && flush_file(out, file) != 0)
+        return;
+
+    if (size >= OUTPUT_BUFFER_SIZE)
+    {
+        struct iovec iov = {(void *)data, size};
+        if (write_vector(file->fd, &iov, 1) != 0)
+            out->failed = 1;
+        return;
+    }
+
+    memcpy(file->buffer + file->length, data, size);
+    file->length += size;
+}
+
+int output_open(struct output *out, int formats, const char *prefix, struct jpeg_decoder *dec, const struct jpeg_info *info, int cropped)
+{
+    memset(out, 0, sizeof(struct output));
+    out->dec = dec;
+    out->info = *info;
+    out->formats = formats;
+    if (cropped && (formats & OUTPUT_COMPONENT_FORMATS))
+    {
+        log_("component planes and coefficients are not written when cropping\n");
+        out->formats &= ~OUTPUT_COMPONENT_FORMATS;
+    }
+
+    for (int i = 0; i < OUTPUT_FORMAT_COUNT; ++i)
+    {
+        if (!(out->formats & (1 << i)))
+            continue;
+
+        char filename[PATH_MAX] = {0};
+        if (format_infos[i].suffix)
+            snprintf(filename, PATH_MAX, "%s_%dx%d%s", prefix, info->width, info->height, format_infos[i].suffix);
+        else
+            snprintf(filename, PATH_MAX, "%s_%dx%d.%s", prefix, info->width, info->height, info->component_count == 1 ? "pgm" : "ppm");
+
+        struct output_file *file = &out->files[i];
+        file->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (file->fd < 0)
+        {
+            log_("open output file `%s` failed: %s\n", filename, strerror(errno));
+            goto fail;
+        }
+        file->buffer = malloc(OUTPUT_BUFFER_SIZE);
+        if (!file->buffer)
+        {
+            close(file->fd);
+            goto fail;
+        }
+    }
+
+    for (int i = 0; i < info->component_count && (out->formats & (OUTPUT_I420 | OUTPUT_NV12 | OUTPUT_YUV444P)); ++i)
+    {
+        out->planes[i] = malloc((size_t)info->component_widths[i] * info->component_heights[i]);
+        if (!out->planes[i])
+            goto fail;
+    }
+    out->row = malloc((size_t)info->width * 4);
+    if (!out->row)
+        goto fail;
+
+    return 0;
+
+fail:
+    out->failed = 1;
+    output_close(out);
+    return -1;
+}
+
+// 写出第MCU_row行MCU的全部系数，只能在这一行的回调中取
+static void write_coefficients(struct output *out, int MCU_row)
+{
+    struct jpeg_info *info = &out->info;
+    struct output_file *file = &out->files[__builtin_ctz(OUTPUT_COEFFICIENTS)];
+    for (int MCU_col = 0; MCU_col < info->horizontal_MCU_count; ++MCU_col)
+    {
+        for (int component = 0; component < info->component_count; ++component)
+        {
+            for (int block_row = 0; block_row < info->vertical_sample_rates[component]; ++block_row)
+            {
+                for (int block_col = 0; block_col < info->horizontal_sample_rates[component]; ++block_col)
+                {
+                    const int16_t *coefficients = jpeg_decoder_coefficients(out->dec, MCU_row, MCU_col, component, block_row, block_col);
+                    write_file(out, file, coefficients, 64 * sizeof(int16_t));
+                }
+            }
+        }
+    }
+}
+
+void output_write_rows(void *opaque, const struct jpeg_rows *rows)
+{
+    struct output *out = opaque;
+    struct jpeg_info *info = &out->info;
+    if (out->failed)
+        return;
+
+    // 分量平面复制到整幅平面中的对应位置，去掉补齐MCU的部分
+    for (int component = 0; component < info->component_count && out->planes[component] && rows->planes[component]; ++component)
+    {
+        int width = info->component_widths[component];
+        int first_row = rows->MCU_row * rows->plane_row_counts[component];
+        int row_count = min(rows->plane_row_counts[component], info->component_heights[component] - first_row);
+        for (int i = 0; i < row_count; ++i)
+            memcpy(out->planes[component] + (size_t)(first_row + i) * width, rows->planes[component] + i * rows->plane_strides[component], width);
+    }
+    if ((out->formats & OUTPUT_COEFFICIENTS) && rows->planes[0])
+        write_coefficients(out, rows->MCU_row);
+
+    int width = info->width;
+    if (out->formats & OUTPUT_RGB24)
+    {
+        struct output_file *file = &out->files[__builtin_ctz(OUTPUT_RGB24)];
+        if (rows->RGB_stride == width * 3) // 行之间没有间隔时整块写入
+            write_file(out, file, rows->RGB, (size_t)rows->row_count * width * 3);
+        else
+            for (int i = 0; i < rows->row_count; ++i)
+                write_file(out, file, rows->RGB + (size_t)i * rows->RGB_stride, width * 3);
+    }
+    if (out->formats & OUTPUT_RGBA)
+    {
+        struct output_file *file = &out->files[__builtin_ctz(OUTPUT_RGBA)];
+        for (int i = 0; i < rows->row_count; ++i)
+        {
+            const uint8_t *RGB = rows->RGB + (size_t)i * rows->RGB_stride;
+            for (int x = 0; x < width; ++x)
+            {
+                out->row[x * 4] = RGB[x * 3];
+                out->row[x * 4 + 1] = RGB[x * 3 + 1];
+                out->row[x * 4 + 2] = RGB[x * 3 + 2];
+                out->row[x * 4 + 3] = 255;
+            }
+            write_file(out, file, out->row, width * 4);
+        }
+    }
+    if (out->formats & OUTPUT_PNM)
+    {
+        struct output_file *file = &out->files[__builtin_ctz(OUTPUT_PNM)];
+        int gray = info->component_count == 1;
+        if (rows->y == 0)
+        {
+            char header[64];
+            int length = snprintf(header, sizeof(header), "P%d\n%d %d\n255\n", gray ? 5 : 6, width, info->height);
+            write_file(out, file, header, length);
+        }
+        for (int i = 0; i < rows->row_count; ++i)
+        {
+            const uint8_t *RGB = rows->RGB + (size_t)i * rows->RGB_stride;
+            if (gray) // 灰度图的RGB三个值相同
+            {
+                for (int x = 0; x < width; ++x)
+                    out->row[x] = RGB[x * 3];
+                write_file(out, file, out->row, width);
+            }
+            else
+            {
+                write_file(out, file, RGB, width * 3);
+            }
+        }
+    }
+}
+
+// 把sw x sh的平面缩放为dw x dh，各方向按整数倍：缩小时取倍数大小的方块平均，放大时复制最近的采样
+static void resample_plane(const uint8_t *src, int sw, int sh, uint8_t *dst, int dw, int dh)
+{
+    int down_x = sw > dw ? (sw + dw / 2) / dw : 1;
+    int down_y = sh > dh ? (sh + dh / 2) / dh : 1;
+    int up_x = dw > sw ? (dw + sw / 2) / sw : 1;
+    int up_y = dh > sh ? (dh + sh / 2) / sh : 1;
+    for (int y = 0; y < dh; ++y)
+    {
+        int y0 = min(y / up_y * down_y, sh - 1);
+        int y1 = min(y0 + down_y, sh);
+        for (int x = 0; x < dw; ++x)
+        {
+            int x0 = min(x / up_x * down_x, sw - 1);
+            int x1 = min(x0 + down_x, sw);
+            int sum = 0;
+            for (int i = y0; i < y1; ++i)
+                for (int j = x0; j < x1; ++j)
+                    sum += src[(size_t)i * sw + j];
+            int count = (y1 - y0) * (x1 - x0);
+            dst[(size_t)y * dw + x] = (sum + count / 2) / count;
+        }
+    }
+}
+
+// 色度转换为dw x dh的U/V平面，尺寸与解码得到的相同时直接使用，灰度图的色度为128；chroma中为需要释放的缓冲
+static int convert_chroma(struct output *out, int dw, int dh, const uint8_t *planes[2], uint8_t *chroma[2])
+{
+    struct jpeg_info *info = &out->info;
+    for (int i = 0; i < 2; ++i)
+    {
+        int component = i + 1;
+        int sw = info->component_widths[component], sh = info->component_heights[component];
+        chroma[i] = NULL;
+        if (info->component_count > 1 && sw == dw && sh == dh)
+        {
+            planes[i] = out->planes[component];
+            continue;
+        }
+
+        chroma[i] = malloc((size_t)dw * dh);
+        if (!chroma[i])
+            return -1;
+        if (info->component_count > 1)
+            resample_plane(out->planes[component], sw, sh, chroma[i], dw, dh);
+        else
+            memset(chroma[i], 128, (size_t)dw * dh);
+        planes[i] = chroma[i];
+    }
+
+    return 0;
+}
+
+// 整幅的YUV平面在关闭时转换并写出，每个文件一次writev
+static void write_YUV(struct output *out)
+{
+    struct jpeg_info *info = &out->info;
+    size_t luma_size = (size_t)info->width * info->height;
+    const uint8_t *planes[2];
+    uint8_t *chroma[2] = {NULL, NULL};
+    uint8_t *UV = NULL;
+
+    if (out->formats & (OUTPUT_I420 | OUTPUT_NV12))
+    {
+        int dw = (info->width + 1) / 2, dh = (info->height + 1) / 2;
+        size_t chroma_size = (size_t)dw * dh;
+        if (convert_chroma(out, dw, dh, planes, chroma) != 0)
+            goto fail;
+
+        if (out->formats & OUTPUT_I420)
+        {
+            struct iovec iov[3] = {{out->planes[0], luma_size}, {(void *)planes[0], chroma_size}, {(void *)planes[1], chroma_size}};
+            if (flush_file(out, &out->files[__builtin_ctz(OUTPUT_I420)]) != 0 || write_vector(out->files[__builtin_ctz(OUTPUT_I420)].fd, iov, 3) != 0)
+                goto fail;
+        }
+        if (out->formats & OUTPUT_NV12)
+        {
+            UV = malloc(chroma_size * 2);
+            if (!UV)
+                goto fail;
+            for (size_t i = 0; i < chroma_size; ++i)
+            {
+                UV[i * 2] = planes[0][i];
+                UV[i * 2 + 1] = planes[1][i];
+            }
+            struct iovec iov[2] = {{out->planes[0], luma_size}, {UV, chroma_size * 2}};
+            if (flush_file(out, &out->files[__builtin_ctz(OUTPUT_NV12)]) != 0 || write_vector(out->files[__builtin_ctz(OUTPUT_NV12)].fd, iov, 2) != 0)
+                goto fail;
+        }
+        free(chroma[0]);
+        free(chroma[1]);
+        chroma[0] = chroma[1] = NULL;
+    }
+
+    if (out->formats & OUTPUT_YUV444P)
+    {
+        if (convert_chroma(out, info->width, info->height, planes, chroma) != 0)
+            goto fail;
+        struct iovec iov[3] = {{out->planes[0], luma_size}, {(void *)planes[0], luma_size}, {(void *)planes[1], luma_size}};
+        if (flush_file(out, &out->files[__builtin_ctz(OUTPUT_YUV444P)]) != 0 || write_vector(out->files[__builtin_ctz(OUTPUT_YUV444P)].fd, iov, 3) != 0)
+            goto fail;
+    }
+
+    goto end;
+
+fail:
+    log_("write YUV planes failed\n");
+    out->failed = 1;
+end:
+    free(chroma[0]);
+    free(chroma[1]);
+    free(UV);
+}
+
+int output_close(struct output *out)
+{
+    if (!out->failed && (out->formats & (OUTPUT_I420 | OUTPUT_NV12 | OUTPUT_YUV444P)))
+        write_YUV(out);
+
+    for (int i = 0; i < OUTPUT_FORMAT_COUNT; ++i)
+    {
+        struct output_file *file = &out->files[i];
+        if (!file->buffer) // 没有打开
+            continue;
+        flush_file(out, file);
+        if (close(file->fd) != 0)
+            out->failed = 1;
+        free(file->buffer);
+        file->buffer = NULL;
+    }
+
+    for (int i = 0; i < 3; ++i)
+    {
+        free(out->planes[i]);
+        out->planes[i] = NULL;
+    }
+    free(out->row);
+    out->row = NULL;
+    out->formats = 0;
+
+    return out->failed ? -1 : 0;
+}
@@ -0,0 +1,55 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "jpeg_decoder.h"
+
+// 输出格式，可以同时输出多种，每种一个文件
+#define OUTPUT_I420 0x01         // Y平面，之后为1/2 x 1/2的U/V平面
+#define OUTPUT_NV12 0x02         // Y平面，之后为1/2 x 1/2的UV交错平面
+#define OUTPUT_YUV444P 0x04      // 全分辨率的Y/U/V平面
+#define OUTPUT_RGB24 0x08        // 每像素RGB 3字节
+#define OUTPUT_RGBA 0x10         // 每像素RGBA 4字节，A为255
+#define OUTPUT_PNM 0x20          // 彩色为PPM(P6)，灰度为PGM(P5)
+#define OUTPUT_COEFFICIENTS 0x40 // 按MCU顺序，每个MCU中依次为Y/Cb/Cr的各block，每个block为64个自然顺序的int16反量化系数，主机字节序
+#define OUTPUT_FORMAT_COUNT 7
+
+// 需要分量平面或系数，裁剪解码时这些数据只有区域覆盖的MCU有效，不输出
+#define OUTPUT_COMPONENT_FORMATS (OUTPUT_I420 | OUTPUT_NV12 | OUTPUT_YUV444P | OUTPUT_COEFFICIENTS)
+#define OUTPUT_DEFAULT_FORMATS (OUTPUT_I420 | OUTPUT_RGB24)
+
+// 带缓冲的输出文件，缓冲满时一次write
+struct output_file
+{
+    int fd;
+    uint8_t *buffer; // 为NULL时没有打开
+    size_t length;   // 缓冲中的字节数
+};
+
+// 一张图像的输出，RGB类格式逐行经缓冲写出；YUV格式先把各分量复制到整幅平面，关闭时转换后每个文件一次writev写出
+struct output
+{
+    int formats; // 实际输出的格式，OUTPUT_I420等的组合
+    struct jpeg_decoder *dec;
+    struct jpeg_info info; // 裁剪时宽高为区域的宽高
+    int failed;            // 写入失败后不再写入
+
+    struct output_file files[OUTPUT_FORMAT_COUNT]; // 按格式的bit位置存放
+    uint8_t *planes[3];                            // 各分量的整幅平面，大小为info中的component_widths x component_heights
+    uint8_t *row;                                  // RGBA/PGM转换一行用
+};
+
+// 解析逗号分隔的格式名：i420,nv12,yuv444p,rgb24,rgba,pnm,coef，返回格式组合，有无法识别的名称时返回0
+int output_parse_formats(const char *names);
+
+// 输出文件名为<prefix>_<宽>x<高>_I420.yuv等，cropped非0时去掉OUTPUT_COMPONENT_FORMATS，dec用于取系数，成功返回0
+int output_open(struct output *out, int formats, const char *prefix, struct jpeg_decoder *dec, const struct jpeg_info *info, int cropped);
+
+// 解码的输出回调，opaque为struct output；planes为NULL时(整幅RGB缓冲)只写RGB类格式，PNM在y为0时写文件头，用于逐帧追加
+void output_write_rows(void *opaque, const struct jpeg_rows *rows);
+
+// 写出YUV平面和缓冲中剩余的数据并关闭，没有打开时也可以调用，全部写入成功返回0
+int output_close(struct output *out);
+
+#endif
@@ -0,0 +1,31 @@
+#include "simd.h"
+
+static int level; // CPUID检测到的可用指令集
+
+// 检测CPU支持的指令集，程序启动时调用一次，各模块据此选择kernel
+void simd_init()
+{
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        level = SIMD_AVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        level = SIMD_SSE2;
+#endif
+}
+
+int simd_level()
+{
+    return level;
+}
+
+const char *simd_name(int level)
+{
+    switch (level)
+    {
+    case SIMD_NONE: return "none";
+    case SIMD_SSE2: return "sse2";
+    case SIMD_AVX2: return "avx2";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#endif
+
+#define SIMD_NONE 0 // 纯C实现，所有平台可用
+#define SIMD_SSE2 1
+#define SIMD_AVX2 2
+
+void simd_init();
+int simd_level();
+const char *simd_name(int level);
+
+#endif
@@ -0,0 +1,148 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "log.h"
+#include "thread_pool.h"
+
+struct thread_pool
+{
+    pthread_t *threads;
+    int thread_count; // 工作线程数，不含调用线程
+
+    pthread_mutex_t mutex;
+    pthread_cond_t start_cond; // 有新一批任务或需要退出
+    pthread_cond_t done_cond;  // 所有工作线程都已完成本批任务
+    int generation;            // 每批任务加1，工作线程据此判断是否有新任务
+    int finished_workers;      // 已完成本批任务的工作线程数
+    int quit;
+
+    thread_task_func func;
+    void *opaque;
+    int task_count;
+    int next_task; // 下一个待领取的任务
+};
+
+// 不断领取任务执行，直到本批任务全部被领取
+static void run_tasks(struct thread_pool *pool)
+{
+    while (1)
+    {
+        pthread_mutex_lock(&pool->mutex);
+        int task_index = pool->next_task++;
+        pthread_mutex_unlock(&pool->mutex);
+
+        if (task_index >= pool->task_count)
+            break;
+        pool->func(pool->opaque, task_index);
+    }
+}
+
+static void *worker(void *arg)
+{
+    struct thread_pool *pool = arg;
+    int generation = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (1)
+    {
+        while (!pool->quit && pool->generation == generation)
+            pthread_cond_wait(&pool->start_cond, &pool->mutex);
+        if (pool->quit)
+            break;
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->mutex);
+
+        run_tasks(pool);
+
+        // 每个工作线程每批都要报告完成，保证run返回后不会有线程还在读上一批的任务
+        pthread_mutex_lock(&pool->mutex);
+        if (++pool->finished_workers == pool->thread_count)
+            pthread_cond_signal(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+struct thread_pool *thread_pool_create(int thread_count)
+{
+    struct thread_pool *pool = calloc(1, sizeof(struct thread_pool));
+    if (!pool)
+    {
+        log_("calloc failed\n");
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    if (thread_count > 1)
+    {
+        pool->threads = calloc(thread_count - 1, sizeof(pthread_t));
+        for (int i = 0; pool->threads && i < thread_count - 1; ++i)
+        {
+            int ret = pthread_create(&pool->threads[i], NULL, worker, pool);
+            if (ret != 0)
+            {
+                log_("pthread_create failed: %s, use %d threads\n", strerror(ret), i + 1);
+                break;
+            }
+            ++pool->thread_count;
+        }
+    }
+
+    return pool;
+}
+
+void thread_pool_destroy(struct thread_pool *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->thread_count; ++i)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->start_cond);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->threads);
+    free(pool);
+}
+
+int thread_pool_size(struct thread_pool *pool)
+{
+    return pool ? pool->thread_count + 1 : 1;
+}
+
+void thread_pool_run(struct thread_pool *pool, thread_task_func func, void *opaque, int task_count)
+{
+    if (!pool || pool->thread_count == 0)
+    {
+        for (int i = 0; i < task_count; ++i)
+            func(opaque, i);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->func = func;
+    pool->opaque = opaque;
+    pool->task_count = task_count;
+    pool->next_task = 0;
+    pool->finished_workers = 0;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->start_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    run_tasks(pool);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->finished_workers < pool->thread_count)
+        pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
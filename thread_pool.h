@@ -0,0 +1,17 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// 执行第task_index个任务
+typedef void (*thread_task_func)(void *opaque, int task_index);
+
+struct thread_pool;
+
+// thread_count包含调用线程本身，<=1时不创建工作线程，任务全部在调用线程中执行
+struct thread_pool *thread_pool_create(int thread_count);
+void thread_pool_destroy(struct thread_pool *pool);
+int thread_pool_size(struct thread_pool *pool);
+
+// 执行task_count个任务，调用线程也参与执行，全部任务完成后返回；pool为NULL时串行执行
+void thread_pool_run(struct thread_pool *pool, thread_task_func func, void *opaque, int task_count);
+
+#endif